@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Runtime support for generated selections: adaptive ordering of conjuncts.
+ * Every sample_period-th tuple evaluates all conjuncts and measures them;
+ * the other tuples run the conjuncts in the current order with early exit.
+ */
+inline uint64_t adaptive_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+template <unsigned N>
+struct Adaptive_Conjunction {
+	static const uint32_t sample_period = 128;
+	static const uint32_t samples_per_reorder = 32;
+
+	unsigned order[N];
+	uint64_t evaluated[N];
+	uint64_t passed[N];
+	uint64_t cycles[N];
+	uint32_t countdown = sample_period;
+	uint32_t samples = 0;
+	uint64_t overhead = 0;
+
+	// static_cost: cost estimates from the generator, used until samples arrive
+	Adaptive_Conjunction(const unsigned (&static_cost)[N]) {
+		for (unsigned i = 0; i < N; ++i) {
+			order[i] = i;
+			evaluated[i] = 1;
+			passed[i] = 1;
+			cycles[i] = static_cost[i];
+		}
+		uint64_t t0 = adaptive_clock();
+		overhead = adaptive_clock() - t0;
+		reorder();
+	}
+
+	bool sample() {
+		if (--countdown != 0) return false;
+		countdown = sample_period;
+		return true;
+	}
+
+	void record(unsigned i, bool pass, uint64_t t0, uint64_t t1) {
+		uint64_t spent = t1 - t0;
+		spent = spent > overhead ? spent - overhead : 1;
+		evaluated[i] += 1;
+		passed[i] += pass;
+		cycles[i] += spent;
+		if (i == N-1 && ++samples == samples_per_reorder) {
+			samples = 0;
+			reorder();
+		}
+	}
+
+	// rank = cost / (1 - selectivity), ascending; history is halved so that
+	// the order follows drifting data
+	void reorder() {
+		double rank[N];
+		for (unsigned i = 0; i < N; ++i) {
+			double sel = double(passed[i]) / double(evaluated[i] + 1);
+			double cost = double(cycles[i]) / double(evaluated[i]);
+			rank[i] = cost / (1.0 - sel);
+			evaluated[i] = (evaluated[i] >> 1) + 1;
+			passed[i] >>= 1;
+			cycles[i] = (cycles[i] >> 1) + 1;
+		}
+		std::sort(order, order + N, [&rank](unsigned a, unsigned b) {return rank[a] < rank[b];});
+	}
+};
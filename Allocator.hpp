@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <new>
+#include <vector>
+#include <atomic>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * Allocation layer for generated table columns and operator state.
+ * Requests of at least large_size bytes are served by mmap in multiples of
+ * 2MB, so that they can be backed by transparent or explicit huge pages and
+ * placed on NUMA nodes; smaller requests go to malloc.
+ * Configure once at startup, before tables are loaded.
+ */
+namespace alloc {
+	enum class Pages : unsigned {Default, Transparent, Explicit};
+	enum class Placement : unsigned {FirstTouch, Interleave};
+
+	const size_t huge_page_size = size_t(1) << 21;
+	const size_t large_size = huge_page_size;
+	const size_t alignment = 64;
+
+	struct Config {
+		Pages pages = Pages::Default;
+		Placement placement = Placement::FirstTouch;
+	};
+
+	inline Config& config() {
+		static Config c;
+		return c;
+	}
+
+	// DB_PAGES=thp|explicit, DB_NUMA=interleave
+	inline void configure_from_env() {
+		const char* pages = getenv("DB_PAGES");
+		const char* numa = getenv("DB_NUMA");
+		if (pages && strcmp(pages, "thp") == 0) config().pages = Pages::Transparent;
+		if (pages && strcmp(pages, "explicit") == 0) config().pages = Pages::Explicit;
+		if (numa && strcmp(numa, "interleave") == 0) config().placement = Placement::Interleave;
+	}
+
+	// number of configured NUMA nodes (1 if the kernel reports none)
+	inline unsigned node_count() {
+		static unsigned count = 0;
+		if (count == 0) {
+			unsigned last = 0;
+			FILE* f = fopen("/sys/devices/system/node/possible", "r");
+			if (f) {
+				unsigned first = 0;
+				int n = fscanf(f, "%u-%u", &first, &last);
+				if (n < 2) last = first;
+				fclose(f);
+			}
+			count = last + 1;
+		}
+		return count;
+	}
+
+	// NUMA node backing addr, -1 if unknown (e.g. page not touched yet)
+	inline int node_of(const void* addr) {
+#ifdef SYS_get_mempolicy
+		int node = -1;
+		const unsigned long MPOL_F_NODE = 1, MPOL_F_ADDR = 2;
+		if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) == 0) return node;
+#endif
+		return -1;
+	}
+
+	// NUMA node of the calling thread
+	inline unsigned current_node() {
+		unsigned cpu = 0, node = 0;
+#ifdef SYS_getcpu
+		if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) node = 0;
+#endif
+		return node;
+	}
+
+	inline void interleave(void* mem, size_t bytes) {
+#ifdef SYS_mbind
+		const int MPOL_INTERLEAVE = 3;
+		unsigned nodes = node_count();
+		if (nodes < 2) return;
+		std::vector<unsigned long> mask((nodes + 63) / 64, 0);
+		for (unsigned n = 0; n < nodes; ++n) mask[n / 64] |= 1ul << (n % 64);
+		syscall(SYS_mbind, mem, bytes, MPOL_INTERLEAVE, mask.data(), nodes + 1, 0);
+#endif
+	}
+
+	inline size_t mapped_size(size_t bytes) {
+		return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+	}
+
+	inline void* allocate(size_t bytes) {
+		if (bytes < large_size) {
+			void* mem = nullptr;
+			if (posix_memalign(&mem, alignment, bytes) != 0) throw std::bad_alloc();
+			return mem;
+		}
+		size_t size = mapped_size(bytes);
+		const Config& c = config();
+		void* mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if (c.pages == Pages::Explicit) {
+			mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		}
+#endif
+		if (mem == MAP_FAILED) {
+			// no explicit huge pages reserved: fall back to transparent ones
+			mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+			if (c.pages != Pages::Default) madvise(mem, size, MADV_HUGEPAGE);
+#endif
+		}
+		if (c.placement == Placement::Interleave) interleave(mem, size);
+		return mem;
+	}
+
+	inline void deallocate(void* mem, size_t bytes) {
+		if (mem == nullptr) return;
+		if (bytes < large_size) {
+			free(mem);
+		} else {
+			munmap(mem, mapped_size(bytes));
+		}
+	}
+}
+
+// std allocator over alloc::allocate(); used by generated columns, indices and operator state
+template <class T>
+struct Column_Allocator {
+	using value_type = T;
+	Column_Allocator() {}
+	template <class U> Column_Allocator(const Column_Allocator<U>&) {}
+	T* allocate(size_t n) {return static_cast<T*>(alloc::allocate(n * sizeof(T)));}
+	void deallocate(T* p, size_t n) {alloc::deallocate(p, n * sizeof(T));}
+	template <class U> bool operator==(const Column_Allocator<U>&) const {return true;}
+	template <class U> bool operator!=(const Column_Allocator<U>&) const {return false;}
+};
+
+/**
+ * Hands out morsels of [0, size) to worker threads, preferring morsels whose
+ * data lives on the worker's NUMA node; a worker whose node has run dry
+ * steals from the other nodes.
+ */
+struct Morsel_Dispatcher {
+	struct Range {
+		size_t begin;
+		size_t end;
+	};
+	struct Queue {
+		std::vector<Range> morsels;
+		std::atomic<size_t> next;
+		Queue() : next(0) {}
+		Queue(const Queue& q) : morsels(q.morsels), next(q.next.load()) {}
+	};
+	std::vector<Queue> queues;// by node
+
+	// element_at(i) yields the address of element i of the column used for placement
+	template <class Element_At>
+	Morsel_Dispatcher(size_t size, size_t morsel_size, Element_At element_at) : queues(alloc::node_count()) {
+		for (size_t begin = 0; begin < size; begin += morsel_size) {
+			size_t end = begin + morsel_size < size ? begin + morsel_size : size;
+			int node = alloc::node_of(element_at(begin));
+			queues[node < 0 || unsigned(node) >= queues.size() ? 0 : node].morsels.push_back({begin, end});
+		}
+	}
+
+	// false once all morsels are taken
+	bool next(unsigned node, Range& range) {
+		for (size_t i = 0; i < queues.size(); ++i) {
+			Queue& q = queues[(node + i) % queues.size()];
+			size_t pos = q.next.fetch_add(1);
+			if (pos < q.morsels.size()) {
+				range = q.morsels[pos];
+				return true;
+			}
+		}
+		return false;
+	}
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include "Allocator.hpp"
+
+/**
+ * B+-tree for indices declared 'tree', in place of std::map and
+ * std::multimap and with their interface as far as generated code and the
+ * runtime use it. Nodes take up to 512 bytes, aligned to cache lines: inner nodes
+ * hold separator keys and child pointers in arrays of their own, leaves hold
+ * the (key, tid) entries and are chained in key order, so an iterator from
+ * lower_bound() walks a key range leaf by leaf. All lines of a node are
+ * prefetched on the way down, before the binary search within it.
+ *
+ * Entries with equal keys keep their order of insertion. Erasing does not
+ * merge nodes; leaves may run empty and are skipped until the next bulk
+ * load, which packs sorted entries into full leaves bottom-up.
+ */
+template <class Key, class Value, bool Unique>
+struct BTree {
+	using key_type = Key;
+	using mapped_type = Value;
+	using value_type = std::pair<Key,Value>;
+	static const size_t node_bytes = 512;
+	static const size_t header_bytes = 2 * sizeof(void*);
+	static const size_t leaf_fit = (node_bytes - header_bytes) / sizeof(value_type);
+	static const size_t inner_fit = (node_bytes - header_bytes) / (sizeof(Key) + sizeof(void*));
+	static const size_t leaf_capacity = leaf_fit > 4 ? leaf_fit : 4;
+	static const size_t inner_capacity = inner_fit > 4 ? inner_fit : 4;// separators
+
+private:
+	struct Node {};
+	struct Leaf : Node {
+		size_t count = 0;
+		Leaf* next = nullptr;
+		value_type entries[leaf_capacity];
+	};
+	struct Inner : Node {
+		size_t count = 0;// separators, one child more
+		Key keys[inner_capacity];// keys of children[i] <= keys[i] <= keys of children[i+1]
+		Node* children[inner_capacity + 1];
+	};
+
+public:
+	template <class V>
+	struct Iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = V;
+		using difference_type = std::ptrdiff_t;
+		using pointer = V*;
+		using reference = V&;
+		Leaf* leaf = nullptr;// nullptr at the end
+		size_t pos = 0;
+
+		Iterator() = default;
+		Iterator(Leaf* leaf, size_t pos) : leaf(leaf), pos(pos) {skip();}
+		template <class W>
+		Iterator(const Iterator<W>& other) : leaf(other.leaf), pos(other.pos) {}
+
+		V& operator*() const {return leaf->entries[pos];}
+		V* operator->() const {return &leaf->entries[pos];}
+		Iterator& operator++() {
+			++pos;
+			skip();
+			return *this;
+		}
+		Iterator operator++(int) {
+			Iterator res = *this;
+			++*this;
+			return res;
+		}
+		template <class W>
+		bool operator==(const Iterator<W>& other) const {return leaf == other.leaf && pos == other.pos;}
+		template <class W>
+		bool operator!=(const Iterator<W>& other) const {return !(*this == other);}
+
+	private:
+		// past the end of a leaf to the start of the next non-empty one
+		void skip() {
+			while (leaf && pos == leaf->count) {
+				leaf = leaf->next;
+				pos = 0;
+			}
+		}
+	};
+	using iterator = Iterator<value_type>;
+	using const_iterator = Iterator<const value_type>;
+
+	BTree() = default;
+	BTree(const BTree&) = delete;
+	BTree& operator=(const BTree&) = delete;
+	BTree(BTree&& other) {swap(other);}
+	BTree& operator=(BTree&& other) {
+		clear();
+		swap(other);
+		return *this;
+	}
+	~BTree() {clear();}
+
+	size_t size() const {return entries;}
+	bool empty() const {return entries == 0;}
+
+	iterator begin() {return iterator(first, 0);}
+	iterator end() {return iterator();}
+	const_iterator begin() const {return const_iterator(first, 0);}
+	const_iterator end() const {return const_iterator();}
+
+	// the first entry with a key not less than key
+	iterator lower_bound(const Key& key) {return lower(key);}
+	const_iterator lower_bound(const Key& key) const {return lower(key);}
+	// the first entry with a key greater than key
+	iterator upper_bound(const Key& key) {return upper(key);}
+	const_iterator upper_bound(const Key& key) const {return upper(key);}
+	iterator find(const Key& key) {return locate(key);}
+	const_iterator find(const Key& key) const {return locate(key);}
+	std::pair<iterator,iterator> equal_range(const Key& key) {return range(key);}
+	std::pair<const_iterator,const_iterator> equal_range(const Key& key) const {return range(key);}
+
+	size_t count(const Key& key) const {
+		size_t n = 0;
+		for (const_iterator it = find(key); it != end() && !(key < it->first); ++it) ++n;
+		return n;
+	}
+
+	// after the entries with an equal key; a unique tree keeps the present entry
+	std::pair<iterator,bool> insert(const value_type& entry) {
+		if (Unique) {
+			iterator it = find(entry.first);
+			if (it != end()) return {it, false};
+		}
+		if (height == 0) {
+			first = create<Leaf>();
+			root = first;
+			height = 1;
+		}
+		Key up;
+		Node* right = nullptr;
+		iterator res = insert(root, height, entry, up, right);
+		if (right) {
+			Inner* inner = create<Inner>();
+			inner->count = 1;
+			inner->keys[0] = up;
+			inner->children[0] = root;
+			inner->children[1] = right;
+			root = inner;
+			++height;
+		}
+		++entries;
+		return {res, true};
+	}
+
+	// the hint is ignored, entries go after those with an equal key
+	iterator insert(const_iterator, const value_type& entry) {return insert(entry).first;}
+
+	iterator erase(const_iterator it) {
+		Leaf* leaf = it.leaf;
+		std::move(leaf->entries + it.pos + 1, leaf->entries + leaf->count, leaf->entries + it.pos);
+		--leaf->count;
+		--entries;
+		return iterator(leaf, it.pos);
+	}
+
+	size_t erase(const Key& key) {
+		size_t n = 0;
+		for (iterator it = find(key); it != end() && !(key < it->first); ++n) it = erase(it);
+		return n;
+	}
+
+	// replaces the contents by sorted entries; a unique tree keeps the first of equal keys
+	template <class Entries>
+	void bulk_load(const Entries& sorted) {
+		clear();
+		std::vector<std::pair<Key,Node*>> level;// each node with the smallest key below it
+		Leaf* leaf = nullptr;
+		for (const auto& entry : sorted) {
+			if (Unique && leaf && !(leaf->entries[leaf->count - 1].first < entry.first)) continue;
+			if (leaf == nullptr || leaf->count == leaf_capacity) {
+				Leaf* next = create<Leaf>();
+				if (leaf) leaf->next = next; else first = next;
+				leaf = next;
+				level.emplace_back(entry.first, leaf);
+			}
+			leaf->entries[leaf->count++] = value_type(entry.first, entry.second);
+			++entries;
+		}
+		if (level.empty()) return;
+		height = 1;
+		while (level.size() > 1) {
+			std::vector<std::pair<Key,Node*>> parents;
+			for (size_t i = 0; i < level.size(); i += inner_capacity + 1) {
+				size_t n = std::min(inner_capacity + 1, level.size() - i);
+				Inner* inner = create<Inner>();
+				inner->count = n - 1;
+				for (size_t c = 0; c < n; ++c) {
+					inner->children[c] = level[i + c].second;
+					if (c > 0) inner->keys[c - 1] = level[i + c].first;
+				}
+				parents.emplace_back(level[i].first, inner);
+			}
+			level.swap(parents);
+			++height;
+		}
+		root = level[0].second;
+	}
+
+	void clear() {
+		if (height) destroy(root, height);
+		root = nullptr;
+		first = nullptr;
+		height = 0;
+		entries = 0;
+	}
+
+	void swap(BTree& other) {
+		std::swap(root, other.root);
+		std::swap(first, other.first);
+		std::swap(height, other.height);
+		std::swap(entries, other.entries);
+	}
+
+	// bytes held by the nodes
+	size_t memory() const {return height ? bytes(root, height) : 0;}
+
+private:
+	Node* root = nullptr;
+	Leaf* first = nullptr;
+	unsigned height = 0;// levels, 1 if the root is a leaf
+	size_t entries = 0;
+
+	iterator lower(const Key& key) const {
+		Leaf* leaf = descend(key, false);
+		if (leaf == nullptr) return iterator();
+		auto e = std::lower_bound(leaf->entries, leaf->entries + leaf->count, key, [](const value_type& v, const Key& k) {return v.first < k;});
+		return iterator(leaf, e - leaf->entries);
+	}
+
+	iterator upper(const Key& key) const {
+		Leaf* leaf = descend(key, true);
+		if (leaf == nullptr) return iterator();
+		auto e = std::upper_bound(leaf->entries, leaf->entries + leaf->count, key, [](const Key& k, const value_type& v) {return k < v.first;});
+		return iterator(leaf, e - leaf->entries);
+	}
+
+	iterator locate(const Key& key) const {
+		iterator it = lower(key);
+		return it.leaf && !(key < it->first) ? it : iterator();
+	}
+
+	std::pair<iterator,iterator> range(const Key& key) const {
+		iterator it = lower(key);
+		if (Unique) {
+			iterator last = it;
+			if (it.leaf && !(key < it->first)) ++last;
+			return {it, last};
+		}
+		return {it, upper(key)};
+	}
+
+	template <class T>
+	static T* create() {
+		return new (alloc::allocate(sizeof(T))) T();
+	}
+
+	template <class T>
+	static void release(T* node) {
+		node->~T();
+		alloc::deallocate(node, sizeof(T));
+	}
+
+	template <class T>
+	static void prefetch(const T* node) {
+		const char* p = reinterpret_cast<const char*>(node);
+		for (size_t line = 0; line < sizeof(T); line += alloc::alignment) __builtin_prefetch(p + line);
+	}
+
+	// the child of inner to look for key in: the first with a separator not less (upper: greater) than key
+	static size_t child(const Inner* inner, const Key& key, bool upper) {
+		const Key* end = inner->keys + inner->count;
+		const Key* k = upper ? std::upper_bound(inner->keys, end, key) : std::lower_bound(inner->keys, end, key);
+		return k - inner->keys;
+	}
+
+	// the leaf holding the first entry not less (upper: greater) than key, or the one before it
+	Leaf* descend(const Key& key, bool upper) const {
+		if (height == 0) return nullptr;
+		Node* node = root;
+		for (unsigned level = height; level > 1; --level) {
+			const Inner* inner = static_cast<const Inner*>(node);
+			node = inner->children[child(inner, key, upper)];
+			if (level > 2) prefetch(static_cast<const Inner*>(node)); else prefetch(static_cast<const Leaf*>(node));
+		}
+		return static_cast<Leaf*>(node);
+	}
+
+	// inserts below node at level; a split hands the new right sibling and its separator up
+	iterator insert(Node* node, unsigned level, const value_type& entry, Key& up, Node*& right) {
+		if (level == 1) {
+			Leaf* leaf = static_cast<Leaf*>(node);
+			size_t pos = std::upper_bound(leaf->entries, leaf->entries + leaf->count, entry.first, [](const Key& k, const value_type& v) {return k < v.first;}) - leaf->entries;
+			if (leaf->count == leaf_capacity) {
+				Leaf* sibling = create<Leaf>();
+				size_t mid = leaf->count / 2;
+				std::move(leaf->entries + mid, leaf->entries + leaf->count, sibling->entries);
+				sibling->count = leaf->count - mid;
+				leaf->count = mid;
+				sibling->next = leaf->next;
+				leaf->next = sibling;
+				up = sibling->entries[0].first;
+				right = sibling;
+				if (pos > mid) {
+					leaf = sibling;
+					pos -= mid;
+				}
+			}
+			std::move_backward(leaf->entries + pos, leaf->entries + leaf->count, leaf->entries + leaf->count + 1);
+			leaf->entries[pos] = entry;
+			++leaf->count;
+			return iterator(leaf, pos);
+		}
+		Inner* inner = static_cast<Inner*>(node);
+		size_t c = child(inner, entry.first, true);
+		Key child_up;
+		Node* child_right = nullptr;
+		iterator res = insert(inner->children[c], level - 1, entry, child_up, child_right);
+		if (child_right == nullptr) return res;
+		if (inner->count == inner_capacity) {
+			Inner* sibling = create<Inner>();
+			size_t mid = inner->count / 2;
+			up = inner->keys[mid];
+			std::move(inner->keys + mid + 1, inner->keys + inner->count, sibling->keys);
+			std::copy(inner->children + mid + 1, inner->children + inner->count + 1, sibling->children);
+			sibling->count = inner->count - mid - 1;
+			inner->count = mid;
+			right = sibling;
+			if (c > mid) {
+				inner = sibling;
+				c -= mid + 1;
+			}
+		}
+		std::move_backward(inner->keys + c, inner->keys + inner->count, inner->keys + inner->count + 1);
+		std::copy_backward(inner->children + c + 1, inner->children + inner->count + 1, inner->children + inner->count + 2);
+		inner->keys[c] = child_up;
+		inner->children[c + 1] = child_right;
+		++inner->count;
+		return res;
+	}
+
+	static void destroy(Node* node, unsigned level) {
+		if (level == 1) {
+			release(static_cast<Leaf*>(node));
+			return;
+		}
+		Inner* inner = static_cast<Inner*>(node);
+		for (size_t c = 0; c <= inner->count; ++c) destroy(inner->children[c], level - 1);
+		release(inner);
+	}
+
+	static size_t bytes(const Node* node, unsigned level) {
+		if (level == 1) return sizeof(Leaf);
+		const Inner* inner = static_cast<const Inner*>(node);
+		size_t res = sizeof(Inner);
+		for (size_t c = 0; c <= inner->count; ++c) res += bytes(inner->children[c], level - 1);
+		return res;
+	}
+};
+
+template <class Key, class Value, bool Unique>
+const size_t BTree<Key,Value,Unique>::leaf_capacity;
+template <class Key, class Value, bool Unique>
+const size_t BTree<Key,Value,Unique>::inner_capacity;
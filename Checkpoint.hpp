@@ -0,0 +1,382 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "Allocator.hpp"
+#include "Chunked.hpp"
+#include "Packed.hpp"
+#include "Strings.hpp"
+#include "Tombstones.hpp"
+#include "Concurrent.hpp"
+#include "IndexBuild.hpp"
+
+/**
+ * Runtime support for generated checkpoints. A checkpoint is written by a
+ * fork() of the process: the child sees the tables as they were at the fork
+ * through copy-on-write pages and writes them out while the parent goes on,
+ * so writers only stall for the fork itself. The file is a sequence of named
+ * sections, each starting at a multiple of alignment, and is read back
+ * through mmap: columns are copied out of the mapping, indices are refilled
+ * from their stored entries without extracting or sorting keys.
+ */
+namespace checkpoint {
+	const char magic[8] = {'D','B','I','C','K','P','T','1'};
+	const size_t alignment = 64;
+
+	// file: magic, log position, then per section the name length, the byte
+	// count, the name and the bytes
+	struct Writer {
+		Writer(const std::string& path, uint64_t lsn) : path(path) {
+			out = fopen(path.c_str(), "wb");
+			if (out == nullptr) throw std::runtime_error("cannot write checkpoint " + path);
+			setvbuf(out, nullptr, _IOFBF, 1 << 20);
+			write(magic, sizeof(magic));
+			write(&lsn, sizeof(lsn));
+			pad();
+		}
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+		~Writer() {
+			if (out != nullptr) fclose(out);
+		}
+
+		void begin(const std::string& name, size_t bytes) {
+			uint64_t header[2] = {name.size(), bytes};
+			write(header, sizeof(header));
+			write(name.data(), name.size());
+			pad();
+		}
+
+		void write(const void* data, size_t n) {
+			if (n != 0 && fwrite(data, 1, n, out) != n) throw std::runtime_error("cannot write checkpoint " + path);
+			offset += n;
+		}
+
+		void end() {pad();}
+
+		void add(const std::string& name, const void* data, size_t bytes) {
+			begin(name, bytes);
+			write(data, bytes);
+			end();
+		}
+
+		// flushes and syncs the file; returns its size
+		size_t finish() {
+			if (fflush(out) != 0 || fsync(fileno(out)) != 0) throw std::runtime_error("cannot write checkpoint " + path);
+			fclose(out);
+			out = nullptr;
+			return offset;
+		}
+
+	private:
+		std::string path;
+		FILE* out;
+		size_t offset = 0;
+
+		void pad() {
+			static const char zeros[alignment] = {};
+			write(zeros, (alignment - offset % alignment) % alignment);
+		}
+	};
+
+	struct Image {
+		Image(const std::string& path) {
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) throw std::runtime_error("cannot open checkpoint " + path);
+			struct stat st;
+			if (fstat(fd, &st) != 0 || size_t(st.st_size) < alignment) {
+				::close(fd);
+				throw std::runtime_error("not a checkpoint: " + path);
+			}
+			length = st.st_size;
+			void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (mapped == MAP_FAILED) throw std::runtime_error("cannot map checkpoint " + path);
+			base = static_cast<const char*>(mapped);
+			if (memcmp(base, magic, sizeof(magic)) != 0) {
+				munmap(mapped, length);
+				throw std::runtime_error("not a checkpoint: " + path);
+			}
+			memcpy(&log_position, base + sizeof(magic), sizeof(log_position));
+			for (size_t at = alignment; at + 2 * sizeof(uint64_t) <= length; ) {
+				uint64_t header[2];
+				memcpy(header, base + at, sizeof(header));
+				size_t data = aligned(at + sizeof(header) + header[0]);
+				if (data + header[1] > length) break;
+				sections[std::string(base + at + sizeof(header), header[0])] = {base + data, header[1]};
+				at = aligned(data + header[1]);
+			}
+		}
+		Image(const Image&) = delete;
+		Image& operator=(const Image&) = delete;
+		~Image() {munmap(const_cast<char*>(base), length);}
+
+		// the log position of the snapshot: records from here on are not in it
+		uint64_t lsn() const {return log_position;}
+
+		std::pair<const char*,size_t> section(const std::string& name) const {
+			auto it = sections.find(name);
+			if (it == sections.end()) throw std::runtime_error("checkpoint has no section " + name);
+			return it->second;
+		}
+
+		template <class T>
+		std::pair<const T*,size_t> array(const std::string& name) const {
+			auto s = section(name);
+			if (s.second % sizeof(T) != 0) throw std::runtime_error("checkpoint section " + name + " has the wrong size");
+			return {reinterpret_cast<const T*>(s.first), s.second / sizeof(T)};
+		}
+
+	private:
+		const char* base;
+		size_t length;
+		uint64_t log_position;
+		std::unordered_map<std::string,std::pair<const char*,size_t>> sections;
+
+		static size_t aligned(size_t at) {return (at + alignment - 1) / alignment * alignment;}
+	};
+
+	// columns
+	template <class T, class A>
+	void save(Writer& out, const std::string& name, const std::vector<T,A>& column) {
+		out.add(name, column.data(), column.size() * sizeof(T));
+	}
+
+	template <class T>
+	void save(Writer& out, const std::string& name, const Chunked_Vector<T>& column) {
+		out.begin(name, column.size() * sizeof(T));
+		for (size_t c = 0; c < column.chunk_count(); ++c) {
+			out.write(column.chunk(c), column.chunk_length(c) * sizeof(T));
+		}
+		out.end();
+	}
+
+	// min, max, code width and word count per full block
+	struct Block_Header {
+		int64_t min;
+		int64_t max;
+		uint64_t bits;
+		uint64_t words;
+	};
+
+	template <class T, class Raw>
+	void save(Writer& out, const std::string& name, const Packed_Vector<T,Raw>& column) {
+		std::vector<Block_Header> headers;
+		size_t words = 0;
+		for (const auto& block : column.blocks) {
+			headers.push_back({int64_t(block.min), int64_t(block.max), block.bits, block.words.size()});
+			words += block.words.size();
+		}
+		out.add(name + ".blocks", headers.data(), headers.size() * sizeof(Block_Header));
+		out.begin(name + ".words", words * sizeof(uint64_t));
+		for (const auto& block : column.blocks) out.write(block.words.data(), block.words.size() * sizeof(uint64_t));
+		out.end();
+		save(out, name + ".tail", column.tail);
+	}
+
+	template <class T>
+	void save(Writer& out, const std::string& name, const String_Vector<T>& column) {
+		save(out, name + ".headers", column.headers);
+		save(out, name + ".heap", column.heap);
+	}
+
+	inline void save(Writer& out, const std::string& name, const Tombstones& tombstones) {
+		save(out, name, tombstones.bits);
+	}
+
+	template <class T, class A>
+	void load(const Image& in, const std::string& name, std::vector<T,A>& column) {
+		auto values = in.array<T>(name);
+		column.assign(values.first, values.first + values.second);
+	}
+
+	template <class T>
+	void load(const Image& in, const std::string& name, Chunked_Vector<T>& column) {
+		auto values = in.array<T>(name);
+		column.clear();
+		column.reserve(values.second);
+		for (size_t c = 0; c << chunked::chunk_bits < values.second; ++c) {
+			size_t begin = c << chunked::chunk_bits;
+			memcpy(column.chunk(c), values.first + begin, std::min(chunked::chunk_size, values.second - begin) * sizeof(T));
+		}
+		column.count = values.second;
+	}
+
+	template <class T, class Raw>
+	void load(const Image& in, const std::string& name, Packed_Vector<T,Raw>& column) {
+		auto headers = in.array<Block_Header>(name + ".blocks");
+		auto words = in.array<uint64_t>(name + ".words");
+		column.clear();
+		column.blocks.resize(headers.second);
+		const uint64_t* word = words.first;
+		for (size_t b = 0; b < headers.second; ++b) {
+			auto& block = column.blocks[b];
+			block.min = Raw(headers.first[b].min);
+			block.max = Raw(headers.first[b].max);
+			block.bits = headers.first[b].bits;
+			block.words.assign(word, word + headers.first[b].words);
+			word += headers.first[b].words;
+		}
+		load(in, name + ".tail", column.tail);
+	}
+
+	template <class T>
+	void load(const Image& in, const std::string& name, String_Vector<T>& column) {
+		load(in, name + ".headers", column.headers);
+		load(in, name + ".heap", column.heap);
+		column.compact();
+	}
+
+	inline void load(const Image& in, const std::string& name, Tombstones& tombstones) {
+		load(in, name, tombstones.bits);
+		tombstones.recount();
+	}
+
+	// indices: their (key, tid) entries in iteration order, so tree indices come back sorted
+	template <class Index, class Fn>
+	void entries(const Index& index, Fn fn) {
+		for (const auto& entry : index) fn(entry.first, entry.second);
+	}
+
+	template <class K, class V, class H, class E, bool U, class Fn>
+	void entries(const Concurrent_Hash_Index<K,V,H,E,U>& index, Fn fn) {
+		index.for_each(fn);
+	}
+
+	template <class Index>
+	void save_index(Writer& out, const std::string& name, const Index& index) {
+		using Entry = std::pair<typename Index::key_type, typename Index::mapped_type>;
+		out.begin(name, index.size() * sizeof(Entry));
+		entries(index, [&out](const typename Index::key_type& key, const typename Index::mapped_type& value) {
+			Entry entry(key, value);
+			out.write(&entry, sizeof(Entry));
+		});
+		out.end();
+	}
+
+	// the stored entries as a container for index_build::fill
+	template <class Entry>
+	struct Entries {
+		const Entry* first;
+		size_t n;
+		size_t size() const {return n;}
+		const Entry* begin() const {return first;}
+		const Entry* end() const {return first + n;}
+		const Entry& operator[](size_t i) const {return first[i];}
+	};
+
+	template <class Index>
+	auto reserve(Index& index, size_t n, int) -> decltype(index.reserve(n), void()) {index.reserve(n);}
+	template <class Index>
+	void reserve(Index&, size_t, long) {}
+
+	template <class Index>
+	void load_index(const Image& in, const std::string& name, Index& index) {
+		using Entry = std::pair<typename Index::key_type, typename Index::mapped_type>;
+		auto stored = in.array<Entry>(name);
+		index.clear();
+		reserve(index, stored.second, 0);
+		index_build::fill(index, Entries<Entry>{stored.first, stored.second});
+	}
+
+	struct Stats {
+		bool ok;
+		size_t bytes;
+		double stall_us;// writers blocked while the snapshot was taken
+		double seconds;// writing and syncing the file in the child
+	};
+
+	inline std::ostream& operator<<(std::ostream& out, const Stats& stats) {
+		if (!stats.ok) return out << "checkpoint failed";
+		return out << "checkpoint of " << stats.bytes / 1e6 << " MB in " << stats.seconds << " s, writers stalled " << stats.stall_us << " us";
+	}
+
+	// A checkpoint in progress. The stall runs from construction to resume().
+	struct Handle {
+		Handle(const std::string& path) : path(path), start(std::chrono::steady_clock::now()) {}
+
+		// write(Writer&) runs in a forked child, which replaces path once the
+		// file is synced and reports how long that took
+		template <class Write>
+		void fork(uint64_t lsn, Write write) {
+			if (pipe(report) != 0) throw std::runtime_error("cannot fork for checkpoint");
+			fflush(nullptr);
+			pid = ::fork();
+			if (pid < 0) throw std::runtime_error("cannot fork for checkpoint");
+			if (pid > 0) {
+				::close(report[1]);
+				return;
+			}
+			::close(report[0]);
+			auto begin = std::chrono::steady_clock::now();
+			int status = 1;
+			try {
+				std::string tmp = path + ".tmp";
+				Writer out(tmp, lsn);
+				write(out);
+				out.finish();
+				if (std::rename(tmp.c_str(), path.c_str()) == 0) status = 0;
+			} catch (const std::exception& e) {
+				fprintf(stderr, "%s\n", e.what());
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+			if (::write(report[1], &seconds, sizeof(seconds)) != sizeof(seconds)) status = 1;
+			_exit(status);
+		}
+
+		// ends the stall: the caller has released the tables
+		void resume() {
+			stall = std::chrono::steady_clock::now() - start;
+		}
+
+		bool running() {
+			if (pid <= 0 || finished) return false;
+			int status;
+			if (waitpid(pid, &status, WNOHANG) != pid) return true;
+			finish(status);
+			return false;
+		}
+
+		Stats wait() {
+			if (pid > 0 && !finished) {
+				int status;
+				while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+				finish(status);
+			}
+			return stats;
+		}
+
+	private:
+		std::string path;
+		pid_t pid = -1;
+		int report[2] = {-1, -1};
+		bool finished = false;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::duration stall{};
+		Stats stats = {false, 0, 0, 0};
+
+		void finish(int status) {
+			finished = true;
+			stats.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			if (::read(report[0], &stats.seconds, sizeof(stats.seconds)) != sizeof(stats.seconds)) stats.ok = false;
+			::close(report[0]);
+			struct stat st;
+			stats.bytes = stats.ok && stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+			stats.stall_us = std::chrono::duration<double,std::micro>(stall).count();
+		}
+	};
+}
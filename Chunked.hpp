@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include "Allocator.hpp"
+
+/**
+ * Column storage for tables declared 'chunked': fixed-size, cache-line aligned
+ * chunks from the alloc layer, held in a chunk directory. Appending never
+ * moves elements, so element addresses stay valid and no append copies a
+ * whole column.
+ */
+namespace chunked {
+	const unsigned chunk_bits = 12;
+	const size_t chunk_size = size_t(1) << chunk_bits;
+	const size_t chunk_mask = chunk_size - 1;
+}
+
+template <class T>
+struct Chunked_Vector {
+	std::vector<T*> chunks;// directory; growing it copies pointers only
+	size_t count = 0;
+
+	Chunked_Vector() {}
+	Chunked_Vector(const Chunked_Vector&) = delete;
+	Chunked_Vector& operator=(const Chunked_Vector&) = delete;
+	~Chunked_Vector() {
+		clear();
+		for (T* chunk : chunks) alloc::deallocate(chunk, sizeof(T) * chunked::chunk_size);
+	}
+
+	size_t size() const {return count;}
+	bool empty() const {return count == 0;}
+	T& operator[](size_t i) {return chunks[i >> chunked::chunk_bits][i & chunked::chunk_mask];}
+	const T& operator[](size_t i) const {return chunks[i >> chunked::chunk_bits][i & chunked::chunk_mask];}
+	T& back() {return (*this)[count-1];}
+
+	// chunk c holds the elements [c*chunk_size, c*chunk_size + chunk_length(c))
+	size_t chunk_count() const {return (count + chunked::chunk_mask) >> chunked::chunk_bits;}
+	T* chunk(size_t c) {return chunks[c];}
+	const T* chunk(size_t c) const {return chunks[c];}
+	size_t chunk_length(size_t c) const {return std::min(chunked::chunk_size, count - (c << chunked::chunk_bits));}
+
+	void reserve(size_t n) {
+		size_t needed = (n + chunked::chunk_mask) >> chunked::chunk_bits;
+		chunks.reserve(needed);
+		while (chunks.size() < needed) chunks.push_back(allocate());
+	}
+
+	void push_back(const T& value) {
+		size_t c = count >> chunked::chunk_bits;
+		if (c == chunks.size()) chunks.push_back(allocate());
+		new (&chunks[c][count & chunked::chunk_mask]) T(value);
+		++count;
+	}
+
+	// the emptied chunk stays allocated for the next push_back
+	void pop_back() {
+		--count;
+		(*this)[count].~T();
+	}
+
+	void clear() {
+		while (count > 0) pop_back();
+	}
+
+private:
+	static T* allocate() {
+		static_assert(alignof(T) <= alloc::alignment, "chunks are aligned to alloc::alignment");
+		return static_cast<T*>(alloc::allocate(sizeof(T) * chunked::chunk_size));
+	}
+};
@@ -0,0 +1,505 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <initializer_list>
+#include <functional>
+#include <algorithm>
+
+/**
+ * Runtime support for tables declared 'synchronized'. Their hash indices are
+ * Concurrent_Hash_Index: open addressing split into shards, each with a
+ * sequence latch. Writers latch one shard; readers take no latch at all,
+ * probe optimistically and retry if the shard changed meanwhile. A shard
+ * that grows publishes a new slot table and retires the old one through
+ * epoch-based reclamation, since readers may still be probing it.
+ */
+namespace concurrent {
+	inline void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	// spins briefly, then yields the core
+	struct Backoff {
+		unsigned spins = 0;
+		void operator()() {
+			if (++spins < 64) pause();
+			else std::this_thread::yield();
+		}
+	};
+
+	// Threads announce the global epoch while they read shared structures.
+	// Memory retired at epoch r is freed once no thread is still in an epoch <= r.
+	struct Epochs {
+		static const size_t max_threads = 256;
+
+		Epochs() {
+			for (Slot& slot : slots) {
+				slot.epoch.store(0, std::memory_order_relaxed);
+				slot.taken.store(false, std::memory_order_relaxed);
+			}
+		}
+
+		~Epochs() {
+			for (auto& r : retired) r.second();
+		}
+
+		void enter() {
+			Thread& self = thread();
+			if (self.depth++ > 0) return;
+			std::atomic<uint64_t>& announced = slots[self.slot].epoch;
+			uint64_t e = global.load();
+			// re-check: a retire() that missed our announcement must have bumped global
+			do {
+				announced.store(e);
+			} while ((e = global.load()) != announced.load(std::memory_order_relaxed));
+		}
+
+		void leave() {
+			Thread& self = thread();
+			if (--self.depth > 0) return;
+			slots[self.slot].epoch.store(0, std::memory_order_release);
+		}
+
+		void retire(std::function<void()> free) {
+			std::lock_guard<std::mutex> lock(m);
+			retired.emplace_back(global.fetch_add(1), std::move(free));
+			collect();
+		}
+
+	private:
+		struct alignas(64) Slot {
+			std::atomic<uint64_t> epoch;// 0 while the thread reads nothing
+			std::atomic<bool> taken;
+		};
+		struct Thread {
+			size_t slot;
+			unsigned depth = 0;
+			Epochs& owner;
+			Thread(Epochs& owner) : owner(owner) {
+				Backoff backoff;
+				for (slot = 0; ; slot = (slot + 1) % max_threads) {
+					bool expected = false;
+					if (owner.slots[slot].taken.compare_exchange_strong(expected, true)) break;
+					if (slot == max_threads - 1) backoff();
+				}
+			}
+			~Thread() {owner.slots[slot].taken.store(false, std::memory_order_release);}
+		};
+
+		std::atomic<uint64_t> global{1};
+		Slot slots[max_threads];
+		std::mutex m;
+		std::vector<std::pair<uint64_t,std::function<void()>>> retired;
+
+		Thread& thread() {
+			static thread_local Thread self(*this);
+			return self;
+		}
+
+		void collect() {
+			uint64_t oldest = UINT64_MAX;
+			for (const Slot& slot : slots) {
+				uint64_t e = slot.epoch.load();
+				if (e != 0 && e < oldest) oldest = e;
+			}
+			size_t kept = 0;
+			for (size_t i = 0; i < retired.size(); ++i) {
+				if (retired[i].first < oldest) retired[i].second();
+				else if (kept++ != i) retired[kept-1] = std::move(retired[i]);
+			}
+			retired.resize(kept);
+		}
+	};
+
+	inline Epochs& epochs() {
+		static Epochs instance;
+		return instance;
+	}
+
+	struct Epoch_Guard {
+		Epoch_Guard() {epochs().enter();}
+		~Epoch_Guard() {epochs().leave();}
+		Epoch_Guard(const Epoch_Guard&) = delete;
+		Epoch_Guard& operator=(const Epoch_Guard&) = delete;
+	};
+
+	// spreads the low-entropy hashes of small integer keys over all bits
+	inline uint64_t mix(uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
+	}
+}
+
+// reader-writer spin latch
+struct Shared_Latch {
+	void lock() {
+		concurrent::Backoff backoff;
+		uint32_t expected = 0;
+		while (!state.compare_exchange_weak(expected, exclusive, std::memory_order_acquire)) {
+			expected = 0;
+			backoff();
+		}
+	}
+	void unlock() {state.store(0, std::memory_order_release);}
+
+	void lock_shared() {
+		concurrent::Backoff backoff;
+		uint32_t s = state.load(std::memory_order_relaxed);
+		while (true) {
+			if (s & exclusive) {
+				backoff();
+				s = state.load(std::memory_order_relaxed);
+			} else if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+				return;
+			}
+		}
+	}
+	void unlock_shared() {state.fetch_sub(1, std::memory_order_release);}
+
+	bool try_lock() {
+		uint32_t expected = 0;
+		return state.compare_exchange_strong(expected, exclusive, std::memory_order_acquire);
+	}
+	bool try_lock_shared() {
+		uint32_t s = state.load(std::memory_order_relaxed);
+		while (!(s & exclusive)) {
+			if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) return true;
+		}
+		return false;
+	}
+
+private:
+	static const uint32_t exclusive = uint32_t(1) << 31;
+	std::atomic<uint32_t> state{0};
+};
+
+// holds several Shared_Latches for its lifetime, some exclusively and the rest
+// shared. They are taken all or none: a guard that cannot take one releases
+// those it has and starts over, so it never waits while holding a latch, and
+// guards taking the latches of tables in different orders cannot deadlock as
+// long as their holders take no further latch. Generated procedures therefore
+// write the tables they hold through insert_latched() and remove_latched().
+struct Latch_Guard {
+	Latch_Guard(std::initializer_list<Shared_Latch*> exclusive, std::initializer_list<Shared_Latch*> shared)
+		: exclusive(exclusive), shared(shared) {
+		concurrent::Backoff backoff;
+		while (!try_lock()) backoff();
+	}
+	~Latch_Guard() {unlock(exclusive.size(), shared.size());}
+	Latch_Guard(const Latch_Guard&) = delete;
+	Latch_Guard& operator=(const Latch_Guard&) = delete;
+
+private:
+	std::vector<Shared_Latch*> exclusive;
+	std::vector<Shared_Latch*> shared;
+
+	bool try_lock() {
+		for (size_t i = 0; i < exclusive.size(); ++i) {
+			if (!exclusive[i]->try_lock()) {
+				unlock(i, 0);
+				return false;
+			}
+		}
+		for (size_t i = 0; i < shared.size(); ++i) {
+			if (!shared[i]->try_lock_shared()) {
+				unlock(exclusive.size(), i);
+				return false;
+			}
+		}
+		return true;
+	}
+	// the first e exclusive and s shared latches
+	void unlock(size_t e, size_t s) {
+		for (size_t i = 0; i < s; ++i) shared[i]->unlock_shared();
+		for (size_t i = 0; i < e; ++i) exclusive[i]->unlock();
+	}
+};
+
+// Key and Value must be trivially copyable in practice: optimistic readers
+// may see a slot while it is written and discard what they read.
+template <class Key, class Value, class Hash, class Equal, bool unique>
+struct Concurrent_Hash_Index {
+	using key_type = Key;
+	using mapped_type = Value;
+	static const unsigned shard_bits = 6;
+	static const size_t shard_count = size_t(1) << shard_bits;
+	static const size_t min_capacity = 16;
+
+	Concurrent_Hash_Index() {
+		for (Shard& shard : shards) shard.table.store(new Table(min_capacity), std::memory_order_relaxed);
+	}
+	~Concurrent_Hash_Index() {
+		for (Shard& shard : shards) delete shard.table.load(std::memory_order_relaxed);
+	}
+	Concurrent_Hash_Index(const Concurrent_Hash_Index&) = delete;
+	Concurrent_Hash_Index& operator=(const Concurrent_Hash_Index&) = delete;
+
+	// false if the index is unique and already holds key
+	bool insert(const Key& key, Value value) {
+		uint64_t h = hash(key);
+		Shard& shard = shards[h >> (64 - shard_bits)];
+		Writer writer(shard);
+		Table* table = shard.table.load(std::memory_order_relaxed);
+		size_t free = SIZE_MAX;
+		for (size_t i = h & table->mask, n = 0; n <= table->mask; i = (i + 1) & table->mask, ++n) {
+			Slot& slot = table->slots[i];
+			if (slot.state == State::Empty) {
+				if (free == SIZE_MAX) free = i;
+				break;
+			}
+			if (slot.state == State::Deleted) {
+				if (free == SIZE_MAX) free = i;
+				if (!unique) break;
+			} else if (unique && slot.hash == h && Equal()(slot.key, key)) {
+				return false;
+			}
+		}
+		if (free == SIZE_MAX || (table->slots[free].state == State::Empty && (table->used + 1) * 4 > table->capacity() * 3)) {
+			table = grow(shard, table->live + 1);
+			free = find_free(table, h);
+		}
+		Slot& slot = table->slots[free];
+		if (slot.state == State::Empty) ++table->used;
+		slot.key = key;
+		slot.value = value;
+		slot.hash = h;
+		slot.state = State::Full;
+		++table->live;
+		return true;
+	}
+
+	// removes the entry key -> value; false if there is none
+	bool erase(const Key& key, Value value) {
+		uint64_t h = hash(key);
+		Shard& shard = shards[h >> (64 - shard_bits)];
+		Writer writer(shard);
+		Slot* slot = locate(shard.table.load(std::memory_order_relaxed), h, key, value);
+		if (slot == nullptr) return false;
+		slot->state = State::Deleted;
+		--shard.table.load(std::memory_order_relaxed)->live;
+		return true;
+	}
+
+	// repoints the entry key -> old_value to new_value
+	bool replace(const Key& key, Value old_value, Value new_value) {
+		uint64_t h = hash(key);
+		Shard& shard = shards[h >> (64 - shard_bits)];
+		Writer writer(shard);
+		Slot* slot = locate(shard.table.load(std::memory_order_relaxed), h, key, old_value);
+		if (slot == nullptr) return false;
+		slot->value = new_value;
+		return true;
+	}
+
+	// the value of some entry for key
+	bool find(const Key& key, Value& out) const {
+		bool found = false;
+		read(key, [&found, &out](const Slot& slot) {
+			out = slot.value;
+			found = true;
+			return false;
+		}, [&found]() {found = false;});
+		return found;
+	}
+
+	// the values of all entries for key
+	void find_all(const Key& key, std::vector<Value>& out) const {
+		read(key, [&out](const Slot& slot) {
+			out.push_back(slot.value);
+			return !unique;
+		}, [&out]() {out.clear();});
+	}
+
+	// out[i] = the value of some entry for keys[i], missing if there is none;
+	// returns the number of keys found. The slots of a group of keys are
+	// prefetched before any of them is probed.
+	size_t find_batch(const Key* keys, size_t n, Value* out, Value missing) const {
+		static const size_t group = 16;
+		uint64_t hashes[group];
+		size_t found = 0;
+		concurrent::Epoch_Guard guard;
+		for (size_t begin = 0; begin < n; begin += group) {
+			size_t end = std::min(n, begin + group);
+			for (size_t i = begin; i < end; ++i) {
+				uint64_t h = hashes[i - begin] = hash(keys[i]);
+				// a table replaced meanwhile is not freed before the guard ends
+				const Table* table = shards[h >> (64 - shard_bits)].table.load(std::memory_order_acquire);
+				__builtin_prefetch(&table->slots[h & table->mask]);
+			}
+			for (size_t i = begin; i < end; ++i) {
+				bool hit = false;
+				Value& value = out[i];
+				read(hashes[i - begin], keys[i], [&hit, &value](const Slot& slot) {
+					value = slot.value;
+					hit = true;
+					return false;
+				}, [&hit]() {hit = false;});
+				if (hit) ++found;
+				else value = missing;
+			}
+		}
+		return found;
+	}
+
+	size_t count(const Key& key) const {
+		size_t res = 0;
+		read(key, [&res](const Slot&) {
+			++res;
+			return !unique;
+		}, [&res]() {res = 0;});
+		return res;
+	}
+
+	// not safe against concurrent writers
+	size_t size() const {
+		size_t res = 0;
+		for (const Shard& shard : shards) res += shard.table.load(std::memory_order_relaxed)->live;
+		return res;
+	}
+
+	// fn(key, value) for every entry; not safe against concurrent writers
+	template <class Fn>
+	void for_each(Fn fn) const {
+		for (const Shard& shard : shards) {
+			for (const Slot& slot : shard.table.load(std::memory_order_relaxed)->slots) {
+				if (slot.state == State::Full) fn(slot.key, slot.value);
+			}
+		}
+	}
+
+	void clear() {
+		for (Shard& shard : shards) {
+			Writer writer(shard);
+			Table* old = shard.table.load(std::memory_order_relaxed);
+			shard.table.store(new Table(min_capacity), std::memory_order_release);
+			retire(old);
+		}
+	}
+
+	// sizes the shards for n entries spread evenly
+	void reserve(size_t n) {
+		for (Shard& shard : shards) {
+			Writer writer(shard);
+			Table* table = shard.table.load(std::memory_order_relaxed);
+			grow(shard, table->live + n / shard_count + 1);
+		}
+	}
+
+private:
+	enum class State : uint8_t {Empty, Full, Deleted};
+	struct Slot {
+		State state = State::Empty;
+		uint64_t hash;
+		Key key;
+		Value value;
+	};
+	struct Table {
+		size_t mask;
+		size_t live = 0;
+		size_t used = 0;// live and deleted slots
+		std::vector<Slot> slots;
+		Table(size_t capacity) : mask(capacity - 1), slots(capacity) {}
+		size_t capacity() const {return mask + 1;}
+	};
+	// version is odd while a writer changes the shard
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> version{0};
+		std::atomic<Table*> table{nullptr};
+	};
+	struct Writer {
+		Shard& shard;
+		Writer(Shard& shard) : shard(shard) {
+			concurrent::Backoff backoff;
+			uint64_t v = shard.version.load(std::memory_order_relaxed);
+			while ((v & 1) || !shard.version.compare_exchange_weak(v, v + 1, std::memory_order_acquire)) {
+				backoff();
+				v = shard.version.load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+		~Writer() {shard.version.fetch_add(1, std::memory_order_release);}
+	};
+
+	Shard shards[shard_count];
+
+	static uint64_t hash(const Key& key) {return concurrent::mix(Hash()(key));}
+
+	static void retire(Table* table) {
+		concurrent::epochs().retire([table]() {delete table;});
+	}
+
+	// probes optimistically; visit(slot) returns whether to continue,
+	// reset() undoes the visits of an attempt that has to be retried
+	template <class Visit, class Reset>
+	void read(const Key& key, Visit visit, Reset reset) const {
+		read(hash(key), key, visit, reset);
+	}
+
+	template <class Visit, class Reset>
+	void read(uint64_t h, const Key& key, Visit visit, Reset reset) const {
+		const Shard& shard = shards[h >> (64 - shard_bits)];
+		concurrent::Epoch_Guard guard;
+		concurrent::Backoff backoff;
+		while (true) {
+			uint64_t v = shard.version.load(std::memory_order_acquire);
+			if (v & 1) {
+				backoff();
+				continue;
+			}
+			const Table* table = shard.table.load(std::memory_order_acquire);
+			for (size_t i = h & table->mask, n = 0; n <= table->mask; i = (i + 1) & table->mask, ++n) {
+				const Slot& slot = table->slots[i];
+				if (slot.state == State::Empty) break;
+				if (slot.state == State::Full && slot.hash == h && Equal()(slot.key, key) && !visit(slot)) break;
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (shard.version.load(std::memory_order_relaxed) == v) return;
+			reset();
+		}
+	}
+
+	static Slot* locate(Table* table, uint64_t h, const Key& key, Value value) {
+		for (size_t i = h & table->mask, n = 0; n <= table->mask; i = (i + 1) & table->mask, ++n) {
+			Slot& slot = table->slots[i];
+			if (slot.state == State::Empty) break;
+			if (slot.state == State::Full && slot.hash == h && slot.value == value && Equal()(slot.key, key)) return &slot;
+		}
+		return nullptr;
+	}
+
+	static size_t find_free(Table* table, uint64_t h) {
+		size_t i = h & table->mask;
+		while (table->slots[i].state == State::Full) i = (i + 1) & table->mask;
+		return i;
+	}
+
+	// rehashes the shard into a table for at least n entries, dropping deleted slots;
+	// the caller holds the shard's latch
+	Table* grow(Shard& shard, size_t n) {
+		Table* old = shard.table.load(std::memory_order_relaxed);
+		size_t capacity = min_capacity;
+		while (capacity * 3 < n * 4 + 4) capacity *= 2;
+		if (capacity < old->capacity() && old->used == old->live) return old;
+		if (capacity < old->capacity()) capacity = old->capacity();
+		Table* table = new Table(capacity);
+		for (const Slot& slot : old->slots) {
+			if (slot.state != State::Full) continue;
+			table->slots[find_free(table, slot.hash)] = slot;
+			++table->live;
+		}
+		table->used = table->live;
+		shard.table.store(table, std::memory_order_release);
+		retire(old);
+		return table;
+	}
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+
+/**
+ * Runtime support for generated transaction drivers. A Transaction_Mix runs
+ * weighted transactions, each a callback that draws its parameters from the
+ * random generator and calls a generated procedure, and reports throughput
+ * together with latency percentiles per transaction type. The transactions
+ * may run on several threads at once, each with its own random generator.
+ */
+struct Transaction_Mix {
+	using Rng = std::mt19937_64;
+	// false if a lookup found no row, the procedure then changed nothing
+	using Transaction = std::function<bool(Rng&)>;
+
+	void add(const std::string& name, unsigned weight, const Transaction& run) {
+		types.push_back({name, weight, run});
+	}
+
+	// runs n transactions on the calling thread and prints the statistics
+	void run(size_t n, std::ostream& out, uint64_t seed = 42) {run(n, 1, out, seed);}
+
+	// runs n transactions on each of threads threads, each drawing from its own
+	// generator, and prints the statistics of all of them; one thread is the caller
+	void run(size_t n, size_t threads, std::ostream& out, uint64_t seed = 42) {
+		unsigned total = 0;
+		for (const Type& t : types) total += t.weight;
+		std::vector<std::vector<Result>> results(threads, std::vector<Result>(types.size()));
+		auto work = [&](size_t thread) {
+			Rng rng(seed + thread);
+			std::vector<Result>& res = results[thread];
+			for (size_t t = 0; t < types.size(); ++t) res[t].latencies.reserve(n * types[t].weight / total + 1);
+			std::uniform_int_distribution<unsigned> pick(0, total - 1);
+			for (size_t i = 0; i < n; ++i) {
+				unsigned p = pick(rng);
+				size_t t = 0;
+				while (p >= types[t].weight) p -= types[t++].weight;
+				auto begin = std::chrono::steady_clock::now();
+				if (!types[t].run(rng)) ++res[t].failed;
+				res[t].latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+			}
+		};
+		auto start = std::chrono::steady_clock::now();
+		if (threads == 1) {
+			work(0);
+		} else {
+			std::vector<std::thread> workers;
+			for (size_t thread = 0; thread < threads; ++thread) workers.emplace_back(work, thread);
+			for (std::thread& worker : workers) worker.join();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		out << n * threads << " transactions";
+		if (threads > 1) out << " on " << threads << " threads";
+		out << " in " << seconds << " s: " << std::fixed << std::setprecision(0) << n * threads / seconds << " tps" << std::endl;
+		out << std::setprecision(2);
+		for (size_t t = 0; t < types.size(); ++t) {
+			Result all;
+			for (const std::vector<Result>& res : results) {
+				all.latencies.insert(all.latencies.end(), res[t].latencies.begin(), res[t].latencies.end());
+				all.failed += res[t].failed;
+			}
+			if (all.latencies.empty()) continue;
+			std::sort(all.latencies.begin(), all.latencies.end());
+			auto percentile = [&all](double p) {return all.latencies[size_t(p * (all.latencies.size() - 1))] / 1000.0;};
+			out << "  " << types[t].name << ": " << all.latencies.size() << " runs, " << all.failed << " failed, latency us"
+			    << " p50 " << percentile(0.5) << " p99 " << percentile(0.99) << " max " << percentile(1.0) << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+
+private:
+	struct Type {
+		std::string name;
+		unsigned weight;
+		Transaction run;
+	};
+	// of one type on one thread
+	struct Result {
+		std::vector<uint64_t> latencies;// ns
+		size_t failed = 0;
+	};
+	std::vector<Type> types;
+};
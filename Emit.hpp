@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * Runtime support for generated OperatorEmit. Results are written into
+ * batches of typed column arrays (one generated Batch struct per query) and
+ * handed to a callback that runs on its own thread. There are two batches:
+ * the query fills one while the callback works on the other.
+ */
+namespace emit {
+	const size_t batch_size = 1024;
+}
+
+// Batch needs a member size_t count
+template <class Batch>
+struct Batch_Emitter {
+	using Callback = std::function<void(const Batch&)>;
+
+	Batch_Emitter(const Callback& callback) : callback(callback), buffers(new Batch[2]) {
+		buffers[0].count = 0;
+		buffers[1].count = 0;
+		consumer = std::thread([this]() {run();});
+	}
+	Batch_Emitter(const Batch_Emitter&) = delete;
+	Batch_Emitter& operator=(const Batch_Emitter&) = delete;
+	~Batch_Emitter() {finish();}
+
+	Batch& current() {return buffers[filling];}
+
+	// hands the current batch to the callback and returns the other one,
+	// emptied, once the callback is done with it
+	Batch& flush() {
+		std::unique_lock<std::mutex> lock(m);
+		Batch* next = &buffers[filling ^ 1];
+		idle.wait(lock, [this, next]() {return pending == nullptr && busy != next;});
+		pending = &buffers[filling];
+		ready.notify_one();
+		filling ^= 1;
+		next->count = 0;
+		return *next;
+	}
+
+	// emits the last, partial batch and waits for the callback to finish
+	void finish() {
+		if (!consumer.joinable()) return;
+		if (current().count > 0) flush();
+		{
+			std::lock_guard<std::mutex> lock(m);
+			done = true;
+		}
+		ready.notify_one();
+		consumer.join();
+	}
+
+private:
+	Callback callback;
+	std::unique_ptr<Batch[]> buffers;
+	unsigned filling = 0;
+	Batch* pending = nullptr;// handed over, not yet taken by the consumer
+	Batch* busy = nullptr;// in the callback
+	bool done = false;
+	std::mutex m;
+	std::condition_variable ready;
+	std::condition_variable idle;
+	std::thread consumer;
+
+	void run() {
+		std::unique_lock<std::mutex> lock(m);
+		while (true) {
+			ready.wait(lock, [this]() {return pending != nullptr || done;});
+			if (pending == nullptr) return;
+			busy = pending;
+			pending = nullptr;
+			lock.unlock();
+			callback(*busy);
+			lock.lock();
+			busy = nullptr;
+			idle.notify_one();
+		}
+	}
+};
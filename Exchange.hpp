@@ -0,0 +1,274 @@
+#pragma once
+
+#include <poll.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+/**
+ * Runtime support for generated OperatorExchange: one plan run by several
+ * worker processes on one host, each on the tables of its own shard. A
+ * Cluster forks the workers, which load their shard and then wait for
+ * commands on a Unix socket. Cluster::gather() has every worker run the part
+ * of the plan below the exchange and stream its tuples through a
+ * single-producer single-consumer ring in shared memory to the coordinator,
+ * which runs the part above. Workers report completion and errors on their
+ * socket; a worker that dies fails the run without taking the coordinator
+ * down, and later runs fail until the Cluster is rebuilt. An exception thrown
+ * by the coordinator's part cancels the run: the workers stop at their next
+ * push, and gather() waits for all of them before it rethrows, so the next
+ * run starts from idle workers.
+ *
+ * Workers are forked without exec, so code addresses are the same in all
+ * processes: a command names the function to run by its address. Construct
+ * the Cluster before starting other threads (e.g. the log writer), as fork
+ * copies only the calling thread. Tuples are copied as raw bytes and must
+ * not own memory.
+ */
+namespace exchange {
+	const size_t ring_bytes = 1 << 20;
+	const size_t publish_every = 64;// records written before the producer publishes them
+
+	// records are counted from the start of a run; record n is at slot n % capacity
+	struct Ring {
+		alignas(64) std::atomic<uint64_t> head;// records consumed
+		alignas(64) std::atomic<uint64_t> tail;// records produced
+		alignas(64) std::atomic<bool> cancelled;// set by the coordinator, the producer stops
+		alignas(64) char data[ring_bytes];
+	};
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "ring counters must be lock-free to be shared between processes");
+
+	template <class Row>
+	struct Sender {
+		static const size_t capacity = ring_bytes / sizeof(Row);
+
+		explicit Sender(Ring& ring) : ring(ring), tail(ring.tail.load(std::memory_order_relaxed)) {}
+
+		void push(const Row& row) {
+			if (tail - head == capacity) {
+				publish();
+				while (tail - (head = ring.head.load(std::memory_order_acquire)) == capacity) {
+					if (ring.cancelled.load(std::memory_order_relaxed)) throw std::runtime_error("exchange run cancelled");
+					sched_yield();
+				}
+			}
+			memcpy(ring.data + (tail % capacity) * sizeof(Row), &row, sizeof(Row));
+			if (++tail - published == publish_every) publish();
+		}
+
+		void publish() {
+			if (ring.cancelled.load(std::memory_order_relaxed)) throw std::runtime_error("exchange run cancelled");
+			ring.tail.store(tail, std::memory_order_release);
+			published = tail;
+		}
+
+	private:
+		Ring& ring;
+		uint64_t tail;
+		uint64_t published = tail;
+		uint64_t head = 0;// as last seen, the consumer may be further
+	};
+
+	template <class Row>
+	const size_t Sender<Row>::capacity;
+
+	// control messages on the socket of a worker
+	struct Command {
+		uint64_t run;// void(*)(uint64_t produce, Ring&), 0: exit
+		uint64_t produce;
+	};
+	struct Status {
+		uint32_t failed;
+		char what[252];
+	};
+
+	inline bool transfer(int fd, void* data, size_t n, bool out) {
+		char* p = static_cast<char*>(data);
+		for (size_t done = 0; done < n; ) {
+			ssize_t r = out ? ::send(fd, p + done, n - done, MSG_NOSIGNAL) : ::recv(fd, p + done, n - done, 0);
+			if (r < 0 && errno == EINTR) continue;
+			if (r <= 0) return false;
+			done += size_t(r);
+		}
+		return true;
+	}
+
+	// runs in the worker: produce is the generated void(*)(Sender<Row>&)
+	template <class Row>
+	void run(uint64_t produce, Ring& ring) {
+		Sender<Row> sender(ring);
+		reinterpret_cast<void(*)(Sender<Row>&)>(produce)(sender);
+		sender.publish();
+	}
+
+	struct Cluster {
+		using Init = std::function<void(size_t shard, size_t shards)>;
+
+		// forks the worker processes, each calls init(shard, workers) once to load its shard
+		Cluster(size_t workers, const Init& init) {
+			if (workers == 0) throw std::invalid_argument("cluster without workers");
+			void* mem = mmap(nullptr, workers * sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED) throw std::runtime_error("cannot map exchange rings");
+			rings = static_cast<Ring*>(mem);
+			// buffered output would be written again by every worker
+			std::cout.flush();
+			fflush(nullptr);
+			for (size_t w = 0; w < workers; ++w) {
+				int fds[2];
+				if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) throw std::runtime_error("cannot create exchange socket");
+				pid_t pid = fork();
+				if (pid < 0) throw std::runtime_error("cannot fork exchange worker");
+				if (pid == 0) {
+					::close(fds[0]);
+					for (const Worker& other : this->workers) ::close(other.fd);
+					serve(fds[1], w, workers, init);
+				}
+				::close(fds[1]);
+				this->workers.push_back({pid, fds[0], true});
+			}
+		}
+		Cluster(const Cluster&) = delete;
+		Cluster& operator=(const Cluster&) = delete;
+
+		~Cluster() {
+			for (Worker& worker : workers) {
+				if (worker.alive) {
+					Command exit = {0, 0};
+					transfer(worker.fd, &exit, sizeof(exit), true);
+				}
+				::close(worker.fd);
+				waitpid(worker.pid, nullptr, 0);
+			}
+			munmap(rings, workers.size() * sizeof(Ring));
+		}
+
+		size_t size() const {return workers.size();}
+
+		// every worker calls produce, which hands its tuples to Sender::push();
+		// consume(row) gets them in the coordinator, the rows of one worker in order.
+		// If consume throws, the workers are cancelled and the exception is
+		// rethrown once all of them have reported
+		template <class Row, class Fn>
+		void gather(void (*produce)(Sender<Row>&), Fn consume) {
+			static_assert(std::is_trivially_copyable<Row>::value, "exchanged tuples are copied as bytes");
+			const size_t capacity = Sender<Row>::capacity;
+			for (size_t w = 0; w < workers.size(); ++w) {
+				if (!workers[w].alive) throw std::runtime_error("exchange worker " + std::to_string(w) + " is down");
+			}
+			std::vector<uint64_t> heads(workers.size(), 0);
+			std::vector<bool> running(workers.size(), true);
+			std::string error;
+			std::exception_ptr thrown;// by consume, the rest of the run is discarded
+			for (size_t w = 0; w < workers.size(); ++w) {
+				rings[w].head.store(0, std::memory_order_relaxed);
+				rings[w].tail.store(0, std::memory_order_relaxed);
+				rings[w].cancelled.store(false, std::memory_order_relaxed);
+				Command command = {uint64_t(reinterpret_cast<uintptr_t>(&run<Row>)), uint64_t(reinterpret_cast<uintptr_t>(produce))};
+				if (!transfer(workers[w].fd, &command, sizeof(command), true)) {
+					lost(w, error);
+					running[w] = false;
+				}
+			}
+			// drains the ring of worker w, true if there were records
+			auto drain = [&](size_t w) {
+				Ring& ring = rings[w];
+				uint64_t tail = ring.tail.load(std::memory_order_acquire);
+				if (tail == heads[w]) return false;
+				if (!thrown) {
+					try {
+						for (uint64_t n = heads[w]; n < tail; ++n) {
+							consume(*reinterpret_cast<const Row*>(ring.data + (n % capacity) * sizeof(Row)));
+						}
+					} catch (...) {
+						thrown = std::current_exception();
+						for (size_t v = 0; v < workers.size(); ++v) rings[v].cancelled.store(true, std::memory_order_relaxed);
+					}
+				}
+				heads[w] = tail;
+				ring.head.store(tail, std::memory_order_release);
+				return true;
+			};
+			std::vector<pollfd> fds(workers.size());
+			for (size_t active = std::count(running.begin(), running.end(), true); active > 0; ) {
+				bool progress = false;
+				for (size_t w = 0; w < workers.size(); ++w) {
+					if (running[w]) progress |= drain(w);
+				}
+				for (size_t w = 0; w < workers.size(); ++w) {
+					fds[w] = {running[w] ? workers[w].fd : -1, POLLIN, 0};
+				}
+				if (poll(fds.data(), fds.size(), progress ? 0 : 1) <= 0) continue;
+				for (size_t w = 0; w < workers.size(); ++w) {
+					if (fds[w].fd < 0 || fds[w].revents == 0) continue;
+					Status status;
+					if (!transfer(workers[w].fd, &status, sizeof(status), false)) {
+						lost(w, error);
+					} else {
+						// the worker published its last records before it reported
+						drain(w);
+						if (status.failed && error.empty()) error = "exchange worker " + std::to_string(w) + ": " + status.what;
+					}
+					running[w] = false;
+					--active;
+				}
+			}
+			if (thrown) std::rethrow_exception(thrown);
+			if (!error.empty()) throw std::runtime_error(error);
+		}
+
+	private:
+		struct Worker {
+			pid_t pid;
+			int fd;// coordinator's end of the control socket
+			bool alive;
+		};
+		std::vector<Worker> workers;
+		Ring* rings = nullptr;
+
+		void lost(size_t w, std::string& error) {
+			workers[w].alive = false;
+			if (error.empty()) error = "exchange worker " + std::to_string(w) + " exited";
+		}
+
+		[[noreturn]] void serve(int fd, size_t shard, size_t shards, const Init& init) {
+			int code = 0;
+			try {
+				init(shard, shards);
+				Command command;
+				while (transfer(fd, &command, sizeof(command), false) && command.run) {
+					Status status;
+					memset(&status, 0, sizeof(status));
+					try {
+						reinterpret_cast<void(*)(uint64_t, Ring&)>(command.run)(command.produce, rings[shard]);
+					} catch (const std::exception& e) {
+						status.failed = 1;
+						strncpy(status.what, e.what(), sizeof(status.what) - 1);
+					}
+					if (!transfer(fd, &status, sizeof(status), true)) break;
+				}
+			} catch (const std::exception& e) {
+				std::cerr << "exchange worker " << shard << ": " << e.what() << std::endl;
+				code = 1;
+			}
+			std::cout.flush();
+			fflush(nullptr);
+			// the coordinator's static objects are not the worker's to destroy
+			_exit(code);
+		}
+	};
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include "Allocator.hpp"
+
+/**
+ * Runtime support for OperatorHashJoin probing in groups: a build-once hash
+ * table whose lookups are split into steps, so that generated code can hash
+ * a group of probe keys, prefetch their buckets, prefetch the first entries
+ * of the chains and only then compare keys, keeping the cache misses of the
+ * whole group in flight at the same time.
+ *
+ * Entries live in one array in insertion order and are chained by position;
+ * the bucket array holds the position of the last entry inserted into each
+ * bucket. Both grow by doubling, keeping at most one entry per bucket on
+ * average. Lookups do not modify the table.
+ */
+template <class Key, class Value, class Hash, class Equal>
+struct Join_Hash_Table {
+	using key_type = Key;
+	using mapped_type = Value;
+	static const size_t none = ~size_t(0);
+
+	struct Entry {
+		uint64_t hash;
+		size_t next;// none at the end of the chain
+		Key key;
+		Value value;
+	};
+
+	size_t size() const {return entries.size();}
+	size_t bucket_count() const {return heads.size();}
+	size_t end() const {return none;}
+
+	uint64_t hash(const Key& key) const {
+		// the multiplication spreads the bits of weak hashes over the high bits used for the bucket
+		return uint64_t(hasher(key)) * 0x9e3779b97f4a7c15ull;
+	}
+
+	void insert(const Key& key, const Value& value) {
+		insert(hash(key), key, value);
+	}
+
+	void insert(uint64_t h, const Key& key, const Value& value) {
+		if (entries.size() >= heads.size()) grow();
+		size_t& head = heads[h >> shift];
+		entries.push_back({h, head, key, value});
+		head = entries.size() - 1;
+	}
+
+	// false if the key is present already
+	bool insert_unique(const Key& key, const Value& value) {
+		uint64_t h = hash(key);
+		if (find(head(h), h, key) != none) return false;
+		insert(h, key, value);
+		return true;
+	}
+
+	// step 1: fetch the bucket of h into the cache
+	void prefetch(uint64_t h) const {
+		if (!heads.empty()) __builtin_prefetch(&heads[h >> shift]);
+	}
+
+	// step 2: the first entry of the chain of h, prefetched
+	size_t head(uint64_t h) const {
+		if (heads.empty()) return none;
+		size_t entry = heads[h >> shift];
+		if (entry != none) __builtin_prefetch(&entries[entry]);
+		return entry;
+	}
+
+	// step 3: the first entry from entry on with the key, none if there is none
+	size_t find(size_t entry, uint64_t h, const Key& key) const {
+		while (entry != none && !(entries[entry].hash == h && equal(entries[entry].key, key))) {
+			entry = entries[entry].next;
+		}
+		return entry;
+	}
+
+	// the next entry with the key after entry
+	size_t next(size_t entry, uint64_t h, const Key& key) const {
+		return find(entries[entry].next, h, key);
+	}
+
+	size_t find(const Key& key) const {
+		uint64_t h = hash(key);
+		return find(head(h), h, key);
+	}
+
+	const Value& value(size_t entry) const {return entries[entry].value;}
+
+	// fn(hash, key, value) for every entry in insertion order
+	template <class Fn>
+	void for_each(Fn fn) const {
+		for (const Entry& e : entries) fn(e.hash, e.key, e.value);
+	}
+
+	void clear() {
+		entries.clear();
+		heads.clear();
+		shift = 64;
+	}
+
+private:
+	std::vector<Entry,Column_Allocator<Entry>> entries;
+	std::vector<size_t,Column_Allocator<size_t>> heads;
+	unsigned shift = 64;// bucket = hash >> shift
+	Hash hasher;
+	Equal equal;
+
+	void grow() {
+		shift = heads.empty() ? 64 - 4 : shift - 1;
+		heads.assign(size_t(1) << (64 - shift), none);
+		// relinking in insertion order keeps every chain newest first
+		for (size_t i = 0; i < entries.size(); ++i) {
+			size_t& head = heads[entries[i].hash >> shift];
+			entries[i].next = head;
+			head = i;
+		}
+	}
+};
+
+template <class Key, class Value, class Hash, class Equal>
+const size_t Join_Hash_Table<Key,Value,Hash,Equal>::none;
+
+template <class Key, class Value, class Hash, class Equal>
+size_t hash_table_bytes(const Join_Hash_Table<Key,Value,Hash,Equal>& table) {
+	return table.size() * sizeof(typename Join_Hash_Table<Key,Value,Hash,Equal>::Entry) + table.bucket_count() * sizeof(size_t);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "Allocator.hpp"
+#include "Sort.hpp"
+#include "Concurrent.hpp"
+#include "BTree.hpp"
+
+/**
+ * Runtime support for generated Table_::build_index_<name>(): builds an
+ * index from the columns instead of row by row. Key tuples are extracted by
+ * all hardware threads. Tree indices sort the entries with parallel_sort;
+ * a BTree is then bulk loaded bottom-up, std::map and std::multimap get
+ * every insertion at the end. Hash indices size their bucket array once up
+ * front. The std containers are filled sequentially, Concurrent_Hash_Index
+ * by all threads.
+ */
+namespace index_build {
+	// fn(begin, end) over [0, n) split between the hardware threads
+	template <class Fn>
+	void parallel_for(size_t n, Fn fn, size_t min_range = 1 << 14) {
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		size_t ranges = std::min(threads, std::max<size_t>(1, n / min_range));
+		if (ranges < 2) {
+			fn(0, n);
+			return;
+		}
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < ranges; ++i) {
+			workers.emplace_back(fn, n * i / ranges, n * (i + 1) / ranges);
+		}
+		for (auto& w : workers) w.join();
+	}
+
+	template <class K, class V, class C, class A, class Entries>
+	void arrange(std::map<K,V,C,A>&, Entries& entries) {
+		parallel_sort(entries, std::less<typename Entries::value_type>());
+	}
+
+	template <class K, class V, class C, class A, class Entries>
+	void arrange(std::multimap<K,V,C,A>&, Entries& entries) {
+		parallel_sort(entries, std::less<typename Entries::value_type>());
+	}
+
+	template <class K, class V, bool U, class Entries>
+	void arrange(BTree<K,V,U>&, Entries& entries) {
+		parallel_sort(entries, std::less<typename Entries::value_type>());
+	}
+
+	template <class K, class V, class H, class E, class A, class Entries>
+	void arrange(std::unordered_map<K,V,H,E,A>& index, Entries& entries) {
+		index.reserve(entries.size());
+	}
+
+	template <class K, class V, class H, class E, class A, class Entries>
+	void arrange(std::unordered_multimap<K,V,H,E,A>& index, Entries& entries) {
+		index.reserve(entries.size());
+	}
+
+	template <class K, class V, class H, class E, bool U, class Entries>
+	void arrange(Concurrent_Hash_Index<K,V,H,E,U>& index, Entries& entries) {
+		index.reserve(entries.size());
+	}
+
+	template <class Index, class Entries>
+	void fill(Index& index, const Entries& entries) {
+		for (const auto& entry : entries) {
+			index.insert(index.end(), entry);
+		}
+	}
+
+	// entries in key order
+	template <class K, class V, bool U, class Entries>
+	void fill(BTree<K,V,U>& index, const Entries& entries) {
+		index.bulk_load(entries);
+	}
+
+	template <class K, class V, class H, class E, bool U, class Entries>
+	void fill(Concurrent_Hash_Index<K,V,H,E,U>& index, const Entries& entries) {
+		parallel_for(entries.size(), [&index, &entries](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				index.insert(entries[i].first, entries[i].second);
+			}
+		});
+	}
+}
+
+// replaces the contents of index by key_at(tid) -> tid for all tids < rows;
+// throws if a unique index would get a duplicate key
+template <class Index, class Key_At>
+void build_index(Index& index, size_t rows, Key_At key_at, bool unique, const char* name) {
+	using Entry = std::pair<typename Index::key_type, typename Index::mapped_type>;
+	std::vector<Entry,Column_Allocator<Entry>> entries(rows);
+	index_build::parallel_for(rows, [&entries, &key_at](size_t begin, size_t end) {
+		for (size_t tid = begin; tid < end; ++tid) {
+			entries[tid] = Entry(key_at(tid), tid);
+		}
+	});
+	index.clear();
+	index_build::arrange(index, entries);
+	index_build::fill(index, entries);
+	if (unique && index.size() != rows) {
+		throw std::runtime_error(std::string("duplicate key in unique index ") + name);
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * Runtime support for OperatorHashJoin with caching enabled: built join
+ * tables survive the query execution, keyed by a fingerprint of the build
+ * side's generated code. An entry is reused only while the versions of the
+ * tables it was built from are unchanged. Entries are evicted least recently
+ * used first once their estimated size exceeds the budget.
+ */
+struct Join_Cache {
+	struct Entry {
+		std::string key;
+		std::vector<uint64_t> versions;
+		std::shared_ptr<void> table;
+		size_t bytes;
+	};
+
+	Join_Cache(size_t budget) : budget(budget) {}
+
+	// the cached table for key, null if there is none for these versions
+	template <class Table>
+	std::shared_ptr<Table> get(const std::string& key, const std::vector<uint64_t>& versions) {
+		std::lock_guard<std::mutex> lock(m);
+		auto it = index.find(key);
+		if (it == index.end()) return nullptr;
+		if (it->second->versions != versions) {
+			// stale: a build table changed
+			erase(it->second);
+			return nullptr;
+		}
+		entries.splice(entries.begin(), entries, it->second);
+		return std::static_pointer_cast<Table>(entries.front().table);
+	}
+
+	// tables larger than the whole budget are not cached
+	template <class Table>
+	void put(const std::string& key, const std::vector<uint64_t>& versions, const std::shared_ptr<Table>& table, size_t bytes) {
+		std::lock_guard<std::mutex> lock(m);
+		auto it = index.find(key);
+		if (it != index.end()) erase(it->second);
+		if (bytes > budget) return;
+		while (used + bytes > budget) erase(std::prev(entries.end()));
+		entries.push_front({key, versions, table, bytes});
+		index[key] = entries.begin();
+		used += bytes;
+	}
+
+	void setBudget(size_t bytes) {
+		std::lock_guard<std::mutex> lock(m);
+		budget = bytes;
+		while (used > budget) erase(std::prev(entries.end()));
+	}
+
+	size_t memory() const {return used;}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(m);
+		entries.clear();
+		index.clear();
+		used = 0;
+	}
+
+private:
+	size_t budget;
+	size_t used = 0;
+	std::list<Entry> entries;// most recently used first
+	std::unordered_map<std::string,std::list<Entry>::iterator> index;
+	std::mutex m;
+
+	void erase(std::list<Entry>::iterator it) {
+		used -= it->bytes;
+		index.erase(it->key);
+		entries.erase(it);
+	}
+};
+
+inline Join_Cache& join_cache() {
+	static Join_Cache cache(size_t(256) << 20);
+	return cache;
+}
+
+// estimated size of an unordered container: nodes and bucket array
+template <class Map>
+size_t hash_table_bytes(const Map& map) {
+	return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) + map.bucket_count() * sizeof(void*);
+}
@@ -0,0 +1,669 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Column primitives called by generated scans. Every kernel has a scalar
+ * version and, on x86-64, AVX2 and AVX-512 versions selected once at runtime.
+ *
+ * Integer columns are read as int32_t and Numeric columns as int64_t, which
+ * is the layout of the runtime types. A selection vector holds offsets
+ * relative to the start of the processed range.
+ */
+namespace kernels {
+	enum class Cmp : unsigned {Eq, Ne, Lt, Le, Gt, Ge};
+
+	// number of rows handled by one kernel call in generated scans
+	const size_t batch_size = 1024;
+
+	enum class Level : unsigned {Scalar, AVX2, AVX512};
+
+	inline Level detect() {
+#if defined(__x86_64__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw"))
+			return Level::AVX512;
+		if (__builtin_cpu_supports("avx2"))
+			return Level::AVX2;
+#endif
+		return Level::Scalar;
+	}
+
+	inline Level level() {
+		static const Level l = detect();
+		return l;
+	}
+
+	// raw representation of a runtime value (Integer -> int32_t, Numeric -> int64_t)
+	template <class Raw, class T>
+	inline Raw raw(const T& value) {
+		static_assert(sizeof(T) == sizeof(Raw), "unexpected layout of runtime type");
+		Raw res;
+		memcpy(&res, &value, sizeof(Raw));
+		return res;
+	}
+
+	template <class T>
+	inline bool compare(T a, Cmp op, T c) {
+		switch(op) {
+			case Cmp::Eq: return a == c;
+			case Cmp::Ne: return a != c;
+			case Cmp::Lt: return a < c;
+			case Cmp::Le: return a <= c;
+			case Cmp::Gt: return a > c;
+			case Cmp::Ge: return a >= c;
+		}
+		return false;
+	}
+
+	//------------------------------------------------------------------ scalar
+	namespace scalar {
+		template <class T>
+		inline size_t select(const T* col, size_t n, Cmp op, T c, uint32_t* sel) {
+			size_t k = 0;
+			for (size_t i = 0; i < n; ++i) {
+				sel[k] = i;
+				k += compare(col[i], op, c);
+			}
+			return k;
+		}
+
+		template <class T>
+		inline size_t refine(const T* col, const uint32_t* sel_in, size_t n, Cmp op, T c, uint32_t* sel) {
+			size_t k = 0;
+			for (size_t i = 0; i < n; ++i) {
+				uint32_t pos = sel_in[i];
+				sel[k] = pos;
+				k += compare(col[pos], op, c);
+			}
+			return k;
+		}
+
+		template <class T>
+		inline void bitmap(const T* col, size_t n, Cmp op, T c, uint64_t* bits) {
+			for (size_t i = 0; i < n; i += 64) {
+				uint64_t word = 0;
+				for (size_t j = i; j < n && j < i + 64; ++j) {
+					word |= uint64_t(compare(col[j], op, c)) << (j - i);
+				}
+				bits[i / 64] = word;
+			}
+		}
+
+		template <class T>
+		inline void gather(const T* col, const uint32_t* sel, size_t n, T* out) {
+			for (size_t i = 0; i < n; ++i) out[i] = col[sel[i]];
+		}
+
+		inline int64_t sum(const int32_t* col, size_t n) {
+			int64_t res = 0;
+			for (size_t i = 0; i < n; ++i) res += col[i];
+			return res;
+		}
+
+		inline __int128 sum(const int64_t* col, size_t n) {
+			__int128 res = 0;
+			for (size_t i = 0; i < n; ++i) res += col[i];
+			return res;
+		}
+
+		template <class T>
+		inline T min(const T* col, size_t n) {
+			T res = col[0];
+			for (size_t i = 1; i < n; ++i) res = col[i] < res ? col[i] : res;
+			return res;
+		}
+
+		template <class T>
+		inline T max(const T* col, size_t n) {
+			T res = col[0];
+			for (size_t i = 1; i < n; ++i) res = col[i] > res ? col[i] : res;
+			return res;
+		}
+
+		// rows of width stride whose bytes [offset,offset+len) equal value
+		inline size_t equal_bytes(const char* rows, size_t stride, size_t offset, size_t n, const char* value, size_t len, uint32_t* sel) {
+			size_t k = 0;
+			for (size_t i = 0; i < n; ++i) {
+				sel[k] = i;
+				k += memcmp(rows + i*stride + offset, value, len) == 0;
+			}
+			return k;
+		}
+
+		inline size_t refine_equal_bytes(const char* rows, size_t stride, size_t offset, const uint32_t* sel_in, size_t n, const char* value, size_t len, uint32_t* sel) {
+			size_t k = 0;
+			for (size_t i = 0; i < n; ++i) {
+				uint32_t pos = sel_in[i];
+				sel[k] = pos;
+				k += memcmp(rows + pos*stride + offset, value, len) == 0;
+			}
+			return k;
+		}
+
+		// codes [begin, n)
+		inline void unpack(const uint64_t* words, unsigned bits, size_t begin, size_t n, uint32_t* codes) {
+			const char* bytes = reinterpret_cast<const char*>(words);
+			uint64_t mask = (uint64_t(1) << bits) - 1;
+			for (size_t i = begin; i < n; ++i) {
+				size_t pos = i * bits;
+				uint64_t word;
+				memcpy(&word, bytes + (pos >> 3), sizeof(word));
+				codes[i] = (word >> (pos & 7)) & mask;
+			}
+		}
+	}
+
+#if defined(__x86_64__)
+	//------------------------------------------------------------------ AVX2
+	namespace avx2 {
+		// lanes where x op c holds, as an all-ones mask
+		__attribute__((target("avx2")))
+		inline __m256i cmp32(__m256i x, Cmp op, __m256i c) {
+			const __m256i ones = _mm256_set1_epi32(-1);
+			switch(op) {
+				case Cmp::Eq: return _mm256_cmpeq_epi32(x, c);
+				case Cmp::Ne: return _mm256_xor_si256(_mm256_cmpeq_epi32(x, c), ones);
+				case Cmp::Lt: return _mm256_cmpgt_epi32(c, x);
+				case Cmp::Le: return _mm256_xor_si256(_mm256_cmpgt_epi32(x, c), ones);
+				case Cmp::Gt: return _mm256_cmpgt_epi32(x, c);
+				case Cmp::Ge: return _mm256_xor_si256(_mm256_cmpgt_epi32(c, x), ones);
+			}
+			return ones;
+		}
+
+		__attribute__((target("avx2")))
+		inline __m256i cmp64(__m256i x, Cmp op, __m256i c) {
+			const __m256i ones = _mm256_set1_epi64x(-1);
+			switch(op) {
+				case Cmp::Eq: return _mm256_cmpeq_epi64(x, c);
+				case Cmp::Ne: return _mm256_xor_si256(_mm256_cmpeq_epi64(x, c), ones);
+				case Cmp::Lt: return _mm256_cmpgt_epi64(c, x);
+				case Cmp::Le: return _mm256_xor_si256(_mm256_cmpgt_epi64(x, c), ones);
+				case Cmp::Gt: return _mm256_cmpgt_epi64(x, c);
+				case Cmp::Ge: return _mm256_xor_si256(_mm256_cmpgt_epi64(c, x), ones);
+			}
+			return ones;
+		}
+
+		inline size_t append(uint32_t* sel, size_t k, uint32_t base, unsigned mask) {
+			while (mask) {
+				sel[k++] = base + __builtin_ctz(mask);
+				mask &= mask - 1;
+			}
+			return k;
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t select(const int32_t* col, size_t n, Cmp op, int32_t c, uint32_t* sel) {
+			__m256i vc = _mm256_set1_epi32(c);
+			size_t k = 0, i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i));
+				unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(cmp32(x, op, vc)));
+				k = append(sel, k, i, mask);
+			}
+			for (; i < n; ++i) {
+				sel[k] = i;
+				k += compare(col[i], op, c);
+			}
+			return k;
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t select(const int64_t* col, size_t n, Cmp op, int64_t c, uint32_t* sel) {
+			__m256i vc = _mm256_set1_epi64x(c);
+			size_t k = 0, i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i));
+				unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(cmp64(x, op, vc)));
+				k = append(sel, k, i, mask);
+			}
+			for (; i < n; ++i) {
+				sel[k] = i;
+				k += compare(col[i], op, c);
+			}
+			return k;
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t refine(const int32_t* col, const uint32_t* sel_in, size_t n, Cmp op, int32_t c, uint32_t* sel) {
+			__m256i vc = _mm256_set1_epi32(c);
+			size_t k = 0, i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256i pos = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sel_in + i));
+				__m256i x = _mm256_i32gather_epi32(reinterpret_cast<const int*>(col), pos, 4);
+				unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(cmp32(x, op, vc)));
+				while (mask) {
+					sel[k++] = sel_in[i + __builtin_ctz(mask)];
+					mask &= mask - 1;
+				}
+			}
+			for (; i < n; ++i) {
+				uint32_t pos = sel_in[i];
+				sel[k] = pos;
+				k += compare(col[pos], op, c);
+			}
+			return k;
+		}
+
+		__attribute__((target("avx2")))
+		inline void gather(const int32_t* col, const uint32_t* sel, size_t n, int32_t* out) {
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256i pos = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sel + i));
+				__m256i x = _mm256_i32gather_epi32(reinterpret_cast<const int*>(col), pos, 4);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), x);
+			}
+			for (; i < n; ++i) out[i] = col[sel[i]];
+		}
+
+		__attribute__((target("avx2")))
+		inline void gather(const int64_t* col, const uint32_t* sel, size_t n, int64_t* out) {
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128i pos = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sel + i));
+				__m256i x = _mm256_i32gather_epi64(reinterpret_cast<const long long*>(col), pos, 8);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), x);
+			}
+			for (; i < n; ++i) out[i] = col[sel[i]];
+		}
+
+		// 32-bit values are widened to 64-bit lanes, so the sum cannot overflow
+		__attribute__((target("avx2")))
+		inline int64_t sum(const int32_t* col, size_t n) {
+			__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i));
+				acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+				acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+			}
+			int64_t lanes[4];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(acc0, acc1));
+			int64_t res = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			for (; i < n; ++i) res += col[i];
+			return res;
+		}
+
+		__attribute__((target("avx2")))
+		inline int32_t min(const int32_t* col, size_t n) {
+			if (n < 8) return scalar::min(col, n);
+			__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col));
+			size_t i = 8;
+			for (; i + 8 <= n; i += 8) {
+				acc = _mm256_min_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i)));
+			}
+			int32_t lanes[8];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+			int32_t res = scalar::min(lanes, 8);
+			for (; i < n; ++i) res = col[i] < res ? col[i] : res;
+			return res;
+		}
+
+		__attribute__((target("avx2")))
+		inline int32_t max(const int32_t* col, size_t n) {
+			if (n < 8) return scalar::max(col, n);
+			__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col));
+			size_t i = 8;
+			for (; i + 8 <= n; i += 8) {
+				acc = _mm256_max_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i)));
+			}
+			int32_t lanes[8];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+			int32_t res = scalar::max(lanes, 8);
+			for (; i < n; ++i) res = col[i] > res ? col[i] : res;
+			return res;
+		}
+
+		__attribute__((target("avx2")))
+		inline int64_t min(const int64_t* col, size_t n) {
+			if (n < 4) return scalar::min(col, n);
+			__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col));
+			size_t i = 4;
+			for (; i + 4 <= n; i += 4) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i));
+				acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+			}
+			int64_t lanes[4];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+			int64_t res = scalar::min(lanes, 4);
+			for (; i < n; ++i) res = col[i] < res ? col[i] : res;
+			return res;
+		}
+
+		__attribute__((target("avx2")))
+		inline int64_t max(const int64_t* col, size_t n) {
+			if (n < 4) return scalar::max(col, n);
+			__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col));
+			size_t i = 4;
+			for (; i + 4 <= n; i += 4) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i));
+				acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+			}
+			int64_t lanes[4];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+			int64_t res = scalar::max(lanes, 4);
+			for (; i < n; ++i) res = col[i] > res ? col[i] : res;
+			return res;
+		}
+
+		// one 16-byte compare per row for values of up to 16 bytes
+		__attribute__((target("avx2")))
+		inline size_t equal_bytes(const char* rows, size_t stride, size_t offset, size_t n, const char* value, size_t len, uint32_t* sel) {
+			if (len > 16) return scalar::equal_bytes(rows, stride, offset, n, value, len, sel);
+			char padded[16] = {0};
+			memcpy(padded, value, len);
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded));
+			unsigned need = (1u << len) - 1;
+			size_t k = 0;
+			// the rows i with offset + i*stride + 16 <= n*stride have 16 readable bytes
+			size_t safe = n * stride >= offset + 16 ? (n * stride - offset - 16) / stride + 1 : 0;
+			size_t i = 0;
+			for (; i < safe; ++i) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + i*stride + offset));
+				unsigned eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, v));
+				sel[k] = i;
+				k += (eq & need) == need;
+			}
+			for (; i < n; ++i) {
+				sel[k] = i;
+				k += memcmp(rows + i*stride + offset, value, len) == 0;
+			}
+			return k;
+		}
+
+		// 8 codes per step: gather the 8 bytes holding each code, then shift and mask
+		__attribute__((target("avx2")))
+		inline void unpack(const uint64_t* words, unsigned bits, size_t n, uint32_t* codes) {
+			const long long* bytes = reinterpret_cast<const long long*>(words);
+			const __m256i mask = _mm256_set1_epi64x((uint64_t(1) << bits) - 1);
+			const __m256i lows = _mm256_setr_epi32(0,2,4,6,0,2,4,6);
+			__m256i pos = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7), _mm256_set1_epi32(bits));
+			const __m256i step = _mm256_set1_epi32(8 * bits);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256i offsets = _mm256_srli_epi32(pos, 3);
+				__m256i shifts = _mm256_and_si256(pos, _mm256_set1_epi32(7));
+				__m256i lo = _mm256_i32gather_epi64(bytes, _mm256_castsi256_si128(offsets), 1);
+				__m256i hi = _mm256_i32gather_epi64(bytes, _mm256_extracti128_si256(offsets, 1), 1);
+				lo = _mm256_and_si256(_mm256_srlv_epi64(lo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shifts))), mask);
+				hi = _mm256_and_si256(_mm256_srlv_epi64(hi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shifts, 1))), mask);
+				// low halves of the 64-bit lanes, lo then hi
+				lo = _mm256_permutevar8x32_epi32(lo, lows);
+				hi = _mm256_permutevar8x32_epi32(hi, lows);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+				pos = _mm256_add_epi32(pos, step);
+			}
+			scalar::unpack(words, bits, i, n, codes);
+		}
+	}
+
+	//------------------------------------------------------------------ AVX-512
+	// GCC warns about the intrinsics' own unset lanes (_mm512_undefined_*)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+	namespace avx512 {
+		// selection vectors are written with compress-store, no per-bit loop
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline size_t select(const int32_t* col, size_t n, Cmp op, int32_t c, uint32_t* sel) {
+			__m512i vc = _mm512_set1_epi32(c);
+			__m512i pos = _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+			const __m512i step = _mm512_set1_epi32(16);
+			size_t k = 0, i = 0;
+			for (; i + 16 <= n; i += 16) {
+				__m512i x = _mm512_loadu_si512(col + i);
+				__mmask16 mask;
+				switch(op) {
+					case Cmp::Eq: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_EQ); break;
+					case Cmp::Ne: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_NE); break;
+					case Cmp::Lt: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_LT); break;
+					case Cmp::Le: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_LE); break;
+					case Cmp::Gt: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_NLE); break;
+					default:      mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_NLT); break;
+				}
+				_mm512_mask_compressstoreu_epi32(sel + k, mask, pos);
+				k += __builtin_popcount(mask);
+				pos = _mm512_add_epi32(pos, step);
+			}
+			for (; i < n; ++i) {
+				sel[k] = i;
+				k += compare(col[i], op, c);
+			}
+			return k;
+		}
+
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline size_t select(const int64_t* col, size_t n, Cmp op, int64_t c, uint32_t* sel) {
+			__m512i vc = _mm512_set1_epi64(c);
+			__m256i pos = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+			const __m256i step = _mm256_set1_epi32(8);
+			size_t k = 0, i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m512i x = _mm512_loadu_si512(col + i);
+				__mmask8 mask;
+				switch(op) {
+					case Cmp::Eq: mask = _mm512_cmp_epi64_mask(x, vc, _MM_CMPINT_EQ); break;
+					case Cmp::Ne: mask = _mm512_cmp_epi64_mask(x, vc, _MM_CMPINT_NE); break;
+					case Cmp::Lt: mask = _mm512_cmp_epi64_mask(x, vc, _MM_CMPINT_LT); break;
+					case Cmp::Le: mask = _mm512_cmp_epi64_mask(x, vc, _MM_CMPINT_LE); break;
+					case Cmp::Gt: mask = _mm512_cmp_epi64_mask(x, vc, _MM_CMPINT_NLE); break;
+					default:      mask = _mm512_cmp_epi64_mask(x, vc, _MM_CMPINT_NLT); break;
+				}
+				_mm256_mask_compressstoreu_epi32(sel + k, mask, pos);
+				k += __builtin_popcount(mask);
+				pos = _mm256_add_epi32(pos, step);
+			}
+			for (; i < n; ++i) {
+				sel[k] = i;
+				k += compare(col[i], op, c);
+			}
+			return k;
+		}
+
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline size_t refine(const int32_t* col, const uint32_t* sel_in, size_t n, Cmp op, int32_t c, uint32_t* sel) {
+			__m512i vc = _mm512_set1_epi32(c);
+			size_t k = 0, i = 0;
+			for (; i + 16 <= n; i += 16) {
+				__m512i pos = _mm512_loadu_si512(sel_in + i);
+				__m512i x = _mm512_i32gather_epi32(pos, col, 4);
+				__mmask16 mask;
+				switch(op) {
+					case Cmp::Eq: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_EQ); break;
+					case Cmp::Ne: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_NE); break;
+					case Cmp::Lt: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_LT); break;
+					case Cmp::Le: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_LE); break;
+					case Cmp::Gt: mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_NLE); break;
+					default:      mask = _mm512_cmp_epi32_mask(x, vc, _MM_CMPINT_NLT); break;
+				}
+				_mm512_mask_compressstoreu_epi32(sel + k, mask, pos);
+				k += __builtin_popcount(mask);
+			}
+			for (; i < n; ++i) {
+				uint32_t pos = sel_in[i];
+				sel[k] = pos;
+				k += compare(col[pos], op, c);
+			}
+			return k;
+		}
+
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline void gather(const int32_t* col, const uint32_t* sel, size_t n, int32_t* out) {
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				__m512i pos = _mm512_loadu_si512(sel + i);
+				_mm512_storeu_si512(out + i, _mm512_i32gather_epi32(pos, col, 4));
+			}
+			for (; i < n; ++i) out[i] = col[sel[i]];
+		}
+
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline int64_t sum(const int32_t* col, size_t n) {
+			__m512i acc = _mm512_setzero_si512();
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + i));
+				acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(x));
+			}
+			int64_t res = _mm512_reduce_add_epi64(acc);
+			for (; i < n; ++i) res += col[i];
+			return res;
+		}
+
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline int64_t min(const int64_t* col, size_t n) {
+			if (n < 8) return scalar::min(col, n);
+			__m512i acc = _mm512_loadu_si512(col);
+			size_t i = 8;
+			for (; i + 8 <= n; i += 8) acc = _mm512_min_epi64(acc, _mm512_loadu_si512(col + i));
+			int64_t res = _mm512_reduce_min_epi64(acc);
+			for (; i < n; ++i) res = col[i] < res ? col[i] : res;
+			return res;
+		}
+
+		__attribute__((target("avx512f,avx512vl,avx512bw")))
+		inline int64_t max(const int64_t* col, size_t n) {
+			if (n < 8) return scalar::max(col, n);
+			__m512i acc = _mm512_loadu_si512(col);
+			size_t i = 8;
+			for (; i + 8 <= n; i += 8) acc = _mm512_max_epi64(acc, _mm512_loadu_si512(col + i));
+			int64_t res = _mm512_reduce_max_epi64(acc);
+			for (; i < n; ++i) res = col[i] > res ? col[i] : res;
+			return res;
+		}
+	}
+#pragma GCC diagnostic pop
+#endif
+
+	//------------------------------------------------------------------ dispatch
+#if defined(__x86_64__)
+#define KERNELS_DISPATCH(avx512_call, avx2_call, scalar_call) \
+	switch(level()) { \
+		case Level::AVX512: return avx512_call; \
+		case Level::AVX2: return avx2_call; \
+		default: return scalar_call; \
+	}
+#else
+#define KERNELS_DISPATCH(avx512_call, avx2_call, scalar_call) return scalar_call;
+#endif
+
+	// offsets i in [0,n) with col[i] op c
+	inline size_t select(const int32_t* col, size_t n, Cmp op, int32_t c, uint32_t* sel) {
+		KERNELS_DISPATCH(avx512::select(col, n, op, c, sel), avx2::select(col, n, op, c, sel), scalar::select(col, n, op, c, sel))
+	}
+
+	inline size_t select(const int64_t* col, size_t n, Cmp op, int64_t c, uint32_t* sel) {
+		KERNELS_DISPATCH(avx512::select(col, n, op, c, sel), avx2::select(col, n, op, c, sel), scalar::select(col, n, op, c, sel))
+	}
+
+	// entries of sel_in whose row satisfies col[row] op c; sel may alias sel_in
+	inline size_t refine(const int32_t* col, const uint32_t* sel_in, size_t n, Cmp op, int32_t c, uint32_t* sel) {
+		KERNELS_DISPATCH(avx512::refine(col, sel_in, n, op, c, sel), avx2::refine(col, sel_in, n, op, c, sel), scalar::refine(col, sel_in, n, op, c, sel))
+	}
+
+	inline size_t refine(const int64_t* col, const uint32_t* sel_in, size_t n, Cmp op, int64_t c, uint32_t* sel) {
+		return scalar::refine(col, sel_in, n, op, c, sel);
+	}
+
+	// bit i of bits is set if col[i] op c
+	template <class T>
+	inline void bitmap(const T* col, size_t n, Cmp op, T c, uint64_t* bits) {
+		scalar::bitmap(col, n, op, c, bits);
+	}
+
+	inline void gather(const int32_t* col, const uint32_t* sel, size_t n, int32_t* out) {
+		KERNELS_DISPATCH(avx512::gather(col, sel, n, out), avx2::gather(col, sel, n, out), scalar::gather(col, sel, n, out))
+	}
+
+	inline void gather(const int64_t* col, const uint32_t* sel, size_t n, int64_t* out) {
+		KERNELS_DISPATCH(avx2::gather(col, sel, n, out), avx2::gather(col, sel, n, out), scalar::gather(col, sel, n, out))
+	}
+
+	inline int64_t sum(const int32_t* col, size_t n) {
+		KERNELS_DISPATCH(avx512::sum(col, n), avx2::sum(col, n), scalar::sum(col, n))
+	}
+
+	// 64-bit values are summed into 128 bits
+	inline __int128 sum(const int64_t* col, size_t n) {
+		return scalar::sum(col, n);
+	}
+
+	inline int32_t min(const int32_t* col, size_t n) {
+		KERNELS_DISPATCH(avx2::min(col, n), avx2::min(col, n), scalar::min(col, n))
+	}
+
+	inline int32_t max(const int32_t* col, size_t n) {
+		KERNELS_DISPATCH(avx2::max(col, n), avx2::max(col, n), scalar::max(col, n))
+	}
+
+	inline int64_t min(const int64_t* col, size_t n) {
+		KERNELS_DISPATCH(avx512::min(col, n), avx2::min(col, n), scalar::min(col, n))
+	}
+
+	inline int64_t max(const int64_t* col, size_t n) {
+		KERNELS_DISPATCH(avx512::max(col, n), avx2::max(col, n), scalar::max(col, n))
+	}
+
+	// n rows of width stride whose bytes [offset,offset+len) equal prefix; no
+	// byte after the last row is read, AVX-512 machines use the AVX2 version
+	inline size_t equal_bytes(const char* rows, size_t stride, size_t offset, size_t n, const char* prefix, size_t len, uint32_t* sel) {
+		KERNELS_DISPATCH(avx2::equal_bytes(rows, stride, offset, n, prefix, len, sel), avx2::equal_bytes(rows, stride, offset, n, prefix, len, sel), scalar::equal_bytes(rows, stride, offset, n, prefix, len, sel))
+	}
+
+	inline size_t refine_equal_bytes(const char* rows, size_t stride, size_t offset, const uint32_t* sel_in, size_t n, const char* prefix, size_t len, uint32_t* sel) {
+		return scalar::refine_equal_bytes(rows, stride, offset, sel_in, n, prefix, len, sel);
+	}
+
+	// Char<n>: rows starting with prefix (or equal to it if len == n)
+	template <class T>
+	inline size_t prefix_char(const T* col, size_t n, const char* prefix, size_t len, uint32_t* sel) {
+		return equal_bytes(reinterpret_cast<const char*>(col), sizeof(T), offsetof(T, value), n, prefix, len, sel);
+	}
+
+	template <class T>
+	inline size_t refine_prefix_char(const T* col, const uint32_t* sel_in, size_t n, const char* prefix, size_t len, uint32_t* sel) {
+		return refine_equal_bytes(reinterpret_cast<const char*>(col), sizeof(T), offsetof(T, value), sel_in, n, prefix, len, sel);
+	}
+
+	// Varchar<n>: rows at least len long that start with prefix
+	template <class T>
+	inline size_t prefix_varchar(const T* col, size_t n, const char* prefix, size_t len, uint32_t* sel) {
+		size_t k = equal_bytes(reinterpret_cast<const char*>(col), sizeof(T), offsetof(T, value), n, prefix, len, sel);
+		size_t res = 0;
+		for (size_t i = 0; i < k; ++i) {
+			sel[res] = sel[i];
+			res += col[sel[i]].len >= len;
+		}
+		return res;
+	}
+
+	template <class T>
+	inline size_t refine_prefix_varchar(const T* col, const uint32_t* sel_in, size_t n, const char* prefix, size_t len, uint32_t* sel) {
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t pos = sel_in[i];
+			sel[k] = pos;
+			k += (col[pos].len >= len) & (memcmp(col[pos].value, prefix, len) == 0);
+		}
+		return k;
+	}
+
+	// codes i in [0,n) of width bits (at most 32), packed back to back from bit 0
+	// of words; words needs one word of padding after the last code
+	inline void unpack(const uint64_t* words, unsigned bits, size_t n, uint32_t* codes) {
+		if (bits == 0) {
+			memset(codes, 0, n * sizeof(uint32_t));
+			return;
+		}
+		KERNELS_DISPATCH(avx2::unpack(words, bits, n, codes), avx2::unpack(words, bits, n, codes), scalar::unpack(words, bits, 0, n, codes))
+	}
+
+#undef KERNELS_DISPATCH
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "Concurrent.hpp"
+
+/**
+ * Runtime support for batched point lookups into the indices of generated
+ * tables: lookup_batch(index, keys, n, tids) finds n independent keys at
+ * once. Hash lookups are interleaved in groups of keys, so that the cache
+ * misses of a group are in flight together instead of one after the other:
+ * the first node of every bucket of the std hash indices, and the first slot
+ * of Concurrent_Hash_Index, is prefetched for the whole group before any key
+ * is compared. Tree indices are looked up one by one.
+ */
+namespace lookup {
+	// tid of a key that is not in the index
+	const uint64_t missing = ~uint64_t(0);
+	// lookups in flight
+	const size_t group = 16;
+
+	// three passes over each group of keys: hash them, fetch the first node of
+	// each bucket and prefetch it, then walk the chains
+	template <class Index>
+	size_t interleave(const Index& index, const typename Index::key_type* keys, size_t n, typename Index::mapped_type* tids) {
+		using Value = typename Index::mapped_type;
+		size_t buckets[group];
+		typename Index::const_local_iterator nodes[group];
+		size_t found = 0;
+		for (size_t begin = 0; begin < n; begin += group) {
+			size_t count = std::min(group, n - begin);
+			const typename Index::key_type* k = keys + begin;
+			for (size_t i = 0; i < count; ++i) {
+				buckets[i] = index.bucket(k[i]);
+			}
+			for (size_t i = 0; i < count; ++i) {
+				nodes[i] = index.begin(buckets[i]);
+				if (nodes[i] != index.end(buckets[i])) __builtin_prefetch(&*nodes[i]);
+			}
+			for (size_t i = 0; i < count; ++i) {
+				Value& tid = tids[begin + i];
+				tid = Value(missing);
+				for (auto it = nodes[i]; it != index.end(buckets[i]); ++it) {
+					if (index.key_eq()(it->first, k[i])) {
+						tid = it->second;
+						++found;
+						break;
+					}
+				}
+			}
+		}
+		return found;
+	}
+}
+
+// tids[i] = the tid of keys[i] in index, for a non-unique index that of any
+// matching row, lookup::missing if there is none; returns the number found
+template <class Index>
+size_t lookup_batch(const Index& index, const typename Index::key_type* keys, size_t n, typename Index::mapped_type* tids) {
+	size_t found = 0;
+	for (size_t i = 0; i < n; ++i) {
+		auto it = index.find(keys[i]);
+		if (it == index.end()) {
+			tids[i] = typename Index::mapped_type(lookup::missing);
+		} else {
+			tids[i] = it->second;
+			++found;
+		}
+	}
+	return found;
+}
+
+template <class K, class V, class H, class E, class A>
+size_t lookup_batch(const std::unordered_map<K,V,H,E,A>& index, const K* keys, size_t n, V* tids) {
+	return lookup::interleave(index, keys, n, tids);
+}
+
+template <class K, class V, class H, class E, class A>
+size_t lookup_batch(const std::unordered_multimap<K,V,H,E,A>& index, const K* keys, size_t n, V* tids) {
+	return lookup::interleave(index, keys, n, tids);
+}
+
+template <class K, class V, class H, class E, bool U>
+size_t lookup_batch(const Concurrent_Hash_Index<K,V,H,E,U>& index, const K* keys, size_t n, V* tids) {
+	return index.find_batch(keys, n, tids, V(lookup::missing));
+}
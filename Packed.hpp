@@ -0,0 +1,246 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "Allocator.hpp"
+#include "Kernels.hpp"
+
+/**
+ * Column storage for Integer and Numeric attributes declared 'compressed'.
+ * Full blocks of block_size values are frame-of-reference encoded (offsets
+ * from the block minimum) and bit-packed to the width of the block range;
+ * a block of equal values takes no code bits at all. The last, partial block
+ * is kept uncompressed. Each block keeps its minimum and maximum as a zone
+ * map, so selections accept or reject whole blocks without unpacking them.
+ */
+namespace packed {
+	const unsigned block_bits = 10;
+	const size_t block_size = size_t(1) << block_bits;
+	const size_t block_mask = block_size - 1;
+
+	enum class Zone : unsigned {None, Some, All};
+
+	// which rows of a block with values in [min,max] can satisfy x op c
+	template <class Raw>
+	inline Zone zone(Raw min, Raw max, kernels::Cmp op, Raw c) {
+		switch(op) {
+			case kernels::Cmp::Eq:
+				if (c < min || c > max) return Zone::None;
+				return min == max ? Zone::All : Zone::Some;
+			case kernels::Cmp::Ne:
+				if (c < min || c > max) return Zone::All;
+				return min == max ? Zone::None : Zone::Some;
+			case kernels::Cmp::Lt: return c <= min ? Zone::None : (c > max ? Zone::All : Zone::Some);
+			case kernels::Cmp::Le: return c < min ? Zone::None : (c >= max ? Zone::All : Zone::Some);
+			case kernels::Cmp::Gt: return c >= max ? Zone::None : (c < min ? Zone::All : Zone::Some);
+			case kernels::Cmp::Ge: return c > max ? Zone::None : (c <= min ? Zone::All : Zone::Some);
+		}
+		return Zone::Some;
+	}
+}
+
+// T is stored as its Raw representation (Integer: int32_t, Numeric: int64_t)
+template <class T, class Raw>
+struct Packed_Vector {
+	static_assert(sizeof(T) == sizeof(Raw), "unexpected layout of runtime type");
+	static_assert(packed::block_size == kernels::batch_size, "a scan batch covers one block");
+	using Unsigned = typename std::make_unsigned<Raw>::type;
+
+	struct Block {
+		Raw min;
+		Raw max;
+		unsigned bits;// code width: 0 if all values are equal, 64 if the range needs more than 32 bits
+		std::vector<uint64_t,Column_Allocator<uint64_t>> words;// codes and one word of padding
+	};
+	std::vector<Block> blocks;// full blocks
+	std::vector<Raw,Column_Allocator<Raw>> tail;// the last block, uncompressed
+
+	size_t size() const {return blocks.size() * packed::block_size + tail.size();}
+	bool empty() const {return size() == 0;}
+	// the code width of a block is only known once it is full, so only the blocks are reserved, not their words
+	void reserve(size_t n) {
+		blocks.reserve(n >> packed::block_bits);
+		tail.reserve(packed::block_size);
+	}
+
+	T operator[](size_t i) const {return value(get(i));}
+	T back() const {return (*this)[size()-1];}
+
+	Raw get(size_t i) const {
+		size_t b = i >> packed::block_bits;
+		if (b == blocks.size()) return tail[i & packed::block_mask];
+		const Block& block = blocks[b];
+		return decode(block.min, code(block, i & packed::block_mask));
+	}
+
+	// replaces element i; a value outside the block's [min,max] re-encodes the block
+	void set(size_t i, const T& v) {
+		Raw r = kernels::raw<Raw>(v);
+		size_t b = i >> packed::block_bits;
+		if (b == blocks.size()) {
+			tail[i & packed::block_mask] = r;
+			return;
+		}
+		Block& block = blocks[b];
+		if (r >= block.min && r <= block.max) {
+			put(block, i & packed::block_mask, Unsigned(r) - Unsigned(block.min));
+			return;
+		}
+		Raw values[packed::block_size];
+		decodeBlock(block, values);
+		values[i & packed::block_mask] = r;
+		block = encode(values);
+	}
+
+	void push_back(const T& v) {
+		if (tail.capacity() < packed::block_size) tail.reserve(packed::block_size);
+		tail.push_back(kernels::raw<Raw>(v));
+		if (tail.size() == packed::block_size) {
+			blocks.push_back(encode(tail.data()));
+			tail.clear();
+		}
+	}
+
+	void pop_back() {
+		if (tail.empty()) {
+			tail.resize(packed::block_size);
+			decodeBlock(blocks.back(), tail.data());
+			blocks.pop_back();
+		}
+		tail.pop_back();
+	}
+
+	void clear() {
+		blocks.clear();
+		tail.clear();
+	}
+
+	// rows [begin, begin + block_size), or up to size(); begin is a multiple of block_size
+	void decode(size_t begin, T* out) const {
+		Raw* res = reinterpret_cast<Raw*>(out);
+		size_t b = begin >> packed::block_bits;
+		if (b == blocks.size()) {
+			memcpy(res, tail.data(), tail.size() * sizeof(Raw));
+		} else {
+			decodeBlock(blocks[b], res);
+		}
+	}
+
+	// kernels::select over the n rows starting at begin (a multiple of block_size):
+	// the zone map decides whole blocks, otherwise the codes are compared to c - min
+	size_t select(size_t begin, size_t n, kernels::Cmp op, Raw c, uint32_t* sel) const {
+		size_t b = begin >> packed::block_bits;
+		if (b == blocks.size()) return kernels::select(tail.data(), n, op, c, sel);
+		const Block& block = blocks[b];
+		switch(packed::zone(block.min, block.max, op, c)) {
+			case packed::Zone::None:
+				return 0;
+			case packed::Zone::All:
+				for (size_t i = 0; i < n; ++i) sel[i] = i;
+				return n;
+			default:
+				break;
+		}
+		if (block.bits < 32) {
+			// c lies in [min,max] here, so c - min is a valid code
+			uint32_t codes[packed::block_size];
+			kernels::unpack(block.words.data(), block.bits, n, codes);
+			return kernels::select(reinterpret_cast<const int32_t*>(codes), n, op, int32_t(Unsigned(c) - Unsigned(block.min)), sel);
+		}
+		Raw values[packed::block_size];
+		decodeBlock(block, values);
+		return kernels::select(values, n, op, c, sel);
+	}
+
+	// kernels::refine for a selection within the block starting at begin
+	size_t refine(size_t begin, const uint32_t* sel_in, size_t n, kernels::Cmp op, Raw c, uint32_t* sel) const {
+		size_t b = begin >> packed::block_bits;
+		if (b == blocks.size()) return kernels::refine(tail.data(), sel_in, n, op, c, sel);
+		const Block& block = blocks[b];
+		switch(packed::zone(block.min, block.max, op, c)) {
+			case packed::Zone::None:
+				return 0;
+			case packed::Zone::All:
+				if (sel != sel_in) memcpy(sel, sel_in, n * sizeof(uint32_t));
+				return n;
+			default:
+				break;
+		}
+		if (block.bits < 32) {
+			uint32_t codes[packed::block_size];
+			kernels::unpack(block.words.data(), block.bits, packed::block_size, codes);
+			return kernels::refine(reinterpret_cast<const int32_t*>(codes), sel_in, n, op, int32_t(Unsigned(c) - Unsigned(block.min)), sel);
+		}
+		Raw values[packed::block_size];
+		decodeBlock(block, values);
+		return kernels::refine(values, sel_in, n, op, c, sel);
+	}
+
+	// bytes held by the column
+	size_t memory() const {
+		size_t res = blocks.capacity() * sizeof(Block) + tail.capacity() * sizeof(Raw);
+		for (const Block& block : blocks) res += block.words.capacity() * sizeof(uint64_t);
+		return res;
+	}
+
+private:
+	static T value(Raw r) {
+		T res;
+		memcpy(static_cast<void*>(&res), &r, sizeof(T));
+		return res;
+	}
+
+	static Raw decode(Raw min, uint64_t code) {
+		return Raw(Unsigned(min) + Unsigned(code));
+	}
+
+	static uint64_t code(const Block& block, size_t i) {
+		if (block.bits == 0) return 0;
+		if (block.bits == 64) return block.words[i];
+		size_t pos = i * block.bits;
+		uint64_t word;
+		memcpy(&word, reinterpret_cast<const char*>(block.words.data()) + (pos >> 3), sizeof(word));
+		return (word >> (pos & 7)) & ((uint64_t(1) << block.bits) - 1);
+	}
+
+	static void put(Block& block, size_t i, uint64_t code) {
+		if (block.bits == 0) return;
+		if (block.bits == 64) {
+			block.words[i] = code;
+			return;
+		}
+		size_t pos = i * block.bits;
+		char* at = reinterpret_cast<char*>(block.words.data()) + (pos >> 3);
+		uint64_t mask = ((uint64_t(1) << block.bits) - 1) << (pos & 7);
+		uint64_t word;
+		memcpy(&word, at, sizeof(word));
+		word = (word & ~mask) | (code << (pos & 7));
+		memcpy(at, &word, sizeof(word));
+	}
+
+	static Block encode(const Raw* values) {
+		Block block;
+		block.min = kernels::min(values, packed::block_size);
+		block.max = kernels::max(values, packed::block_size);
+		uint64_t range = Unsigned(Unsigned(block.max) - Unsigned(block.min));
+		block.bits = range == 0 ? 0 : 64 - __builtin_clzll(range);
+		if (block.bits > 32) block.bits = 64;
+		block.words.assign(block.bits * packed::block_size / 64 + 1, 0);
+		for (size_t i = 0; i < packed::block_size; ++i) {
+			put(block, i, Unsigned(values[i]) - Unsigned(block.min));
+		}
+		return block;
+	}
+
+	static void decodeBlock(const Block& block, Raw* out) {
+		if (block.bits == 64) {
+			for (size_t i = 0; i < packed::block_size; ++i) out[i] = decode(block.min, block.words[i]);
+			return;
+		}
+		uint32_t codes[packed::block_size];
+		kernels::unpack(block.words.data(), block.bits, packed::block_size, codes);
+		for (size_t i = 0; i < packed::block_size; ++i) out[i] = decode(block.min, codes[i]);
+	}
+};
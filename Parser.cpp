@@ -5,25 +5,76 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
 namespace keyword {
-	const string Primary  = "primary"  ;
-	const string Key      = "key"      ;
-	const string Create   = "create"   ;
-	const string Table    = "table"    ;
-	const string Index    = "index"    ;
-	const string Integer  = "integer"  ;
-	const string Numeric  = "numeric"  ;
-	const string Char     = "char"     ;
-	const string Varchar  = "varchar"  ;
-	const string Timestamp= "timestamp";
-	const string Not      = "not"      ;
-	const string Null     = "null"     ;
-	const string On       = "on"       ;
-	const string Tree     = "tree"     ;
-	const string Unique   = "unique"   ;
+	struct Entry {
+		const char* text;
+		Parser::Keyword id;
+		bool reserved;// reserved keywords are not accepted as identifiers
+	};
+	const Entry list[] = {
+		 {"primary"  , Parser::Keyword::Primary  , true }
+		,{"key"      , Parser::Keyword::Key      , true }
+		,{"create"   , Parser::Keyword::Create   , true }
+		,{"table"    , Parser::Keyword::Table    , true }
+		,{"index"    , Parser::Keyword::Index    , true }
+		,{"integer"  , Parser::Keyword::Integer  , true }
+		,{"numeric"  , Parser::Keyword::Numeric  , true }
+		,{"char"     , Parser::Keyword::Char     , true }
+		,{"varchar"  , Parser::Keyword::Varchar  , true }
+		,{"timestamp", Parser::Keyword::Timestamp, true }
+		,{"not"      , Parser::Keyword::Not      , true }
+		,{"null"     , Parser::Keyword::Null     , true }
+		,{"on"       , Parser::Keyword::On       , true }
+		,{"tree"     , Parser::Keyword::Tree     , false}
+		,{"unique"   , Parser::Keyword::Unique   , false}
+		,{"chunked"  , Parser::Keyword::Chunked  , false}
+		,{"compressed", Parser::Keyword::Compressed, false}
+		,{"synchronized", Parser::Keyword::Synchronized, false}
+		,{"partition", Parser::Keyword::Partition, false}
+		,{"by"       , Parser::Keyword::By       , false}
+	};
+	
+	// perfect hash over the lower-cased keywords: (len + first + 2*last) & (slots-1),
+	// i.e. & 63; the slot table is filled on first use and asserts that no two keywords collide
+	const unsigned slots = 64;
+	inline unsigned hash(const char* str, size_t len) {
+		return (len + (str[0] | 0x20) + 2*(str[len-1] | 0x20)) & (slots-1);
+	}
+	
+	struct Table {
+		const Entry* slot[slots];
+		Table() {
+			fill(slot, slot+slots, nullptr);
+			for (const Entry& e : list) {
+				unsigned h = hash(e.text, strlen(e.text));
+				if (slot[h] != nullptr) {
+					cerr << "keyword hash collision: " << e.text << ", " << slot[h]->text << endl;
+					abort();
+				}
+				slot[h] = &e;
+			}
+		}
+	};
+	
+	// case-insensitive lookup; nullptr if token is not a keyword
+	const Entry* find(const Token& token) {
+		static const Table table;
+		if (token.len == 0) return nullptr;
+		const Entry* e = table.slot[hash(token.begin, token.len)];
+		if (e == nullptr) return nullptr;
+		for (size_t i = 0; i < token.len; ++i) {
+			// only upper-case letters map to lower-case letters under | 0x20
+			if (e->text[i] == 0 || (token.begin[i] | 0x20) != e->text[i]) return nullptr;
+		}
+		return e->text[token.len] == 0 ? e : nullptr;
+	}
 }
 
 namespace literal {
@@ -33,113 +84,179 @@ namespace literal {
 	const char Semicolon       = ';';
 }
 
-template<typename T>
-struct NamePredicate {
-	const string& name;
-	NamePredicate(const string& name) : name(name) {}
-	bool operator()(const T& t) const { return t.name == name; }
+// read-only mapping of the schema file; tokens point into it
+struct Mapped_File {
+	const char* data = "";
+	size_t size = 0;
+	void* mapping = MAP_FAILED;
+	int fd = -1;
+	bool open(const string& fileName) {
+		fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0) return false;
+		size = st.st_size;
+		if (size == 0) return true;
+		mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) return false;
+		madvise(mapping, size, MADV_SEQUENTIAL);
+		data = static_cast<const char*>(mapping);
+		return true;
+	}
+	~Mapped_File() {
+		if (mapping != MAP_FAILED) munmap(mapping, size);
+		if (fd >= 0) close(fd);
+	}
 };
 
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool isDelimiter(char c) {
+	return c == literal::Comma || c == literal::ParenthesisLeft || c == literal::ParenthesisRight || c == literal::Semicolon;
+}
+
 unique_ptr<Schema> Parser::parse() {
-	string token;
 	unsigned line = 1;
 	unique_ptr<Schema> s(new Schema());
-	in.open(fileName.c_str());
-	if (!in.is_open()) {
+	Mapped_File file;
+	if (!file.open(fileName)) {
 		throw ParserError(line, "cannot open file '"+fileName+"'");
 	}
-	while (in >> token) {
-		string::size_type pos;
-		string::size_type prevPos = 0;
-
-		while (( pos = token.find_first_of(",)(;", prevPos) ) != string::npos) {
-			nextToken(line, token.substr(prevPos, pos-prevPos), *s);
-			nextToken(line, token.substr(pos,1), *s);
-			prevPos=pos+1;
-		}
-		nextToken(line, token.substr(prevPos), *s);
-		if (token.find("\n")!=string::npos) {
+	debug = getenv("DEBUG") != nullptr;
+	relation_ids.clear();
+	attribute_ids.clear();
+	
+	const char* pos = file.data;
+	const char* end = file.data + file.size;
+	while (pos != end) {
+		if (*pos == '\n') {
 			++line;
+			++pos;
+		} else if (isSpace(*pos)) {
+			++pos;
+		} else {
+			const char* begin = pos++;
+			if (!isDelimiter(*begin)) {
+				while (pos != end && !isSpace(*pos) && !isDelimiter(*pos)) ++pos;
+			}
+			nextToken(line, {begin, size_t(pos - begin)}, *s);
 		}
 	}
-	in.close();
-	return move(s);
+	// hash maps point into the mapping
+	relation_ids.clear();
+	attribute_ids.clear();
+	return s;
 }
 
-static bool isIdentifier(const string& str) {
-	if (
-		   str==keyword::Primary   
-		|| str==keyword::Key       
-		|| str==keyword::Create    
-		|| str==keyword::Table     
-		|| str==keyword::Index     
-		|| str==keyword::Integer   
-		|| str==keyword::Numeric   
-		|| str==keyword::Char      
-		|| str==keyword::Varchar   
-		|| str==keyword::Timestamp 
-		|| str==keyword::Not       
-		|| str==keyword::Null      
-		|| str==keyword::On        
-	) 
-	{
+static bool isIdentifier(const Token& token, const keyword::Entry* kw) {
+	if (kw != nullptr && kw->reserved) {
 		return false;
 	}
+	for (size_t i = 0; i < token.len; ++i) {
+		char c = token.begin[i];
+		if (!isalnum((unsigned char)c) && c != '_') return false;
+	}
+	return true;
+}
+
+static bool isInt(const Token& token) {
+	for (size_t i = 0; i < token.len; ++i) {
+		if (!isdigit((unsigned char)token.begin[i])) return false;
+	}
+	return true;
+}
+
+static unsigned toUnsigned(const Token& token) {
+	unsigned res = 0;
+	for (size_t i = 0; i < token.len; ++i) {
+		res = res*10 + (token.begin[i] - '0');
+	}
+	return res;
+}
+
+unsigned Parser::attributeId(unsigned line, const Token& token) {
+	const auto& ids = attribute_ids[rel_id];
+	auto it = ids.find(token);
+	if (it == ids.end())
+		throw ParserError(line, "'"+token.str()+"' is not an attribute of '"+rel->name+"'");
+	return it->second;
+}
 
-	return str.find_first_not_of("abcdefghijklmnopqrstuvwxyz_1234567890") == string::npos;
+// 'compressed' after the type of the current attribute
+void Parser::compressAttribute(unsigned line) {
+	Schema::Relation::Attribute& attr = rel->attributes.back();
+	if (attr.type == Types::Tag::Timestamp)
+		throw ParserError(line, "Only integer, numeric, char and varchar attributes can be compressed: '"+attr.name+"'");
+	attr.compressed = true;
 }
 
-static bool isInt(const string& str) {
-   return str.find_first_not_of("0123456789") == string::npos;
+// 'partition by (<token>)' after the table definition
+void Parser::partitionAttribute(unsigned line, const Token& token) {
+	unsigned id = attributeId(line, token);
+	if (rel->attributes[id].type != Types::Tag::Integer)
+		throw ParserError(line, "Only integer attributes can partition a table: '"+token.str()+"'");
+	rel->partitioned = true;
+	rel->partitionAttribute = id;
 }
 
-void Parser::nextToken(unsigned line, const string& token, Schema& schema) {
-	if (getenv("DEBUG"))
-		cerr << line << ": " << token << endl;
-	if (token.empty())
+// every partition has its own indices, so every key has to name its partition
+void Parser::checkPartitioned(unsigned line, const Schema::Relation::Index& ind) {
+	if (find(ind.fields.begin(), ind.fields.end(), rel->partitionAttribute) == ind.fields.end())
+		throw ParserError(line, "Index '"+ind.name+"' of '"+rel->name+"' does not contain the partition attribute '"+rel->attributes[rel->partitionAttribute].name+"'");
+}
+
+void Parser::nextToken(unsigned line, const Token& token, Schema& schema) {
+	if (debug)
+		cerr << line << ": " << token.str() << endl;
+	if (token.len == 0)
 		return;
-	string tok;
-	
-	transform(token.begin(), token.end(), back_inserter(tok), ::tolower);
+	const keyword::Entry* kw = keyword::find(token);
+	Keyword tok = kw != nullptr ? kw->id : Keyword::None;
 	
 	
 	switch(state) {
 		case State::Semicolon: /* fallthrough */
 		case State::Init:
 			rel = nullptr;
-			if (tok==keyword::Create)
+			if (tok==Keyword::Create)
 				state=State::Create;
 			else
-				throw ParserError(line, "Expected 'CREATE', found '"+token+"'");
+				throw ParserError(line, "Expected 'CREATE', found '"+token.str()+"'");
 			break;
 		case State::Create:
-			if (tok==keyword::Table)
+			if (tok==Keyword::Table)
 				state=State::Table;
-			else if (tok==keyword::Index)
+			else if (tok==Keyword::Index)
 				state=State::Index;
 			else
-				throw ParserError(line, "Expected 'TABLE', found '"+token+"'");
+				throw ParserError(line, "Expected 'TABLE', found '"+token.str()+"'");
 			break;
 		case State::Table:
-			if (isIdentifier(tok)) {
+			if (isIdentifier(token, kw)) {
 				state=State::TableName;
-				schema.relations.push_back(Schema::Relation(token));
+				rel_id = schema.relations.size();
+				schema.relations.push_back(Schema::Relation(token.str()));
 				rel = &schema.relations.back();
+				rel->id = rel_id;
+				relation_ids.emplace(token, rel_id);
+				attribute_ids.emplace_back();
 			} else {
-				throw ParserError(line, "Expected TableName, found '"+token+"'");
+				throw ParserError(line, "Expected TableName, found '"+token.str()+"'");
 			}
 			break;
 		case State::TableName:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::CreateTableBegin;
 			else
-				throw ParserError(line, "Expected '(', found '"+token+"'");
+				throw ParserError(line, "Expected '(', found '"+token.str()+"'");
 			break;
 		case State::Separator: /* fallthrough */
 		case State::CreateTableBegin:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisRight) {
+			if (token.is(literal::ParenthesisRight)) {
 				state=State::CreateTableEnd;
-			} else if (tok==keyword::Primary) {
+			} else if (tok==Keyword::Primary) {
 				state=State::Primary;
 				rel->indices.push_back(Schema::Relation::Index());
 				rel->primaryKey = rel->indices.size() - 1;
@@ -147,257 +264,291 @@ void Parser::nextToken(unsigned line, const string& token, Schema& schema) {
 				rel->indices.back().name = "primary_key";
 				rel->indices.back().primary = true;
 				rel->indices.back().unique = true;
-			} else if (isIdentifier(tok)) {
+			} else if (isIdentifier(token, kw)) {
+				attribute_ids[rel_id].emplace(token, rel->attributes.size());
 				rel->attributes.push_back(Schema::Relation::Attribute());
-				rel->attributes.back().name = token;
+				rel->attributes.back().name = token.str();
 				state=State::AttributeName;
 			} else {
-				throw ParserError(line, "Expected attribute definition, primary key definition or ')', found '"+token+"'");
+				throw ParserError(line, "Expected attribute definition, primary key definition or ')', found '"+token.str()+"'");
 			}
 			break;
 		case State::CreateTableEnd:
-			if (tok.size()==1 && tok[0]==literal::Semicolon)
+			if (token.is(literal::Semicolon)) {
+				if (rel->partitioned) {
+					if (rel->synchronized)
+						throw ParserError(line, "Partitioned table '"+rel->name+"' cannot be synchronized");
+					for (const auto& ind : rel->indices) checkPartitioned(line, ind);
+				}
 				state=State::Semicolon;
+			} else if (tok==Keyword::Chunked)
+				rel->chunked = true;
+			else if (tok==Keyword::Synchronized)
+				rel->synchronized = true;
+			else if (tok==Keyword::Partition && !rel->partitioned)
+				state=State::Partition;
+			else
+				throw ParserError(line, "Expected ';' or table option, found '"+token.str()+"'");
+			break;
+		case State::Partition:
+			if (tok==Keyword::By)
+				state=State::PartitionBy;
 			else
-				throw ParserError(line, "Expected ';', found '"+token+"'");
+				throw ParserError(line, "Expected 'BY', found '"+token.str()+"'");
+			break;
+		case State::PartitionBy:
+			if (token.is(literal::ParenthesisLeft))
+				state=State::PartitionListBegin;
+			else
+				throw ParserError(line, "Expected '(' after 'PARTITION BY', found '"+token.str()+"'");
+			break;
+		case State::PartitionListBegin:
+			if (isIdentifier(token, kw)) {
+				partitionAttribute(line, token);
+				state=State::PartitionName;
+			} else {
+				throw ParserError(line, "Expected partition attribute, found '"+token.str()+"'");
+			}
+			break;
+		case State::PartitionName:
+			if (token.is(literal::ParenthesisRight))
+				state=State::CreateTableEnd;
+			else
+				throw ParserError(line, "Expected ')' after the partition attribute, found '"+token.str()+"'");
 			break;
 		case State::Primary:
-			if (tok==keyword::Key)
+			if (tok==Keyword::Key)
 				state=State::Key;
 			else
-				throw ParserError(line, "Expected 'KEY', found '"+token+"'");
+				throw ParserError(line, "Expected 'KEY', found '"+token.str()+"'");
 			break;
 		case State::Key:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::KeyListBegin;
-			else if (tok==keyword::Tree) {
+			else if (tok==Keyword::Tree) {
 				state=State::PrimaryTree;
 				rel->indices.back().tree = true;
 			} else
-				throw ParserError(line, "Expected list of key attributes or 'tree', found '"+token+"'");
+				throw ParserError(line, "Expected list of key attributes or 'tree', found '"+token.str()+"'");
 			break;
 		case State::PrimaryTree:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::KeyListBegin;
 			else
-				throw ParserError(line, "Expected list of key attributes or 'tree', found '"+token+"'");
+				throw ParserError(line, "Expected list of key attributes or 'tree', found '"+token.str()+"'");
 			break;			
 		case State::KeyListBegin:
-			if (isIdentifier(tok)) {
-				auto& attributes = rel->attributes;
-				auto it = find_if(attributes.begin(), attributes.end(), NamePredicate<Schema::Relation::Attribute>(token));
-				if (it == attributes.end())
-					throw ParserError(line, "'"+token+"' is not an attribute of '"+rel->name+"'");
-				it->primaryFlag = true;
-				rel->indices.back().fields.push_back(distance(attributes.begin(), it));
+			if (isIdentifier(token, kw)) {
+				unsigned id = attributeId(line, token);
+				rel->attributes[id].primaryFlag = true;
+				rel->indices.back().fields.push_back(id);
 				state=State::KeyName;
 			} else {
-				throw ParserError(line, "Expected key attribute, found '"+token+"'");
+				throw ParserError(line, "Expected key attribute, found '"+token.str()+"'");
 			}
 			break;
 		case State::KeyName:
-			if (tok.size()==1 && tok[0] == literal::Comma)
+			if (token.is(literal::Comma))
 				state=State::KeyListBegin;
-			else if (tok.size()==1 && tok[0] == literal::ParenthesisRight)
+			else if (token.is(literal::ParenthesisRight))
 				state=State::KeyListEnd;
 			else
-				throw ParserError(line, "Expected ',' or ')', found '"+token+"'");
+				throw ParserError(line, "Expected ',' or ')', found '"+token.str()+"'");
 			break;
 		case State::KeyListEnd:
-			if (tok.size()==1 && tok[0] == literal::Comma)
+			if (token.is(literal::Comma))
 				state=State::Separator;
-			else if (tok.size()==1 && tok[0] == literal::ParenthesisRight)
+			else if (token.is(literal::ParenthesisRight))
 				state=State::CreateTableEnd;
 			else
-				throw ParserError(line, "Expected ',' or ')', found '"+token+"'");
+				throw ParserError(line, "Expected ',' or ')', found '"+token.str()+"'");
 			break;
 		case State::AttributeName:
-			if (tok==keyword::Integer) {
+			if (tok==Keyword::Integer) {
 				rel->attributes.back().type=Types::Tag::Integer;
 				state=State::AttributeTypeInt;
-			} else if (tok==keyword::Char) {
+			} else if (tok==Keyword::Char) {
 				rel->attributes.back().type=Types::Tag::Char;
 				state=State::AttributeTypeChar;
-			} else if (tok==keyword::Numeric) {
+			} else if (tok==Keyword::Numeric) {
 				rel->attributes.back().type=Types::Tag::Numeric;
 				state=State::AttributeTypeNumeric;
-			} else if (tok==keyword::Varchar) {
+			} else if (tok==Keyword::Varchar) {
 				rel->attributes.back().type=Types::Tag::Varchar;
 				state=State::AttributeTypeChar;
-			} else if (tok==keyword::Timestamp) {
+			} else if (tok==Keyword::Timestamp) {
 				rel->attributes.back().type=Types::Tag::Timestamp;
 				state=State::AttributeTypeInt;
 			}
 			else {
-				throw ParserError(line, "Expected type after attribute name, found '"+token+"'");
+				throw ParserError(line, "Expected type after attribute name, found '"+token.str()+"'");
 			}
 			break;
 		case State::AttributeTypeChar:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::CharBegin;
 			else
-				throw ParserError(line, "Expected '(' after 'CHAR', found'"+token+"'");
+				throw ParserError(line, "Expected '(' after 'CHAR', found'"+token.str()+"'");
 			break;
 		case State::CharBegin:
-			if (isInt(tok)) {
-				rel->attributes.back().len=atoi(tok.c_str());
+			if (isInt(token)) {
+				rel->attributes.back().len=toUnsigned(token);
 				state=State::CharValue;
 			} else {
-				throw ParserError(line, "Expected integer after 'CHAR(', found'"+token+"'");
+				throw ParserError(line, "Expected integer after 'CHAR(', found'"+token.str()+"'");
 			}
 			break;
 		case State::CharValue:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisRight)
+			if (token.is(literal::ParenthesisRight))
 				state=State::CharEnd;
 			else
-				throw ParserError(line, "Expected ')' after length of CHAR, found'"+token+"'");
+				throw ParserError(line, "Expected ')' after length of CHAR, found'"+token.str()+"'");
 			break;
 		case State::AttributeTypeNumeric:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::NumericBegin;
 			else
-				throw ParserError(line, "Expected '(' after 'NUMERIC', found'"+token+"'");
+				throw ParserError(line, "Expected '(' after 'NUMERIC', found'"+token.str()+"'");
 			break;
 		case State::NumericBegin:
-			if (isInt(tok)) {
-				rel->attributes.back().len=atoi(tok.c_str());
+			if (isInt(token)) {
+				rel->attributes.back().len=toUnsigned(token);
 				state=State::NumericValue1;
 			} else {
-				throw ParserError(line, "Expected integer after 'NUMERIC(', found'"+token+"'");
+				throw ParserError(line, "Expected integer after 'NUMERIC(', found'"+token.str()+"'");
 			}
 			break;
 		case State::NumericValue1:
-			if (tok.size()==1 && tok[0]==literal::Comma)
+			if (token.is(literal::Comma))
 				state=State::NumericSeparator;
 			else
-				throw ParserError(line, "Expected ',' after first length of NUMERIC, found'"+token+"'");
+				throw ParserError(line, "Expected ',' after first length of NUMERIC, found'"+token.str()+"'");
 			break;
 		case State::NumericValue2:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisRight)
+			if (token.is(literal::ParenthesisRight))
 				state=State::NumericEnd;
 			else
-				throw ParserError(line, "Expected ')' after second length of NUMERIC, found'"+token+"'");
+				throw ParserError(line, "Expected ')' after second length of NUMERIC, found'"+token.str()+"'");
 			break;
 		case State::NumericSeparator:
-			if (isInt(tok)) {
-				rel->attributes.back().len2=atoi(tok.c_str());
+			if (isInt(token)) {
+				rel->attributes.back().len2=toUnsigned(token);
 				state=State::NumericValue2;
 			} else {
-				throw ParserError(line, "Expected second length for NUMERIC type, found'"+token+"'");
+				throw ParserError(line, "Expected second length for NUMERIC type, found'"+token.str()+"'");
 			}
 			break;
 		case State::CharEnd: /* fallthrough */
 		case State::NumericEnd: /* fallthrough */
 		case State::AttributeTypeInt:
-			if (tok.size()==1 && tok[0]==literal::Comma)
+			if (token.is(literal::Comma))
 				state=State::Separator;
-			else if (tok==keyword::Not)
+			else if (tok==Keyword::Not)
 				state=State::Not;
-			else if (tok.size()==1 && tok[0]==literal::ParenthesisRight)
+			else if (tok==Keyword::Compressed)
+				compressAttribute(line);
+			else if (token.is(literal::ParenthesisRight))
 				state=State::CreateTableEnd;
 			else 
-				throw ParserError(line, "Expected ',' or 'NOT NULL' after attribute type, found '"+token+"'");
+				throw ParserError(line, "Expected ',' or 'NOT NULL' after attribute type, found '"+token.str()+"'");
 			break;
 		case State::Not:
-			if (tok==keyword::Null) {
+			if (tok==Keyword::Null) {
 				rel->attributes.back().notNull=true;
 				state=State::Null;
 			}
 			else 
-				throw ParserError(line, "Expected 'NULL' after 'NOT' name, found '"+token+"'");
+				throw ParserError(line, "Expected 'NULL' after 'NOT' name, found '"+token.str()+"'");
 			break;
 		case State::Null:
-			if (tok.size()==1 && tok[0]==literal::Comma)
+			if (token.is(literal::Comma))
 				state=State::Separator;
-			else if (tok.size()==1 && tok[0]==literal::ParenthesisRight)
+			else if (tok==Keyword::Compressed)
+				compressAttribute(line);
+			else if (token.is(literal::ParenthesisRight))
 				state=State::CreateTableEnd;
 			else 
-				throw ParserError(line, "Expected ',' or ')' after attribute definition, found '"+token+"'");
+				throw ParserError(line, "Expected ',' or ')' after attribute definition, found '"+token.str()+"'");
 			break;
 		case State::Index:
-			if (isIdentifier(tok)) {
+			if (isIdentifier(token, kw)) {
 				state=State::IndexName;
-				index_name = token;
+				index_name = token.str();
 			} else {
-				throw ParserError(line, "Expected IndexName, found '"+token+"'");
+				throw ParserError(line, "Expected IndexName, found '"+token.str()+"'");
 			}
 			break;
 		case State::IndexName:
-			if (tok==keyword::On)
+			if (tok==Keyword::On)
 				state=State::IndexOn;
 			else
-				throw ParserError(line, "Expected 'ON' after index name, found '"+token+"'");
+				throw ParserError(line, "Expected 'ON' after index name, found '"+token.str()+"'");
 			break;
 		case State::IndexOn:
-			if (isIdentifier(tok)) {
+			if (isIdentifier(token, kw)) {
 				// obtain relation
-				auto& relations = schema.relations;
-				auto it = find_if(relations.begin(), relations.end(), NamePredicate<Schema::Relation>(token));
-				
-				if (it == schema.relations.end())
-					throw ParserError(line, "'"+token+"' is not a table");
-				rel = &(*it);
+				auto it = relation_ids.find(token);
+				if (it == relation_ids.end())
+					throw ParserError(line, "'"+token.str()+"' is not a table");
+				rel_id = it->second;
+				rel = &schema.relations[rel_id];
 				// add index
 				rel->indices.push_back(Schema::Relation::Index());
 				rel->indices.back().name = index_name;
 				state=State::IndexTable;
 			} else {
-				throw ParserError(line, "Expected IndexTableName, found '"+token+"'");
+				throw ParserError(line, "Expected IndexTableName, found '"+token.str()+"'");
 			}
 			break;
 		case State::IndexTable:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::CreateIndexBegin;
-			else if (tok==keyword::Unique) {
+			else if (tok==Keyword::Unique) {
 				state=State::IndexUnique;
 				rel->indices.back().unique = true;
-			} else if (tok==keyword::Tree) {
+			} else if (tok==Keyword::Tree) {
 				state=State::IndexTree;
 				rel->indices.back().tree = true;
 			} else
-				throw ParserError(line, "Expected '(' or 'unique' or 'tree', found '"+token+"'");
+				throw ParserError(line, "Expected '(' or 'unique' or 'tree', found '"+token.str()+"'");
 			break;
 		case State::IndexUnique:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::CreateIndexBegin;
-			else if (tok==keyword::Tree) {
+			else if (tok==Keyword::Tree) {
 				state=State::IndexTree;
 				rel->indices.back().tree = true;
 			} else
-				throw ParserError(line, "Expected '(' or 'tree', found '"+token+"'");
+				throw ParserError(line, "Expected '(' or 'tree', found '"+token.str()+"'");
 			break;
 		case State::IndexTree:
-			if (tok.size()==1 && tok[0]==literal::ParenthesisLeft)
+			if (token.is(literal::ParenthesisLeft))
 				state=State::CreateIndexBegin;
 			else
-				throw ParserError(line, "Expected '(', found '"+token+"'");
+				throw ParserError(line, "Expected '(', found '"+token.str()+"'");
 			break;
 		case State::CreateIndexBegin:
-			if (isIdentifier(tok)) {
-				const auto& attributes = rel->attributes;
-				auto it = find_if(attributes.begin(), attributes.end(), NamePredicate<Schema::Relation::Attribute>(token));
-				if (it == attributes.end())
-					throw ParserError(line, "'"+token+"' is not an attribute of '"+rel->name+"'");
-
-				rel->indices.back().fields.push_back(distance(attributes.begin(), it));
+			if (isIdentifier(token, kw)) {
+				rel->indices.back().fields.push_back(attributeId(line, token));
 				state=State::IndexField;
 			} else {
-				throw ParserError(line, "Expected index attribute, found '"+token+"'");
+				throw ParserError(line, "Expected index attribute, found '"+token.str()+"'");
 			}			
 			break;
 		case State::IndexField:
-			if (tok.size()==1 && tok[0] == literal::Comma)
+			if (token.is(literal::Comma))
 				state=State::CreateIndexBegin;
-			else if (tok.size()==1 && tok[0] == literal::ParenthesisRight)
+			else if (token.is(literal::ParenthesisRight))
 				state=State::CreateIndexEnd;
 			else
-				throw ParserError(line, "Expected ',' or ')', found '"+token+"'");
+				throw ParserError(line, "Expected ',' or ')', found '"+token.str()+"'");
 			break;
 		case State::CreateIndexEnd:
-			if (tok.size()==1 && tok[0]==literal::Semicolon)
+			if (token.is(literal::Semicolon)) {
+				if (rel->partitioned) checkPartitioned(line, rel->indices.back());
 				state=State::Semicolon;
-			else
-				throw ParserError(line, "Expected ';', found '"+token+"'");
+			} else
+				throw ParserError(line, "Expected ';', found '"+token.str()+"'");
 			break;
 		default:
 			throw;
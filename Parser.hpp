@@ -1,10 +1,12 @@
 #pragma once
 
 #include <exception>
+#include <cstring>
 #include <string>
 #include <memory>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
 #include "Schema.hpp"
 
 using namespace std;
@@ -20,15 +22,35 @@ public:
    }
 };
 
+// token inside the mapped schema file; valid while parse() runs
+struct Token {
+	const char* begin;
+	size_t len;
+	bool is(char c) const {return len == 1 && *begin == c;}
+	bool operator==(const Token& t) const {return len == t.len && memcmp(begin, t.begin, len) == 0;}
+	string str() const {return string(begin, len);}
+};
+
+struct Token_Hash {
+	size_t operator()(const Token& t) const {
+		size_t h = 14695981039346656037ull;
+		for (size_t i = 0; i < t.len; ++i) h = (h ^ (unsigned char)t.begin[i]) * 1099511628211ull;
+		return h;
+	}
+};
+
 struct Parser {
+	enum class Keyword : unsigned {
+		None, Primary, Key, Create, Table, Index, Integer, Numeric, Char, Varchar, Timestamp, Not, Null, On, Tree, Unique, Chunked, Compressed, Synchronized, Partition, By
+	};
 	string fileName;
-	ifstream in;
 	enum class State : unsigned { 
 		Init, 
 		Semicolon,
 		Create, 
 			//TABLE
 			Table, CreateTableBegin, CreateTableEnd, TableName, 
+			Partition, PartitionBy, PartitionListBegin, PartitionName,
 			Primary, Key, KeyListBegin, KeyName, KeyListEnd, PrimaryTree,
 			AttributeName, 
 				AttributeTypeInt, 
@@ -41,10 +63,18 @@ struct Parser {
 	};
 	State state;
 	Schema::Relation* rel;
+	size_t rel_id;
 	string index_name;
-	Parser(const string& fileName) : fileName(fileName), state(State::Init), rel(nullptr) {}
+	bool debug;
+	unordered_map<Token,size_t,Token_Hash> relation_ids;
+	vector<unordered_map<Token,unsigned,Token_Hash>> attribute_ids;// by relation
+	Parser(const string& fileName) : fileName(fileName), state(State::Init), rel(nullptr), rel_id(0), debug(false) {}
 	~Parser() {};
 	unique_ptr<Schema> parse();
 private:
-	void nextToken(unsigned line, const string& token, Schema& s);
+	void nextToken(unsigned line, const Token& token, Schema& s);
+	unsigned attributeId(unsigned line, const Token& token);
+	void compressAttribute(unsigned line);
+	void partitionAttribute(unsigned line, const Token& token);
+	void checkPartitioned(unsigned line, const Schema::Relation::Index& ind);
 };
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <exception>
+#include <algorithm>
+#include <unordered_map>
+
+/**
+ * Runtime support for tables declared 'partition by (<attribute>)': one
+ * partition per value of the attribute, each a table of its own with its
+ * own columns and indices. A tid holds the position of its partition in the
+ * high bits and the row within the partition in the low bits, so inserting
+ * into one partition never renumbers the rows of another. Through Column
+ * and Index the generated table reads rows by tid and looks up keys, which
+ * contain the partitioning attribute, in their partition only; generated
+ * scans walk the partitions themselves and can skip whole partitions.
+ */
+namespace partition {
+	const unsigned row_bits = 32;
+
+	inline size_t of(uint64_t tid) {return tid >> row_bits;}
+	inline uint64_t row(uint64_t tid) {return tid & ((uint64_t(1) << row_bits) - 1);}
+	inline uint64_t base(size_t p) {return uint64_t(p) << row_bits;}
+
+	// the partitions by position, which is the order of creation, and by key
+	template <class Partition, class Key, class Hash>
+	struct Directory {
+		using partition_type = Partition;
+		std::vector<std::unique_ptr<Partition>> parts;
+		std::vector<Key> keys;// by position
+		std::unordered_map<Key,size_t,Hash> ids;
+
+		size_t size() const {return parts.size();}
+		Partition& operator[](size_t p) const {return *parts[p];}
+
+		// nullptr if there is no partition for key
+		Partition* find(const Key& key) const {
+			auto it = ids.find(key);
+			return it == ids.end() ? nullptr : parts[it->second].get();
+		}
+
+		// the partition for key; a new one is constructed from its base and args
+		template <class... Args>
+		Partition& get(const Key& key, Args&&... args) {
+			auto it = ids.find(key);
+			if (it != ids.end()) return *parts[it->second];
+			ids.emplace(key, parts.size());
+			keys.push_back(key);
+			parts.emplace_back(new Partition(base(parts.size()), std::forward<Args>(args)...));
+			return *parts.back();
+		}
+	};
+
+	// member column of every partition, by tid
+	template <class Directory, class Col, Col Directory::partition_type::*member>
+	struct Column {
+		Directory& partitions;
+
+		auto operator[](uint64_t tid) const -> decltype(std::declval<Col&>()[0]) {
+			return (partitions[of(tid)].*member)[row(tid)];
+		}
+
+		template <class T>
+		void set(uint64_t tid, const T& value) const {
+			(partitions[of(tid)].*member).set(row(tid), value);
+		}
+	};
+
+	// member index of every partition; the partitioning attribute is at pos in the key
+	template <class Directory, class Idx, Idx Directory::partition_type::*member, size_t pos>
+	struct Index {
+		Directory& partitions;
+
+		// the tid of a row with key, of any one for a non-unique index; false if there is none
+		bool find(const typename Idx::key_type& key, uint64_t& tid) const {
+			auto p = partitions.find(std::get<pos>(key));
+			if (p == nullptr) return false;
+			const Idx& index = p->*member;
+			auto it = index.find(key);
+			if (it == index.end()) return false;
+			tid = p->base + it->second;
+			return true;
+		}
+	};
+
+	// fn(p) for every p in [0, n) on all hardware threads, one partition at a
+	// time each; the first exception is rethrown once all threads are done
+	template <class Fn>
+	void parallel_for(size_t n, Fn fn) {
+		size_t threads = std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+		if (threads < 2) {
+			for (size_t p = 0; p < n; ++p) fn(p);
+			return;
+		}
+		std::atomic<size_t> next(0);
+		std::vector<std::exception_ptr> errors(threads);
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t]() {
+				try {
+					for (size_t p = next++; p < n; p = next++) fn(p);
+				} catch (...) {
+					errors[t] = std::current_exception();
+					next = n;
+				}
+			});
+		}
+		for (auto& w : workers) w.join();
+		for (auto& error : errors) if (error) std::rethrow_exception(error);
+	}
+}
@@ -2,6 +2,7 @@
 
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -38,10 +39,12 @@ string Schema::toString() const {
 	stringstream out;
 	string delim;
 	for (const Schema::Relation& rel : relations) {
-		out << rel.name << endl;
+		out << rel.name << (rel.chunked ? " (chunked)" : "") << (rel.synchronized ? " (synchronized)" : "");
+		if (rel.partitioned) out << " (partitioned by " << rel.attributes[rel.partitionAttribute].name << ")";
+		out << endl;
 		// fields
 		for (const auto& attr : rel.attributes) {
-			out << '\t' << attr.name << ' ' << type(attr) << ' ' << (attr.notNull ? "not null" : "") << endl;
+			out << '\t' << attr.name << ' ' << type(attr) << ' ' << (attr.notNull ? "not null" : "") << (attr.compressed ? " compressed" : "") << endl;
 		}
 		// indices
 		for (const auto& ind : rel.indices) {
@@ -57,14 +60,50 @@ string Schema::toString() const {
 	return out.str();
 }
 
+Schema::Relation Schema::Relation::partitionRelation() const {
+	Relation res(*this);
+	res.name = name + "_partition";
+	res.partitioned = false;
+	res.partition = true;
+	return res;
+}
+
+string Schema::Relation::columnType(const Attribute& attr) const {
+	string type_attr = type(attr);
+	if (attr.compressed && (attr.type == Types::Tag::Char || attr.type == Types::Tag::Varchar)) {
+		return "String_Vector<" + type_attr + ">";
+	} else if (attr.compressed) {
+		return "Packed_Vector<" + type_attr + "," + (attr.type == Types::Tag::Integer ? "int32_t" : "int64_t") + ">";
+	} else if (chunked) {
+		return "Chunked_Vector<" + type_attr + ">";
+	} else {
+		return "vector<" + type_attr + ",Column_Allocator<" + type_attr + ">>";
+	}
+}
+
+string Schema::Relation::indexType(const Index& ind) const {
+	string type_index = "type_" + ind.name;
+	string allocator = "Column_Allocator<pair<const " + type_index + ",Tid>>";
+	if (synchronized && !ind.tree) {
+		return "Concurrent_Hash_Index<" + type_index + ",Tid,hash_types::hash<" + type_index + ">,equal_to<" + type_index + ">," + (ind.unique ? "true" : "false") + ">";
+	} else if (ind.tree) {
+		return "BTree<" + type_index + ",Tid," + (ind.unique ? "true" : "false") + ">";
+	} else if (ind.unique) {
+		return "unordered_map<" + type_index + ",Tid,hash_types::hash<" + type_index +  ">,equal_to<" + type_index + ">," + allocator + ">";
+	} else {
+		return "unordered_multimap<" + type_index + ",Tid,hash_types::hash<" + type_index +  ">,equal_to<" + type_index + ">," + allocator + ">";
+	}
+}
+
 string Schema::Relation::hppTableDeclaration() const {
 	stringstream out;
 	string delim;
 	if (attributes.size() == 0) return out.str();
+	if (partitioned) return partitionRelation().hppTableDeclaration() + "\n" + hppPartitionedDeclaration();
 	
 	out << "struct Table_" << name << " {" << endl;
 	for (const auto& attr : attributes) {
-		out << "\tvector<" << type(attr) << "> " <<  attr.name << ";" << (attr.primaryFlag? " //primary": "") << endl;
+		out << "\t" << columnType(attr) << " " <<  attr.name << ";" << (attr.primaryFlag? " //primary": "") << endl;
 	}
 	out << endl;
 	// print indices
@@ -88,39 +127,168 @@ string Schema::Relation::hppTableDeclaration() const {
 		}
 		out << ">;" << endl;
 		//declare index
-		if (ind.unique) {
-			if (ind.tree) {
-				out << "\tmap<" << type_index << ",Tid> " << ind.name << ";" << endl;
-			} else {
-				out << "\tunordered_map<" << type_index << ",Tid,hash_types::hash<" << type_index <<  ">> " << ind.name << ";" << endl;
-			}
-		} else {
-			if (ind.tree) {
-				out << "\tmultimap<" << type_index << ",Tid> " << ind.name << ";" << endl;
-			} else {
-				out << "\tunordered_multimap<" << type_index << ",Tid,hash_types::hash<" << type_index <<  ">> " << ind.name << ";" << endl;
-			}
-		}
+		out << "\t" << indexType(ind) << " " << ind.name << ";" << endl;
 	}
 	out << endl;
-	//size()
+	if (partition) {
+		// rows are numbered from base; hooks and version are those of the partitioned table
+		out << "\tTid base;" << endl;
+		out << "\tvector<function<void(Tid,long)>>& on_change;" << endl;
+		out << "\tuint64_t& version;" << endl;
+		out << "\tTable_" << name << "(Tid base, vector<function<void(Tid,long)>>& on_change, uint64_t& version) : base(base), on_change(on_change), version(version) {}" << endl;
+	} else {
+		// change hooks: called with +1 after a row is inserted and with -1 before it is removed
+		out << "\tvector<function<void(Tid,long)>> on_change;" << endl;
+		// bumped by every insert() and remove()
+		out << "\t" << (synchronized ? "atomic<uint64_t> version{0};" : "uint64_t version = 0;") << endl;
+	}
+	if (synchronized) {
+		// exclusive while rows are appended or moved and their keys change; generated
+		// plans hold it shared while they read, procedures exclusively if they write
+		out << "\tShared_Latch latch;" << endl;
+	}
+	// rows removed by remove_batch(), skipped by scans until compact()
+	out << "\tTombstones tombstones;" << endl;
+	// names the table in the write-ahead log
+	out << "\tstatic const uint16_t wal_id = " << id << ";" << endl;
+	out << endl;
+	//size(): rows including tombstones
 	out << "\tsize_t size() {return " << attributes[0].name << ".size();}" << endl;
-	//read_from_file()
-	out << "\tvoid read_from_file(ifstream& in);" << endl;
-	//insert()
-	out << "\tTid insert(";
-	delim = "";
-	for (auto& attr : attributes) {
-		out << delim << type(attr) << " in_" << attr.name; 
-		delim = ",";
+	//read_from_file(): without maintain_indices rows are appended and the indices built afterwards
+	if (!partition) out << "\tvoid read_from_file(ifstream& in, bool maintain_indices = true);" << endl;
+	//insert() and append(), which leaves the indices alone
+	for (const char* method : {"insert", "append"}) {
+		out << "\tTid " << method << "(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << type(attr) << " in_" << attr.name; 
+			delim = ",";
+		}
+		out << ");" << endl;
+	}
+	//build_indices() and build_index_<name>(): rebuild indices from the columns of a table without tombstones
+	out << "\tvoid build_indices();" << endl;
+	for (const auto& ind : indices) {
+		out << "\tvoid build_index_" << ind.name << "();" << endl;
+		//build_index_<name>_latched(): for callers holding latch exclusively
+		if (synchronized) out << "\tvoid build_index_" << ind.name << "_latched();" << endl;
 	}
-	out << ");" << endl;
 	
 	out << "\tvoid remove(Tid tid);" << endl;
+	if (synchronized) {
+		//insert_latched() and remove_latched(): insert() and remove() for callers holding latch exclusively
+		out << "\tTid insert_latched(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << type(attr) << " in_" << attr.name; 
+			delim = ",";
+		}
+		out << ");" << endl;
+		out << "\tvoid remove_latched(Tid tid);" << endl;
+	}
+	//remove_batch(): the rows leave the indices at once and their columns at the next compact()
+	out << "\tvoid remove_batch(const Tid* tids, size_t n);" << endl;
+	out << "\tvoid compact();" << endl;
+	if (partition) {
+		//write_checkpoint() and read_checkpoint(): sections named <prefix>.<name>
+		out << "\tvoid write_checkpoint(checkpoint::Writer& out, const string& prefix) const;" << endl;
+		out << "\tvoid read_checkpoint(const checkpoint::Image& in, const string& prefix);" << endl;
+		out << "};" << endl;
+		return out.str();
+	}
+	//redo(): applies a record of the write-ahead log
+	out << "\tvoid redo(wal::Kind kind, const char* data);" << endl;
+	//write_checkpoint() and read_checkpoint(): columns and indices as checkpoint sections
+	out << "\tvoid write_checkpoint(checkpoint::Writer& out) const;" << endl;
+	out << "\tvoid read_checkpoint(const checkpoint::Image& in);" << endl;
 	out << "};" << endl;
 	return out.str();
 }
 
+// Table_<name> over its partitions: columns and indices address the rows of
+// all partitions by tid, rows are inserted into the partition of their key
+string Schema::Relation::hppPartitionedDeclaration() const {
+	stringstream out;
+	string delim;
+	const auto& key_attr = attributes[partitionAttribute];
+	
+	out << "struct Table_" << name << " {" << endl;
+	out << "\tusing Partition = Table_" << name << "_partition;" << endl;
+	out << "\tusing Partitions = partition::Directory<Partition," << type(key_attr) << ",hash_types::hash<" << type(key_attr) << ">>;" << endl;
+	out << "\t// by " << key_attr.name << endl;
+	out << "\tPartitions partitions;" << endl;
+	for (const auto& attr : attributes) {
+		out << "\tpartition::Column<Partitions," << columnType(attr) << ",&Partition::" << attr.name << "> " << attr.name << "{partitions};" << (attr.primaryFlag? " //primary": "") << endl;
+	}
+	out << endl;
+	for (const auto& ind : indices) {
+		size_t pos = find(ind.fields.begin(), ind.fields.end(), partitionAttribute) - ind.fields.begin();
+		out << "\tusing type_" << ind.name << " = Partition::type_" << ind.name << ";" << endl;
+		out << "\tpartition::Index<Partitions," << indexType(ind) << ",&Partition::" << ind.name << "," << pos << "> " << ind.name << "{partitions};" << endl;
+	}
+	out << endl;
+	// change hooks: called with +1 after a row is inserted and with -1 before it is removed
+	out << "\tvector<function<void(Tid,long)>> on_change;" << endl;
+	// bumped by every insert() and remove()
+	out << "\tuint64_t version = 0;" << endl;
+	// names the table in the write-ahead log
+	out << "\tstatic const uint16_t wal_id = " << id << ";" << endl;
+	out << endl;
+	// columns and indices refer to partitions
+	out << "\tTable_" << name << "() {}" << endl;
+	out << "\tTable_" << name << "(const Table_" << name << "&) = delete;" << endl;
+	out << "\tTable_" << name << "& operator=(const Table_" << name << "&) = delete;" << endl;
+	//size(): rows of all partitions; tids are not dense
+	out << "\tsize_t size() {size_t res = 0; for (size_t p = 0; p < partitions.size(); ++p) res += partitions[p].size(); return res;}" << endl;
+	//partition(): the partition of key, created if there is none
+	out << "\tPartition& partition(" << type(key_attr) << " key) {return partitions.get(key, on_change, version);}" << endl;
+	out << "\tvoid read_from_file(ifstream& in, bool maintain_indices = true);" << endl;
+	for (const char* method : {"insert", "append"}) {
+		out << "\tTid " << method << "(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << type(attr) << " in_" << attr.name; 
+			delim = ",";
+		}
+		out << ");" << endl;
+	}
+	out << "\tvoid build_indices();" << endl;
+	for (const auto& ind : indices) {
+		out << "\tvoid build_index_" << ind.name << "();" << endl;
+	}
+	out << "\tvoid remove(Tid tid);" << endl;
+	if (synchronized) {
+		//insert_latched() and remove_latched(): insert() and remove() for callers holding latch exclusively
+		out << "\tTid insert_latched(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << type(attr) << " in_" << attr.name; 
+			delim = ",";
+		}
+		out << ");" << endl;
+		out << "\tvoid remove_latched(Tid tid);" << endl;
+	}
+	out << "\tvoid remove_batch(const Tid* tids, size_t n);" << endl;
+	out << "\tvoid compact();" << endl;
+	out << "\tvoid redo(wal::Kind kind, const char* data);" << endl;
+	out << "\tvoid write_checkpoint(checkpoint::Writer& out) const;" << endl;
+	out << "\tvoid read_checkpoint(const checkpoint::Image& in);" << endl;
+	out << "};" << endl;
+	return out.str();
+}
+
+string Schema::Relation::keyTuple(const Index& ind, const string& tmplt) const {
+	stringstream out;
+	string delim;
+	out << "type_" << ind.name << "(";
+	for (unsigned keyId : ind.fields) {
+		out << delim << ReplaceString(tmplt, "&name;", attributes[keyId].name);
+		delim = ",";
+	}
+	out << ")";
+	return out.str();
+}
+
 string Schema::Relation::cppTableImplementation() const {
 	stringstream out;
 	string delim;
@@ -128,10 +296,33 @@ string Schema::Relation::cppTableImplementation() const {
 	string tmplt;
 	
 	if (attributes.size() == 0) return out.str();
-	// insert method
+	if (partitioned) return partitionRelation().cppTableImplementation() + cppPartitionedImplementation();
+	// the tid hooks and the log see: partitions number their rows from base
+	string hook_tid = partition ? "base+" : "";
+	// insert method, insert_latched() of synchronized tables
 	{
+		string args;
+		delim = "";
+		for (auto& attr : attributes) {
+			args += delim + "in_" + attr.name;
+			delim = ",";
+		}
+		if (synchronized) {
+			out << indent << "Tid Table_" << name << "::" << "insert(";
+			delim = "";
+			for (auto& attr : attributes) {
+				out << delim << type(attr) << " in_" << attr.name; 
+				delim = ",";
+			}
+			out << ")" << endl;
+			out << indent << "{" << endl;
+			out << indent << "\tlock_guard<Shared_Latch> guard(latch);" << endl;
+			out << indent << "\treturn insert_latched(" << args << ");" << endl;
+			out << indent << "}" << endl;
+			out << endl;
+		}
 		// signature begin
-		out << indent << "Tid Table_" << name << "::" << "insert(";
+		out << indent << "Tid Table_" << name << "::" << (synchronized ? "insert_latched(" : "insert(");
 		delim = "";
 		for (auto& attr : attributes) {
 			out << delim << type(attr) << " in_" << attr.name; 
@@ -141,73 +332,165 @@ string Schema::Relation::cppTableImplementation() const {
 		// signature end
 		out << indent << "{" << endl;
 		indent.push_back('\t');
-		out << indent << "Tid new_tid = size();" << endl;
-		// indices check
-		for (auto& ind : indices) {
-			if (ind.unique) {
-				out << indent << "check_key(" << ind.name;
+		if (synchronized) {
+			// the row is appended and all its keys inserted under the exclusive latch,
+			// so no reader sees it in the columns but missing from an index
+			out << indent << "Tid new_tid = size();" << endl;
+			for (auto& ind : indices) {
+				if (ind.unique) {
+					out << indent << "if (" << ind.name << ".count(" << keyTuple(ind, "in_&name;") << ") != 0) throw runtime_error(\"duplicate key\");" << endl;
+				}
+			}
+		} else {
+			out << indent << "Tid new_tid = size();" << endl;
+			// indices check
+			for (auto& ind : indices) {
+				if (ind.unique) {
+					out << indent << "check_key(" << ind.name;
+					for (unsigned keyId : ind.fields) {
+						out << ", in_" << attributes[keyId].name;
+					}
+					out << ");" << endl;
+				}
+			}
+			// indices insert
+			for (auto& ind : indices) {
+				out << indent << "insert_key<false>(" << ind.name << ", new_tid";
 				for (unsigned keyId : ind.fields) {
 					out << ", in_" << attributes[keyId].name;
 				}
 				out << ");" << endl;
 			}
 		}
-		// indices insert
-		for (auto& ind : indices) {
-			out << indent << "insert_key<false>(" << ind.name << ", new_tid";
-			for (unsigned keyId : ind.fields) {
-				out << ", in_" << attributes[keyId].name;
-			}
-			out << ");" << endl;
-		}
 		// push back fields
 		tmplt = "&name;.push_back(in_&name;);";
 		for (auto& attr : attributes) {
 			out << indent << ReplaceString(tmplt, "&name;", attr.name) << endl;
 		}
+		if (synchronized) {
+			for (auto& ind : indices) {
+				if (ind.tree) {
+					out << indent << "insert_key<false>(" << ind.name << ", new_tid";
+					for (unsigned keyId : ind.fields) {
+						out << ", in_" << attributes[keyId].name;
+					}
+					out << ");" << endl;
+				} else {
+					out << indent << ind.name << ".insert(" << keyTuple(ind, "in_&name;") << ", new_tid);" << endl;
+				}
+			}
+		}
+		// logged once the row is in, so rejected rows are not; with the tid it got,
+		// which redo() checks
+		out << indent << "if (wal::log().enabled()) wal::log().insert(wal_id, " << hook_tid << "new_tid";
+		for (auto& attr : attributes) {
+			out << ", in_" << attr.name;
+		}
+		out << ");" << endl;
+		out << indent << "++version;" << endl;
+		out << indent << "for (auto& hook : on_change) hook(" << hook_tid << "new_tid, 1);" << endl;
 		//return
 		out << indent << "return new_tid;" << endl;
 		indent.pop_back();
 		out << indent << "}" << endl;
 	}
 	out << endl;
-	// remove method
+	// append method: insert without index maintenance, for bulk loads followed by build_indices()
 	{
+		out << indent << "Tid Table_" << name << "::" << "append(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << type(attr) << " in_" << attr.name; 
+			delim = ",";
+		}
+		out << ")" << endl;
+		out << indent << "{" << endl;
+		indent.push_back('\t');
+		if (synchronized) out << indent << "lock_guard<Shared_Latch> guard(latch);" << endl;
+		out << indent << "Tid new_tid = size();" << endl;
+		tmplt = "&name;.push_back(in_&name;);";
+		for (auto& attr : attributes) {
+			out << indent << ReplaceString(tmplt, "&name;", attr.name) << endl;
+		}
+		out << indent << "++version;" << endl;
+		out << indent << "for (auto& hook : on_change) hook(" << hook_tid << "new_tid, 1);" << endl;
+		out << indent << "return new_tid;" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+	}
+	out << endl;
+	// build_index_<name> methods, build_index_<name>_latched() of synchronized tables
+	string latched = synchronized ? "_latched" : "";
+	for (const auto& ind : indices) {
+		if (synchronized) {
+			out << indent << "void Table_" << name << "::build_index_" << ind.name << "()" << endl;
+			out << indent << "{" << endl;
+			out << indent << "\tlock_guard<Shared_Latch> guard(latch);" << endl;
+			out << indent << "\tbuild_index_" << ind.name << "_latched();" << endl;
+			out << indent << "}" << endl;
+			out << endl;
+		}
+		out << indent << "void Table_" << name << "::build_index_" << ind.name << latched << "()" << endl;
+		out << indent << "{" << endl;
+		indent.push_back('\t');
+		out << indent << "assert(!tombstones.any());" << endl;
+		out << indent << "build_index(" << ind.name << ", size(), [this](size_t tid) {return " << keyTuple(ind, "&name;[tid]") << ";}, " << (ind.unique ? "true" : "false") << ", \"" << ind.name << "\");" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+		out << endl;
+	}
+	// build_indices method: one thread per index, errors rethrown after all are done;
+	// the latch of a synchronized table is taken once for all of them
+	{
+		out << indent << "void Table_" << name << "::build_indices()" << endl;
+		out << indent << "{" << endl;
+		indent.push_back('\t');
+		if (!indices.empty()) {
+			if (synchronized) out << indent << "lock_guard<Shared_Latch> guard(latch);" << endl;
+			out << indent << "vector<exception_ptr> errors(" << indices.size() << ");" << endl;
+			out << indent << "vector<thread> builders;" << endl;
+			for (size_t i = 0; i < indices.size(); ++i) {
+				out << indent << "builders.emplace_back([this,&errors]() {try {build_index_" << indices[i].name << latched << "();} catch (...) {errors[" << i << "] = current_exception();}});" << endl;
+			}
+			out << indent << "for (auto& builder : builders) builder.join();" << endl;
+			out << indent << "for (auto& error : errors) if (error) rethrow_exception(error);" << endl;
+		}
+		indent.pop_back();
+		out << indent << "}" << endl;
+	}
+	out << endl;
+	// remove method, remove_latched() of synchronized tables
+	{
+		if (synchronized) {
+			out << indent << "void Table_" << name << "::" << "remove(Tid tid)" << endl;
+			out << indent << "{" << endl;
+			out << indent << "\tlock_guard<Shared_Latch> guard(latch);" << endl;
+			out << indent << "\tremove_latched(tid);" << endl;
+			out << indent << "}" << endl;
+			out << endl;
+		}
 		// signature begin
-		out << indent << "void Table_" << name << "::" << "remove(Tid tid)" << endl;
+		out << indent << "void Table_" << name << "::" << (synchronized ? "remove_latched(Tid tid)" : "remove(Tid tid)") << endl;
 		// signature end
 		out << indent << "{" << endl;
 		indent.push_back('\t');
 		out << indent << "Tid last_tid = size() - 1;" << endl;
 		out << indent << "assert(tid <= last_tid);" << endl;
-		// remove tid from indices
-		for (const auto& ind : indices) {
-			out << indent << "remove_key(" << ind.name << ",tid";
-			for (unsigned keyId : ind.fields) {
-				out << "," << attributes[keyId].name << "[tid]";
-			}
-			out << ");" << endl;
-		}
+		// the last row may be a tombstone: the row becomes one as well until compact()
+		out << indent << "if (tombstones.any()) {" << endl;
+		indent.push_back('\t');
+		out << indent << "if (wal::log().enabled()) wal::log().tombstone(wal_id, " << hook_tid << "tid);" << endl;
+		out << cppEraseKeys(indent);
+		out << indent << "tombstones.set(tid);" << endl;
+		out << indent << "return;" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+		out << indent << "if (wal::log().enabled()) wal::log().remove(wal_id, " << hook_tid << "tid);" << endl;
+		out << cppEraseKeys(indent);
 		//swap with the last element
-		{
-			out << indent << "if (tid != last_tid) {" << endl;
-			indent.push_back('\t');
-			// update indices for last_tid
-			for (const auto& ind : indices) {
-				out << indent << "replace_key(" << ind.name << ",last_tid,tid";
-				for (unsigned keyId : ind.fields) {
-					out << "," << attributes[keyId].name << "[last_tid]";
-				}
-				out << ");" << endl;
-			}
-			// move fields
-			tmplt = "&name;[tid] = &name;[last_tid];";
-			for (const auto& attr : attributes) {
-				out << indent << ReplaceString(tmplt, "&name;", attr.name) << endl;
-			}
-			indent.pop_back();
-			out << indent << "}" << endl;
-		}
+		out << indent << "if (tid != last_tid) {" << endl;
+		out << cppMoveRow(indent + "\t");
+		out << indent << "}" << endl;
 		// pop back fields
 		for (const auto& attr : attributes) {
 			out << indent << attr.name << ".pop_back();" << endl;
@@ -217,71 +500,379 @@ string Schema::Relation::cppTableImplementation() const {
 		out << indent << "}" << endl;
 	}
 	out << endl;
-	// read_from_file method
+	// remove_batch method: rows are taken out of the indices and left as tombstones
 	{
-		// signature begin
-		out << indent << "void Table_" << name << "::" << "read_from_file(ifstream& in)" << endl;
-		// signature end
+		out << indent << "void Table_" << name << "::" << "remove_batch(const Tid* tids, size_t n)" << endl;
 		out << indent << "{" << endl;
 		indent.push_back('\t');
-		out << indent << "assert(in.is_open());" << endl;
-		// buffers
-		{
-			out << indent << "string buf_field; buf_field.reserve(500);" << endl;			
-			for (const auto& attr : attributes) {
-				out << indent << type(attr) << " in_" << attr.name << ";" << endl;
-			}
+		if (synchronized) out << indent << "lock_guard<Shared_Latch> guard(latch);" << endl;
+		out << indent << "for (size_t i = 0; i < n; ++i) {" << endl;
+		indent.push_back('\t');
+		out << indent << "Tid tid = tids[i];" << endl;
+		out << indent << "assert(tid < size() && !tombstones.test(tid));" << endl;
+		out << indent << "if (wal::log().enabled()) wal::log().tombstone(wal_id, " << hook_tid << "tid);" << endl;
+		out << cppEraseKeys(indent);
+		out << indent << "tombstones.set(tid);" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+	}
+	out << endl;
+	// compact method: the last live rows fill the holes, one index update per moved row
+	{
+		out << indent << "void Table_" << name << "::" << "compact()" << endl;
+		out << indent << "{" << endl;
+		indent.push_back('\t');
+		if (synchronized) out << indent << "lock_guard<Shared_Latch> guard(latch);" << endl;
+		out << indent << "if (!tombstones.any()) return;" << endl;
+		out << indent << "if (wal::log().enabled()) wal::log().compact(wal_id, " << (partition ? "base" : "0") << ");" << endl;
+		out << indent << "++version;" << endl;
+		out << indent << "Tid end = size();" << endl;
+		out << indent << "for (Tid tid = tombstones.next(0); tid < end; tid = tombstones.next(tid + 1)) {" << endl;
+		indent.push_back('\t');
+		out << indent << "Tid last_tid = end - 1;" << endl;
+		out << indent << "while (last_tid > tid && tombstones.test(last_tid)) --last_tid;" << endl;
+		out << indent << "end = last_tid;" << endl;
+		out << indent << "if (last_tid == tid) break;" << endl;
+		out << cppMoveRow(indent);
+		indent.pop_back();
+		out << indent << "}" << endl;
+		out << indent << "for (Tid n = size(); n > end; --n) {" << endl;
+		for (const auto& attr : attributes) {
+			out << indent << "\t" << attr.name << ".pop_back();" << endl;
 		}
-		//reading loop
-		{
-			out << indent << "char first_symbol = 0;" << endl;
-			out << indent << "while (!in.eof()) {" << endl;
-			indent.push_back('\t');
-			out << indent << "first_symbol = in.get();" << endl;
-			out << indent << "if (first_symbol == ROW_DLM || first_symbol == EOF) continue;" << endl;
-			out << indent << "in.unget();" << endl;
-			out << indent << "assert(!in.fail());" << endl;
-			out << endl;
-			// read row from file
-			tmplt = "getline(in, buf_field, &delim;); in_&name; = &type;::castString(buf_field.data(), buf_field.length());";
-			string buf;
-			for (size_t i = 0; i < attributes.size(); ++i) {
-				const auto& attr = attributes[i];
-				buf = ReplaceString(tmplt, "&name;", attr.name);
-				ReplaceStringInPlace(buf, "&type;", type(attr));
-				ReplaceStringInPlace(buf, "&delim;", (i == attributes.size()-1? "ROW_DLM": "FLD_DLM"));
-				out << indent << buf << endl;
-			}
-			out << endl;
-			// make insertion
-			out << indent << "insert(";
-			delim = "";
-			for (auto& attr : attributes) {
-				out << delim << "in_" << attr.name;
-				delim = ",";
-			}
-			out << ");" << endl;
-			indent.pop_back();
-			out << indent << "}" << endl;
+		out << indent << "}" << endl;
+		out << indent << "tombstones.clear();" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+	}
+	out << endl;
+	if (!partition) out << cppRedo() << endl;
+	// checkpoint methods: one section per column and index, named <table>.<name>,
+	// for partitions <prefix>.<name>
+	{
+		string section = partition ? "prefix + \"." : "\"" + name + ".";
+		out << indent << "void Table_" << name << "::write_checkpoint(checkpoint::Writer& out" << (partition ? ", const string& prefix" : "") << ") const" << endl;
+		out << indent << "{" << endl;
+		indent.push_back('\t');
+		for (const auto& attr : attributes) {
+			out << indent << "checkpoint::save(out, " << section << attr.name << "\", " << attr.name << ");" << endl;
+		}
+		for (const auto& ind : indices) {
+			out << indent << "checkpoint::save_index(out, " << section << ind.name << "\", " << ind.name << ");" << endl;
 		}
+		out << indent << "checkpoint::save(out, " << section << "tombstones\", tombstones);" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+		out << endl;
+		out << indent << "void Table_" << name << "::read_checkpoint(const checkpoint::Image& in" << (partition ? ", const string& prefix" : "") << ")" << endl;
+		out << indent << "{" << endl;
+		indent.push_back('\t');
+		if (synchronized) out << indent << "lock_guard<Shared_Latch> guard(latch);" << endl;
+		out << indent << "assert(size() == 0);" << endl;
+		for (const auto& attr : attributes) {
+			out << indent << "checkpoint::load(in, " << section << attr.name << "\", " << attr.name << ");" << endl;
+		}
+		for (const auto& ind : indices) {
+			out << indent << "checkpoint::load_index(in, " << section << ind.name << "\", " << ind.name << ");" << endl;
+		}
+		out << indent << "checkpoint::load(in, " << section << "tombstones\", tombstones);" << endl;
+		out << indent << "++version;" << endl;
+		out << indent << "for (auto& hook : on_change) for (Tid tid = 0; tid < size(); ++tid) if (!tombstones.test(tid)) hook(" << hook_tid << "tid, 1);" << endl;
 		indent.pop_back();
 		out << indent << "}" << endl;
 	}
 	out << endl;
+	if (!partition) out << cppReadFromFile() << endl;
 	
 	return out.str();
 }
 
+// Table_<name> over its partitions: the partition of a row is chosen by its
+// value of partitionAttribute, tids are the partition's base plus its own
+string Schema::Relation::cppPartitionedImplementation() const {
+	stringstream out;
+	string delim;
+	string args;
+	const auto& key_attr = attributes[partitionAttribute];
+	for (auto& attr : attributes) {
+		args += delim + "in_" + attr.name;
+		delim = ",";
+	}
+	// insert and append methods
+	for (const char* method : {"insert", "append"}) {
+		out << "Tid Table_" << name << "::" << method << "(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << type(attr) << " in_" << attr.name; 
+			delim = ",";
+		}
+		out << ")" << endl;
+		out << "{" << endl;
+		out << "\tPartition& p = partition(in_" << key_attr.name << ");" << endl;
+		out << "\treturn p.base + p." << method << "(" << args << ");" << endl;
+		out << "}" << endl;
+		out << endl;
+	}
+	// build_index_<name> and build_indices methods, partition by partition
+	for (const auto& ind : indices) {
+		out << "void Table_" << name << "::build_index_" << ind.name << "()" << endl;
+		out << "{" << endl;
+		out << "\tfor (size_t p = 0; p < partitions.size(); ++p) partitions[p].build_index_" << ind.name << "();" << endl;
+		out << "}" << endl;
+		out << endl;
+	}
+	out << "void Table_" << name << "::build_indices()" << endl;
+	out << "{" << endl;
+	out << "\tfor (size_t p = 0; p < partitions.size(); ++p) partitions[p].build_indices();" << endl;
+	out << "}" << endl;
+	out << endl;
+	// remove method
+	out << "void Table_" << name << "::remove(Tid tid)" << endl;
+	out << "{" << endl;
+	out << "\tassert(partition::of(tid) < partitions.size());" << endl;
+	out << "\tpartitions[partition::of(tid)].remove(partition::row(tid));" << endl;
+	out << "}" << endl;
+	out << endl;
+	// remove_batch and compact methods: the rows of each partition in one batch
+	out << "void Table_" << name << "::remove_batch(const Tid* tids, size_t n)" << endl;
+	out << "{" << endl;
+	out << "\tvector<vector<Tid>> rows(partitions.size());" << endl;
+	out << "\tfor (size_t i = 0; i < n; ++i) {" << endl;
+	out << "\t\tassert(partition::of(tids[i]) < partitions.size());" << endl;
+	out << "\t\trows[partition::of(tids[i])].push_back(partition::row(tids[i]));" << endl;
+	out << "\t}" << endl;
+	out << "\tfor (size_t p = 0; p < rows.size(); ++p) if (!rows[p].empty()) partitions[p].remove_batch(rows[p].data(), rows[p].size());" << endl;
+	out << "}" << endl;
+	out << endl;
+	out << "void Table_" << name << "::compact()" << endl;
+	out << "{" << endl;
+	out << "\tfor (size_t p = 0; p < partitions.size(); ++p) partitions[p].compact();" << endl;
+	out << "}" << endl;
+	out << endl;
+	out << cppRedo() << endl;
+	// checkpoint methods: the partition keys in order of creation, then each
+	// partition with its position as prefix, so that bases are kept
+	out << "void Table_" << name << "::write_checkpoint(checkpoint::Writer& out) const" << endl;
+	out << "{" << endl;
+	out << "\tcheckpoint::save(out, \"" << name << ".partitions\", partitions.keys);" << endl;
+	out << "\tfor (size_t p = 0; p < partitions.size(); ++p) partitions[p].write_checkpoint(out, \"" << name << ".\" + to_string(p));" << endl;
+	out << "}" << endl;
+	out << endl;
+	out << "void Table_" << name << "::read_checkpoint(const checkpoint::Image& in)" << endl;
+	out << "{" << endl;
+	out << "\tassert(partitions.size() == 0);" << endl;
+	out << "\tvector<" << type(key_attr) << "> keys;" << endl;
+	out << "\tcheckpoint::load(in, \"" << name << ".partitions\", keys);" << endl;
+	out << "\tfor (size_t p = 0; p < keys.size(); ++p) partition(keys[p]).read_checkpoint(in, \"" << name << ".\" + to_string(p));" << endl;
+	out << "}" << endl;
+	out << endl;
+	out << cppReadFromFile() << endl;
+	return out.str();
+}
+
+// removes row tid from the indices after telling the hooks
+string Schema::Relation::cppEraseKeys(const string& indent) const {
+	stringstream out;
+	string hook_tid = partition ? "base+" : "";
+	out << indent << "++version;" << endl;
+	out << indent << "for (auto& hook : on_change) hook(" << hook_tid << "tid, -1);" << endl;
+	for (const auto& ind : indices) {
+		if (synchronized && !ind.tree) {
+			out << indent << ind.name << ".erase(" << keyTuple(ind, "&name;[tid]") << ",tid);" << endl;
+			continue;
+		}
+		out << indent << "remove_key(" << ind.name << ",tid";
+		for (unsigned keyId : ind.fields) {
+			out << "," << attributes[keyId].name << "[tid]";
+		}
+		out << ");" << endl;
+	}
+	return out.str();
+}
+
+// moves row last_tid to tid, in the indices and the columns
+string Schema::Relation::cppMoveRow(const string& indent) const {
+	stringstream out;
+	for (const auto& ind : indices) {
+		if (synchronized && !ind.tree) {
+			out << indent << ind.name << ".replace(" << keyTuple(ind, "&name;[last_tid]") << ",last_tid,tid);" << endl;
+			continue;
+		}
+		out << indent << "replace_key(" << ind.name << ",last_tid,tid";
+		for (unsigned keyId : ind.fields) {
+			out << "," << attributes[keyId].name << "[last_tid]";
+		}
+		out << ");" << endl;
+	}
+	// move fields; packed columns have no element references
+	for (const auto& attr : attributes) {
+		string tmplt = attr.compressed ? "&name;.set(tid, &name;[last_tid]);" : "&name;[tid] = &name;[last_tid];";
+		out << indent << ReplaceString(tmplt, "&name;", attr.name) << endl;
+	}
+	return out.str();
+}
+
+// redo method: records are decoded in the order wal::Log wrote them
+string Schema::Relation::cppRedo() const {
+	stringstream out;
+	string delim;
+	string indent;
+	string tmplt;
+	out << indent << "void Table_" << name << "::redo(wal::Kind kind, const char* data)" << endl;
+	out << indent << "{" << endl;
+	indent.push_back('\t');
+	out << indent << "wal::Reader in(data);" << endl;
+	out << indent << "switch (kind) {" << endl;
+	out << indent << "case wal::Kind::Insert: {" << endl;
+	indent.push_back('\t');
+	// later records address the row by the tid it got when it was logged
+	out << indent << "Tid tid; in.get(tid);" << endl;
+	for (const auto& attr : attributes) {
+		out << indent << type(attr) << " in_" << attr.name << "; in.get(in_" << attr.name << ");" << endl;
+	}
+	out << indent << "if (insert(";
+	delim = "";
+	for (auto& attr : attributes) {
+		out << delim << "in_" << attr.name;
+		delim = ",";
+	}
+	out << ") != tid) throw runtime_error(\"" << name << ": logged insert replayed at another tid\");" << endl;
+	out << indent << "break;" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	out << indent << "case wal::Kind::Remove: {" << endl;
+	indent.push_back('\t');
+	out << indent << "Tid tid; in.get(tid);" << endl;
+	out << indent << "remove(tid);" << endl;
+	out << indent << "break;" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	out << indent << "case wal::Kind::Update: {" << endl;
+	indent.push_back('\t');
+	out << indent << "Tid tid; in.get(tid);" << endl;
+	out << indent << "uint16_t attr; in.get(attr);" << endl;
+	out << indent << "for (auto& hook : on_change) hook(tid, -1);" << endl;
+	out << indent << "switch (attr) {" << endl;
+	for (size_t i = 0; i < attributes.size(); ++i) {
+		const auto& attr = attributes[i];
+		tmplt = attr.compressed ? "&name;.set(tid, value);" : "&name;[tid] = value;";
+		out << indent << "case " << i << ": {" << type(attr) << " value; in.get(value); " << ReplaceString(tmplt, "&name;", attr.name) << " break;}" << endl;
+	}
+	out << indent << "}" << endl;
+	out << indent << "for (auto& hook : on_change) hook(tid, 1);" << endl;
+	out << indent << "++version;" << endl;
+	out << indent << "break;" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	out << indent << "case wal::Kind::Tombstone: {" << endl;
+	indent.push_back('\t');
+	out << indent << "Tid tid; in.get(tid);" << endl;
+	out << indent << "remove_batch(&tid, 1);" << endl;
+	out << indent << "break;" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	out << indent << "case wal::Kind::Compact: {" << endl;
+	indent.push_back('\t');
+	out << indent << "Tid base; in.get(base);" << endl;
+	out << indent << (partitioned ? "partitions[partition::of(base)].compact();" : "compact();") << endl;
+	out << indent << "break;" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	out << indent << "case wal::Kind::Commit:" << endl;
+	out << indent << "case wal::Kind::Abort:" << endl;
+	out << indent << "\tbreak;" << endl;
+	out << indent << "}" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	return out.str();
+}
+
+// read_from_file method
+string Schema::Relation::cppReadFromFile() const {
+	stringstream out;
+	string delim;
+	string indent;
+	string tmplt;
+	// signature begin
+	out << indent << "void Table_" << name << "::" << "read_from_file(ifstream& in, bool maintain_indices)" << endl;
+	// signature end
+	out << indent << "{" << endl;
+	indent.push_back('\t');
+	out << indent << "assert(in.is_open());" << endl;
+	// buffers
+	{
+		out << indent << "string buf_field; buf_field.reserve(500);" << endl;			
+		for (const auto& attr : attributes) {
+			out << indent << type(attr) << " in_" << attr.name << ";" << endl;
+		}
+	}
+	//reading loop
+	{
+		out << indent << "char first_symbol = 0;" << endl;
+		out << indent << "while (!in.eof()) {" << endl;
+		indent.push_back('\t');
+		out << indent << "first_symbol = in.get();" << endl;
+		out << indent << "if (first_symbol == ROW_DLM || first_symbol == EOF) continue;" << endl;
+		out << indent << "in.unget();" << endl;
+		out << indent << "assert(!in.fail());" << endl;
+		out << endl;
+		// read row from file
+		tmplt = "getline(in, buf_field, &delim;); in_&name; = &type;::castString(buf_field.data(), buf_field.length());";
+		string buf;
+		for (size_t i = 0; i < attributes.size(); ++i) {
+			const auto& attr = attributes[i];
+			buf = ReplaceString(tmplt, "&name;", attr.name);
+			ReplaceStringInPlace(buf, "&type;", type(attr));
+			ReplaceStringInPlace(buf, "&delim;", (i == attributes.size()-1? "ROW_DLM": "FLD_DLM"));
+			out << indent << buf << endl;
+		}
+		out << endl;
+		// make insertion
+		out << indent << "if (maintain_indices) insert(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << "in_" << attr.name;
+			delim = ",";
+		}
+		out << "); else append(";
+		delim = "";
+		for (auto& attr : attributes) {
+			out << delim << "in_" << attr.name;
+			delim = ",";
+		}
+		out << ");" << endl;
+		indent.pop_back();
+		out << indent << "}" << endl;
+	}
+	out << indent << "if (!maintain_indices) build_indices();" << endl;
+	indent.pop_back();
+	out << indent << "}" << endl;
+	return out.str();
+}
+
 string Schema::hppFilePrint() const {
 	stringstream out;
 	
 	out << "#pragma once"             << endl;
 	out << "#include \"Types.hpp\""   << endl;
+	out << "#include \"Allocator.hpp\"" << endl;
+	out << "#include \"Chunked.hpp\"" << endl;
+	out << "#include \"Packed.hpp\""  << endl;
+	out << "#include \"Strings.hpp\"" << endl;
+	out << "#include \"Tombstones.hpp\"" << endl;
+	out << "#include \"BTree.hpp\"" << endl;
+	out << "#include \"Concurrent.hpp\"" << endl;
+	out << "#include \"Wal.hpp\""    << endl;
+	out << "#include \"Checkpoint.hpp\"" << endl;
+	out << "#include \"Partition.hpp\"" << endl;
 	out << "#include <tuple>"         << endl;
 	out << "#include <vector>"        << endl;
 	out << "#include <unordered_map>" << endl;
 	out << "#include <map>"           << endl;
 	out << "#include <fstream>"       << endl;
+	out << "#include <functional>"    << endl;
 	out                               << endl; 
 	out << "using namespace std;"     << endl;
 	out                               << endl; 
@@ -294,6 +885,13 @@ string Schema::hppFilePrint() const {
 	for (const Schema::Relation& rel : relations) {
 		out << "extern Table_" << rel.name << " " << rel.name << ";" << endl;
 	}
+	out << endl;
+	// checkpoint_tables() snapshots all tables and writes them in the background
+	out << "checkpoint::Handle checkpoint_tables(const string& path);" << endl;
+	// recovery: load_checkpoint() or the tables, replay_log() from its result,
+	// then wal::log().open() with the result of that
+	out << "wal::Position load_checkpoint(const string& path);" << endl;
+	out << "wal::Position replay_log(const string& path, const wal::Position& from = wal::Position());" << endl;
 	
 	return out.str();
 }
@@ -305,7 +903,12 @@ string Schema::cppFilePrint(const string& hpp_file) const {
 	
 	out << "#include \"Types.hpp\""   << endl;
 	out << "#include \"Help.hpp\""    << endl;
+	out << "#include \"IndexBuild.hpp\"" << endl;
 	out << "#include <cassert>"       << endl;
+	out << "#include <thread>"        << endl;
+	out << "#include <exception>"     << endl;
+	out << "#include <stdexcept>"     << endl;
+	out << "#include <mutex>"         << endl;
 	out << "#include <string>"        << endl;
 	out << "#include <utility>"       << endl;
 	out << endl; 
@@ -321,5 +924,57 @@ string Schema::cppFilePrint(const string& hpp_file) const {
 		out << rel.cppTableImplementation() << endl;
 	}
 	
+	// synchronized tables are latched for the fork, all or none like a procedure
+	// does, the others belong to the calling thread
+	out << "checkpoint::Handle checkpoint_tables(const string& path)" << endl;
+	out << "{" << endl;
+	out << "\tcheckpoint::Handle res(path);" << endl;
+	string latches, delim;
+	for (const Schema::Relation& rel : relations) {
+		if (rel.attributes.empty() || !rel.synchronized) continue;
+		latches += delim + "&" + rel.name + ".latch";
+		delim = ",";
+	}
+	out << "\t{" << endl;
+	if (!latches.empty()) out << "\t\tLatch_Guard latches({" << latches << "}, {});" << endl;
+	out << "\t\tres.fork(wal::log().position().next_lsn, [](checkpoint::Writer& out) {" << endl;
+	for (const Schema::Relation& rel : relations) {
+		if (rel.attributes.empty()) continue;
+		out << "\t\t\t" << rel.name << ".write_checkpoint(out);" << endl;
+	}
+	out << "\t\t});" << endl;
+	out << "\t}" << endl;
+	out << "\tres.resume();" << endl;
+	out << "\treturn res;" << endl;
+	out << "}" << endl;
+	out << endl;
+	
+	out << "wal::Position load_checkpoint(const string& path)" << endl;
+	out << "{" << endl;
+	out << "\tcheckpoint::Image in(path);" << endl;
+	for (const Schema::Relation& rel : relations) {
+		if (rel.attributes.empty()) continue;
+		out << "\t" << rel.name << ".read_checkpoint(in);" << endl;
+	}
+	out << "\twal::Position res;" << endl;
+	out << "\tres.next_lsn = in.lsn();" << endl;
+	out << "\treturn res;" << endl;
+	out << "}" << endl;
+	out << endl;
+	
+	out << "wal::Position replay_log(const string& path, const wal::Position& from)" << endl;
+	out << "{" << endl;
+	out << "\tassert(!wal::log().enabled());" << endl;
+	out << "\treturn wal::replay(path, [](uint16_t table, wal::Kind kind, const char* data) {" << endl;
+	out << "\t\tswitch (table) {" << endl;
+	for (const Schema::Relation& rel : relations) {
+		if (rel.attributes.empty()) continue;
+		out << "\t\tcase Table_" << rel.name << "::wal_id: " << rel.name << ".redo(kind, data); break;" << endl;
+	}
+	out << "\t\tdefault: throw runtime_error(\"log record of unknown table\");" << endl;
+	out << "\t\t}" << endl;
+	out << "\t}, from);" << endl;
+	out << "}" << endl;
+	
 	return out.str();
 }
\ No newline at end of file
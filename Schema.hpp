@@ -15,7 +15,8 @@ struct Schema {
 			unsigned len2;
 			bool notNull;
 			bool primaryFlag;
-			Attribute() : len(~0), len2(~0), notNull(true), primaryFlag(false) {}
+			bool compressed;// Integer/Numeric column stored as Packed_Vector, Char/Varchar as String_Vector
+			Attribute() : len(~0), len2(~0), notNull(true), primaryFlag(false), compressed(false) {}
 		};
 		struct Index {
 			vector<unsigned> fields;
@@ -27,13 +28,32 @@ struct Schema {
 		};
 		
 		string name;
+		size_t id;// position in the schema; names the table in the write-ahead log
 		vector<Schema::Relation::Attribute> attributes;
 		size_t primaryKey;
 		bool primaryKeySet;
+		bool chunked;// columns are Chunked_Vector instead of vector
+		bool synchronized;// safe for concurrent insert/remove: latched, hash indices are Concurrent_Hash_Index
+		bool partitioned;// rows are kept in one Table_<name>_partition per value of partitionAttribute
+		unsigned partitionAttribute;
+		bool partition;// generated as the partition of a partitioned table
 		vector<Schema::Relation::Index> indices;
-		Relation(const string& name) : name(name), primaryKey(0), primaryKeySet(false) {}
+		Relation(const string& name) : name(name), id(0), primaryKey(0), primaryKeySet(false), chunked(false), synchronized(false), partitioned(false), partitionAttribute(0), partition(false) {}
 		string hppTableDeclaration() const;
 		string cppTableImplementation() const;
+		// type_<index>(...) over the key fields, each printed by tmplt with &name; replaced
+		string keyTuple(const Index& ind, const string& tmplt) const;
+		// Table_<name>_partition, the relation holding one partition of a partitioned one
+		Relation partitionRelation() const;
+	private:
+		string columnType(const Attribute& attr) const;
+		string indexType(const Index& ind) const;
+		string hppPartitionedDeclaration() const;
+		string cppPartitionedImplementation() const;
+		string cppRedo() const;
+		string cppReadFromFile() const;
+		string cppEraseKeys(const string& indent) const;
+		string cppMoveRow(const string& indent) const;
 	};
 	vector<Schema::Relation> relations;
 	string toString() const;
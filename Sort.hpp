@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <iterator>
+
+/**
+ * Runtime support for generated OperatorSort and OperatorTopK.
+ */
+
+// bounded max-heap (by Cmp) holding the k smallest rows seen so far
+template <class Row, class Cmp, class Allocator = std::allocator<Row>>
+struct Top_K {
+	std::vector<Row,Allocator> heap;
+	size_t k;
+	Cmp cmp;
+	Top_K(size_t k) : k(k) {heap.reserve(k);}
+
+	bool full() const {return heap.size() == k;}
+	// the row that is evicted next; valid only if full()
+	const Row& top() const {return heap.front();}
+
+	void push(const Row& row) {
+		if (!full()) {
+			heap.push_back(row);
+			std::push_heap(heap.begin(), heap.end(), cmp);
+		} else if (cmp(row, heap.front())) {
+			std::pop_heap(heap.begin(), heap.end(), cmp);
+			heap.back() = row;
+			std::push_heap(heap.begin(), heap.end(), cmp);
+		}
+	}
+
+	// ascending rows; the heap is consumed
+	std::vector<Row,Allocator>& finish() {
+		std::sort_heap(heap.begin(), heap.end(), cmp);
+		return heap;
+	}
+};
+
+// runs of at least min_run rows are sorted by separate threads and then
+// merged pairwise, also in parallel, through a second buffer
+template <class Rows, class Cmp>
+void parallel_sort(Rows& rows, Cmp cmp, size_t min_run = 1 << 16) {
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t runs = std::min(threads, rows.size() / min_run);
+	if (runs < 2) {
+		std::sort(rows.begin(), rows.end(), cmp);
+		return;
+	}
+	// run boundaries
+	std::vector<size_t> bounds;
+	for (size_t i = 0; i <= runs; ++i) {
+		bounds.push_back(rows.size() * i / runs);
+	}
+	{
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < runs; ++i) {
+			workers.emplace_back([&rows, &bounds, cmp, i]() {
+				std::sort(rows.begin() + bounds[i], rows.begin() + bounds[i+1], cmp);
+			});
+		}
+		for (auto& w : workers) w.join();
+	}
+	Rows buffer(rows.size());
+	Rows* from = &rows;
+	Rows* to = &buffer;
+	while (bounds.size() > 2) {
+		std::vector<size_t> merged;
+		std::vector<std::thread> workers;
+		size_t i = 0;
+		for (; i + 2 < bounds.size(); i += 2) {
+			size_t b = bounds[i], m = bounds[i+1], e = bounds[i+2];
+			workers.emplace_back([from, to, b, m, e, cmp]() {
+				std::merge(from->begin() + b, from->begin() + m, from->begin() + m, from->begin() + e, to->begin() + b, cmp);
+			});
+			merged.push_back(b);
+		}
+		if (i + 1 < bounds.size()) {
+			// odd run out: copy through
+			size_t b = bounds[i], e = bounds[i+1];
+			std::copy(from->begin() + b, from->begin() + e, to->begin() + b);
+			merged.push_back(b);
+		}
+		merged.push_back(rows.size());
+		for (auto& w : workers) w.join();
+		bounds.swap(merged);
+		std::swap(from, to);
+	}
+	if (from != &rows) rows.swap(buffer);
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include "HashTable.hpp"
+
+/**
+ * Runtime support for OperatorHashJoin under a memory budget (hybrid hash
+ * join). The build side goes into one Join_Hash_Table per partition, chosen
+ * by bits of the key's hash; whenever the tables outgrow the budget, the
+ * largest one is written to a temporary file and its partition stays on
+ * disk. Probe tuples of resident partitions are looked up at once, those of
+ * spilled partitions are written to a file of their own. join_spilled() then
+ * releases the resident tables and joins the spilled partitions one at a
+ * time, splitting those still too large by the next bits of the hash, so the
+ * tables never hold more than the budget at once unless a partition is still
+ * too large after the last split.
+ *
+ * Records are copied as raw bytes in blocks of buffer_bytes, so they must not
+ * own memory. The files are unlinked on creation and vanish with the process.
+ */
+namespace spill {
+	const size_t buffer_bytes = 1 << 18;
+
+	// an unlinked file in $TMPDIR, /tmp if unset
+	inline int temporary() {
+		const char* dir = getenv("TMPDIR");
+		std::string path = std::string(dir && *dir ? dir : "/tmp") + "/spill_XXXXXX";
+		std::vector<char> name(path.begin(), path.end());
+		name.push_back('\0');
+		int fd = mkstemp(name.data());
+		if (fd < 0) throw std::runtime_error("cannot create spill file " + path);
+		unlink(name.data());
+		return fd;
+	}
+
+	// append-only file of fixed-size records, written and read in whole blocks;
+	// no file is created until the first block is full
+	template <class Record>
+	struct File {
+		static const size_t block = buffer_bytes / sizeof(Record) ? buffer_bytes / sizeof(Record) : 1;
+
+		File() = default;
+		File(const File&) = delete;
+		File& operator=(const File&) = delete;
+		~File() {if (fd >= 0) ::close(fd);}
+
+		size_t size() const {return written + buffer.size();}
+
+		void append(const Record& record) {
+			if (buffer.empty()) buffer.reserve(block);
+			buffer.push_back(record);
+			if (buffer.size() == block) flush();
+		}
+
+		// fn(record) for every record in order of appending
+		template <class Fn>
+		void scan(Fn fn) {
+			if (written) {
+				std::vector<Record> in(block);
+				for (size_t done = 0; done < written; done += block) {
+					size_t n = std::min(block, written - done);
+					read(reinterpret_cast<char*>(in.data()), n * sizeof(Record), done * sizeof(Record));
+					for (size_t i = 0; i < n; ++i) fn(in[i]);
+				}
+			}
+			for (const Record& record : buffer) fn(record);
+		}
+
+	private:
+		int fd = -1;
+		size_t written = 0;// records in the file
+		std::vector<Record> buffer;
+
+		void flush() {
+			if (fd < 0) fd = temporary();
+			const char* data = reinterpret_cast<const char*>(buffer.data());
+			size_t n = buffer.size() * sizeof(Record);
+			for (size_t done = 0; done < n; ) {
+				ssize_t w = ::write(fd, data + done, n - done);
+				if (w < 0) throw std::runtime_error("cannot write spill file");
+				done += size_t(w);
+			}
+			written += buffer.size();
+			buffer.clear();
+		}
+
+		void read(char* data, size_t n, size_t offset) const {
+			for (size_t done = 0; done < n; ) {
+				ssize_t r = ::pread(fd, data + done, n - done, offset + done);
+				if (r <= 0) throw std::runtime_error("cannot read spill file");
+				done += size_t(r);
+			}
+		}
+	};
+
+	template <class Record>
+	const size_t File<Record>::block;
+
+	// Table is a Join_Hash_Table, Record a probe tuple with its hash in a member hash
+	template <class Table, class Record>
+	struct Hybrid_Hash_Table {
+		using Key = typename Table::key_type;
+		using Value = typename Table::mapped_type;
+		static const unsigned bits = 4;// per level of partitioning
+		static const size_t fanout = size_t(1) << bits;
+		static const unsigned levels = 4;// at most, then a partition is loaded whatever its size
+
+		explicit Hybrid_Hash_Table(size_t budget) : budget(budget) {}
+
+		uint64_t hash(const Key& key) const {return parts[0].table.hash(key);}
+
+		void insert(const Key& key, const Value& value) {add(hash(key), key, value);}
+
+		// keys present already are dropped, in spilled partitions once they are loaded
+		void insert_unique(const Key& key, const Value& value) {
+			unique = true;
+			add(hash(key), key, value);
+		}
+
+		// the table of the partition of h, nullptr if it is spilled
+		const Table* resident(uint64_t h) const {
+			const Partition& p = parts[slot(h, 0)];
+			return p.build ? nullptr : &p.table;
+		}
+
+		// the probe tuple of a spilled partition, joined by join_spilled()
+		void spill(const Record& record) {parts[slot(record.hash, 0)].probe->append(record);}
+
+		// fn(table, record) for every spilled probe tuple, with the table of its partition;
+		// called after the last probe, as the resident tables are released first
+		template <class Fn>
+		void join_spilled(Fn fn) {
+			for (Partition& p : parts) {
+				if (p.build) continue;
+				p.table = Table();
+				p.bytes = 0;
+			}
+			resident_bytes = 0;
+			for (Partition& p : parts) {
+				if (!p.build) continue;
+				join(*p.build, *p.probe, 1, fn);
+				p.build.reset(new File<Build>());
+				p.probe.reset(new File<Record>());
+			}
+		}
+
+		// the most bytes the tables held at once
+		size_t peak_bytes() const {return peak;}
+
+	private:
+		struct Build {
+			uint64_t hash;
+			Key key;
+			Value value;
+		};
+		struct Partition {
+			Table table;
+			size_t bytes = 0;
+			// both set once the partition is spilled
+			std::unique_ptr<File<Build>> build;
+			std::unique_ptr<File<Record>> probe;
+		};
+		Partition parts[fanout];
+		size_t budget;
+		size_t resident_bytes = 0;
+		size_t peak = 0;
+		bool unique = false;
+
+		// the bits below the 32 high ones, which Join_Hash_Table uses for its buckets
+		static size_t slot(uint64_t h, unsigned level) {
+			return (h >> (32 - bits * (level + 1))) & (fanout - 1);
+		}
+
+		// hash_table_bytes() of a table of entries, whose bucket count doubles from 16 until it is at least entries
+		static size_t table_bytes(size_t entries) {
+			size_t buckets = entries ? 16 : 0;
+			while (buckets < entries) buckets *= 2;
+			return entries * sizeof(typename Table::Entry) + buckets * sizeof(size_t);
+		}
+
+		void add(uint64_t h, const Key& key, const Value& value) {
+			Partition& p = parts[slot(h, 0)];
+			if (p.build) {
+				p.build->append({h, key, value});
+				return;
+			}
+			load(p.table, h, key, value);
+			size_t now = hash_table_bytes(p.table);
+			resident_bytes += now - p.bytes;
+			p.bytes = now;
+			while (resident_bytes > budget) evict();
+			peak = std::max(peak, resident_bytes);
+		}
+
+		void load(Table& table, uint64_t h, const Key& key, const Value& value) const {
+			if (unique && table.find(table.head(h), h, key) != table.end()) return;
+			table.insert(h, key, value);
+		}
+
+		// writes out the largest resident partition
+		void evict() {
+			Partition* largest = nullptr;
+			for (Partition& p : parts) {
+				if (!p.build && (!largest || p.bytes > largest->bytes)) largest = &p;
+			}
+			largest->build.reset(new File<Build>());
+			largest->probe.reset(new File<Record>());
+			File<Build>& out = *largest->build;
+			largest->table.for_each([&](uint64_t h, const Key& key, const Value& value) {
+				out.append({h, key, value});
+			});
+			largest->table = Table();
+			resident_bytes -= largest->bytes;
+			largest->bytes = 0;
+		}
+
+		template <class Fn>
+		void join(File<Build>& build, File<Record>& probe, unsigned level, Fn& fn) {
+			if (probe.size() == 0) return;
+			if (level <= levels && table_bytes(build.size()) > budget) {
+				std::unique_ptr<File<Build>> builds[fanout];
+				std::unique_ptr<File<Record>> probes[fanout];
+				for (size_t s = 0; s < fanout; ++s) {
+					builds[s].reset(new File<Build>());
+					probes[s].reset(new File<Record>());
+				}
+				build.scan([&](const Build& b) {builds[slot(b.hash, level)]->append(b);});
+				probe.scan([&](const Record& r) {probes[slot(r.hash, level)]->append(r);});
+				for (size_t s = 0; s < fanout; ++s) {
+					join(*builds[s], *probes[s], level + 1, fn);
+					builds[s].reset();
+					probes[s].reset();
+				}
+				return;
+			}
+			Table table;
+			build.scan([&](const Build& b) {load(table, b.hash, b.key, b.value);});
+			peak = std::max(peak, hash_table_bytes(table));
+			probe.scan([&](const Record& r) {fn(static_cast<const Table&>(table), r);});
+		}
+	};
+
+	template <class Table, class Record>
+	const size_t Hybrid_Hash_Table<Table,Record>::fanout;
+}
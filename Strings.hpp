@@ -0,0 +1,220 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include "Allocator.hpp"
+
+/**
+ * Column storage for Char and Varchar attributes declared 'compressed'. Each
+ * row is a 16-byte header holding the length and the first 4 bytes of the
+ * string; strings of up to 12 bytes are kept whole in the header, longer ones
+ * in the column's string heap, which the header points into. Char values are
+ * stored without their trailing blanks, so most of them fit into the header.
+ *
+ * Selections compare the headers: the length and prefix decide equality and
+ * short prefixes without reading the heap. Rows are read as values of the
+ * runtime type, rebuilt from the header and the heap. Heap bytes of replaced
+ * and removed strings are reclaimed once they make up half of the heap.
+ */
+namespace strings {
+	const uint32_t inline_size = 12;
+
+	struct Header {
+		uint32_t len;
+		char prefix[4];
+		union {
+			char rest[8];// bytes 4 to 11 of a string stored in the header
+			uint64_t offset;// in the heap of a longer string, which holds all of it
+		};
+	};
+	static_assert(sizeof(Header) == 16, "unexpected layout of string header");
+
+	// the stored bytes: those of a Varchar (types with a len member), a Char up to its trailing blanks
+	template <class T>
+	auto stored(const T& v, int) -> decltype(v.len, size_t()) {return v.len;}
+	template <class T>
+	size_t stored(const T& v, long) {
+		size_t n = sizeof(v.value);
+		while (n > 0 && v.value[n - 1] == ' ') --n;
+		return n;
+	}
+
+	// Char values continue with blanks beyond their stored bytes, Varchar values end there
+	template <class T, class = void>
+	struct padded : std::true_type {};
+	template <class T>
+	struct padded<T,decltype(void(std::declval<const T&>().len))> : std::false_type {};
+}
+
+template <class T>
+struct String_Vector {
+	using Header = strings::Header;
+	std::vector<Header,Column_Allocator<Header>> headers;
+	std::vector<char,Column_Allocator<char>> heap;
+	size_t garbage = 0;// heap bytes no header points to
+
+	size_t size() const {return headers.size();}
+	bool empty() const {return headers.empty();}
+	void reserve(size_t n) {headers.reserve(n);}
+
+	T operator[](size_t i) const {
+		const Header& h = headers[i];
+		return T::castString(data(h), h.len);
+	}
+	T back() const {return (*this)[size()-1];}
+
+	// the bytes of a string, in its header or in the heap
+	const char* data(const Header& h) const {
+		return h.len <= strings::inline_size ? h.prefix : heap.data() + h.offset;
+	}
+
+	void set(size_t i, const T& v) {
+		Header h = encode(v);
+		release(headers[i]);
+		headers[i] = h;
+		reclaim();
+	}
+
+	void push_back(const T& v) {headers.push_back(encode(v));}
+
+	void pop_back() {
+		release(headers.back());
+		headers.pop_back();
+		reclaim();
+	}
+
+	void clear() {
+		headers.clear();
+		heap.clear();
+		garbage = 0;
+	}
+
+	// rows of [begin, begin + n) that start with prefix[0, len), as a selection vector
+	size_t select_prefix(size_t begin, size_t n, const char* prefix, size_t len, uint32_t* sel) const {
+		const Header* h = headers.data() + begin;
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			sel[k] = i;
+			k += startsWith(h[i], prefix, len);
+		}
+		return k;
+	}
+
+	size_t refine_prefix(size_t begin, const uint32_t* sel_in, size_t n, const char* prefix, size_t len, uint32_t* sel) const {
+		const Header* h = headers.data() + begin;
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t pos = sel_in[i];
+			sel[k] = pos;
+			k += startsWith(h[pos], prefix, len);
+		}
+		return k;
+	}
+
+	// rows of [begin, begin + n) equal to c; length and prefix are compared as one word
+	size_t select_equal(size_t begin, size_t n, const T& c, uint32_t* sel) const {
+		const Header* h = headers.data() + begin;
+		Probe probe(c);
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			sel[k] = i;
+			k += equal(h[i], probe);
+		}
+		return k;
+	}
+
+	size_t refine_equal(size_t begin, const uint32_t* sel_in, size_t n, const T& c, uint32_t* sel) const {
+		const Header* h = headers.data() + begin;
+		Probe probe(c);
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t pos = sel_in[i];
+			sel[k] = pos;
+			k += equal(h[pos], probe);
+		}
+		return k;
+	}
+
+	// bytes held by the column
+	size_t memory() const {
+		return headers.capacity() * sizeof(Header) + heap.capacity();
+	}
+
+	// heap bytes of the rows, without garbage
+	void compact() {
+		std::vector<char,Column_Allocator<char>> live;
+		live.reserve(heap.size() - garbage);
+		for (Header& h : headers) {
+			if (h.len <= strings::inline_size) continue;
+			const char* bytes = heap.data() + h.offset;
+			h.offset = live.size();
+			live.insert(live.end(), bytes, bytes + h.len);
+		}
+		heap.swap(live);
+		garbage = 0;
+	}
+
+private:
+	// a constant to compare headers with, encoded once
+	struct Probe {
+		uint64_t word;// length and prefix
+		uint64_t rest;
+		const char* bytes;
+		T value;
+		Probe(const T& c) : value(c) {
+			Header h = head(value);
+			memcpy(&word, &h, sizeof(word));
+			memcpy(&rest, h.rest, sizeof(rest));
+			bytes = value.value;
+		}
+	};
+
+	static Header head(const T& v) {
+		Header h;
+		memset(&h, 0, sizeof(h));
+		h.len = uint32_t(strings::stored(v, 0));
+		memcpy(h.prefix, v.value, std::min<size_t>(h.len, strings::inline_size));
+		return h;
+	}
+
+	Header encode(const T& v) {
+		Header h = head(v);
+		if (h.len > strings::inline_size) {
+			h.offset = heap.size();
+			heap.insert(heap.end(), v.value, v.value + h.len);
+		}
+		return h;
+	}
+
+	bool equal(const Header& h, const Probe& probe) const {
+		uint64_t word;
+		memcpy(&word, &h, sizeof(word));
+		if (word != probe.word) return false;
+		// values of short types are all in the header
+		if (h.len <= strings::inline_size || sizeof(probe.value.value) <= strings::inline_size) return h.offset == probe.rest;
+		return memcmp(heap.data() + h.offset + 4, probe.bytes + 4, h.len - 4) == 0;
+	}
+
+	bool startsWith(const Header& h, const char* prefix, size_t len) const {
+		if (h.len >= len) {
+			if (memcmp(h.prefix, prefix, std::min<size_t>(len, 4)) != 0) return false;
+			return len <= 4 || memcmp(data(h) + 4, prefix + 4, len - 4) == 0;
+		}
+		// a shorter Char continues with blanks
+		if (!strings::padded<T>::value || memcmp(data(h), prefix, h.len) != 0) return false;
+		for (size_t i = h.len; i < len; ++i) if (prefix[i] != ' ') return false;
+		return true;
+	}
+
+	void release(const Header& h) {
+		if (h.len > strings::inline_size) garbage += h.len;
+	}
+
+	void reclaim() {
+		if (garbage > 4096 && garbage * 2 > heap.size()) compact();
+	}
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Rows removed by the generated Table_::remove_batch() that are still in
+ * their columns: one bit per tid, set until Table_::compact() moves the live
+ * rows from the end of the table into the holes and truncates it. Until then
+ * tids stay stable, the indices no longer know the rows, and generated scans
+ * skip them: batches with a selection vector drop them a word of the bitmap
+ * at a time, other loops test their rows one by one.
+ */
+struct Tombstones {
+	static const size_t none = ~size_t(0);
+	std::vector<uint64_t> bits;// words beyond the end are zero
+	size_t count = 0;
+
+	bool any() const {return count != 0;}
+
+	bool test(size_t tid) const {
+		size_t w = tid >> 6;
+		return w < bits.size() && ((bits[w] >> (tid & 63)) & 1);
+	}
+
+	void set(size_t tid) {
+		size_t w = tid >> 6;
+		if (w >= bits.size()) bits.resize(w + 1, 0);
+		uint64_t bit = uint64_t(1) << (tid & 63);
+		count += (bits[w] & bit) == 0;
+		bits[w] |= bit;
+	}
+
+	// the first tombstone at or after tid, none if there is none
+	size_t next(size_t tid) const {
+		size_t w = tid >> 6;
+		if (w >= bits.size()) return none;
+		uint64_t word = bits[w] & (~uint64_t(0) << (tid & 63));
+		while (word == 0) {
+			if (++w == bits.size()) return none;
+			word = bits[w];
+		}
+		return (w << 6) + __builtin_ctzll(word);
+	}
+
+	// the entries of sel_in, offsets from begin, whose row is live; sel may alias sel_in
+	size_t refine(size_t begin, const uint32_t* sel_in, size_t n, uint32_t* sel) const {
+		if (count == 0) {
+			if (sel != sel_in) memcpy(sel, sel_in, n * sizeof(uint32_t));
+			return n;
+		}
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t pos = sel_in[i];
+			sel[k] = pos;
+			k += !test(begin + pos);
+		}
+		return k;
+	}
+
+	void clear() {
+		bits.clear();
+		count = 0;
+	}
+
+	// count from bits, e.g. after loading them
+	void recount() {
+		count = 0;
+		for (uint64_t word : bits) count += __builtin_popcountll(word);
+	}
+};
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Concurrent.hpp"
+
+/**
+ * Write-ahead redo log for the generated insert(), remove(), remove_batch(),
+ * compact() and procedure updates. Each thread encodes its records into its own buffer; the log
+ * writer thread collects all buffers, writes each as one checksummed frame
+ * and makes them durable with one fdatasync per round (group commit).
+ * Records carry a log sequence number (LSN) in execution order, so the
+ * frames need no common order on disk. A thread's records take effect at its
+ * next commit record. Recovery replays, in LSN order, the committed records
+ * of the gap-free LSN prefix. Commits are asynchronous: a Transaction ends
+ * once its commit record is buffered, wait(last_commit()) makes it durable.
+ * A Transaction ended by an exception writes an abort record instead, and
+ * replay drops the records it ends; the tables in memory keep the changes
+ * made before the exception.
+ * Records address rows by tid, inserts log the tid they assigned. Replay
+ * keeps them valid as long as a writer commits before it releases the latch
+ * of a table it inserted into or removed from, as generated procedures do:
+ * records dropped for lack of a commit then precede no committed change of
+ * the table. Table redo() throws if an insert lands elsewhere.
+ */
+namespace wal {
+	enum class Kind : uint8_t {Insert, Remove, Update, Commit, Tombstone, Compact, Abort};
+
+	// frame: size, checksum over the rest, writer, padding; then the records
+	const size_t frame_header_size = 16;
+	// record: lsn, size, table, kind, padding; then the payload
+	const size_t header_size = 16;
+
+	// FNV-1a over 8-byte words, then the tail bytes
+	inline uint32_t checksum(const char* data, size_t n) {
+		uint64_t h = 14695981039346656037ull;
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			uint64_t w;
+			memcpy(&w, data + i, 8);
+			h = (h ^ w) * 1099511628211ull;
+		}
+		for (; i < n; ++i) h = (h ^ uint8_t(data[i])) * 1099511628211ull;
+		return uint32_t(h ^ (h >> 32));
+	}
+
+	// values are written raw, except types with a len member (Varchar),
+	// of which only the used bytes are written
+	template <class T>
+	auto encoded(const T& v, int) -> decltype(v.len, size_t()) {return sizeof(v.len) + v.len;}
+	template <class T>
+	size_t encoded(const T&, long) {return sizeof(T);}
+
+	template <class T>
+	auto put(char* out, const T& v, int) -> decltype(v.len, (char*)nullptr) {
+		memcpy(out, &v.len, sizeof(v.len));
+		memcpy(out + sizeof(v.len), v.value, v.len);
+		return out + sizeof(v.len) + v.len;
+	}
+	template <class T>
+	char* put(char* out, const T& v, long) {
+		memcpy(out, &v, sizeof(T));
+		return out + sizeof(T);
+	}
+
+	inline size_t encodedAll() {return 0;}
+	template <class T, class... Rest>
+	size_t encodedAll(const T& v, const Rest&... rest) {return encoded(v, 0) + encodedAll(rest...);}
+
+	inline void putAll(char*) {}
+	template <class T, class... Rest>
+	void putAll(char* out, const T& v, const Rest&... rest) {
+		putAll(put(out, v, 0), rest...);
+	}
+
+	// decodes a record payload in the order it was written
+	struct Reader {
+		const char* at;
+		Reader(const char* at) : at(at) {}
+		template <class T>
+		void get(T& v) {get(v, 0);}
+	private:
+		template <class T>
+		auto get(T& v, int) -> decltype(v.len, void()) {
+			memcpy(&v.len, at, sizeof(v.len));
+			memcpy(v.value, at + sizeof(v.len), v.len);
+			at += sizeof(v.len) + v.len;
+		}
+		template <class T>
+		void get(T& v, long) {
+			memcpy(&v, at, sizeof(T));
+			at += sizeof(T);
+		}
+	};
+
+	inline void seal(std::vector<char>& frame, uint32_t writer) {
+		uint32_t size = frame.size() - frame_header_size;
+		memcpy(&frame[0], &size, 4);
+		memcpy(&frame[8], &writer, 4);
+		memset(&frame[12], 0, 4);
+		uint32_t sum = checksum(&frame[8], frame.size() - 8);
+		memcpy(&frame[4], &sum, 4);
+	}
+
+	inline bool write_all(int fd, const char* data, size_t n) {
+		for (size_t written = 0; written < n; ) {
+			ssize_t w = ::write(fd, data + written, n - written);
+			if (w < 0) return false;
+			written += w;
+		}
+		return true;
+	}
+
+	// where logging continues after replay()
+	struct Position {
+		uint64_t next_lsn = 1;
+	};
+
+	struct Log {
+		Log() {}
+		Log(const Log&) = delete;
+		Log& operator=(const Log&) = delete;
+		~Log() {close();}
+
+		bool enabled() const {return active.load(std::memory_order_relaxed);}
+
+		// records drawn from now on get an LSN from position().next_lsn on
+		Position position() const {
+			Position res;
+			res.next_lsn = next_lsn.load();
+			return res;
+		}
+
+		// appends to path; the writer makes commits durable every interval
+		void open(const std::string& path, const Position& position = Position(), std::chrono::microseconds interval = std::chrono::microseconds(1000)) {
+			close();
+			fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if (fd < 0) throw std::runtime_error("cannot open log " + path);
+			next_lsn.store(position.next_lsn);
+			durable = position.next_lsn - 1;
+			requested.store(0);
+			this->interval = interval;
+			stop = false;
+			writer = std::thread([this]() {run();});
+			active.store(true);
+		}
+
+		// makes everything committed durable and stops logging
+		void close() {
+			if (!writer.joinable()) return;
+			active.store(false);
+			wait(next_lsn.load() - 1);
+			{
+				std::lock_guard<std::mutex> lock(m);
+				stop = true;
+			}
+			wake.notify_one();
+			writer.join();
+			::close(fd);
+			fd = -1;
+		}
+
+		template <class... Values>
+		void insert(uint16_t table, const Values&... values) {
+			append(table, Kind::Insert, values...);
+		}
+
+		void remove(uint16_t table, uint64_t tid) {
+			append(table, Kind::Remove, tid);
+		}
+
+		template <class T>
+		void update(uint16_t table, uint64_t tid, uint16_t attr, const T& value) {
+			append(table, Kind::Update, tid, attr, value);
+		}
+
+		// tid was removed by remove_batch() and stays in place
+		void tombstone(uint16_t table, uint64_t tid) {
+			append(table, Kind::Tombstone, tid);
+		}
+
+		// the partition with base tid (0 if the table is not partitioned) was compacted
+		void compact(uint16_t table, uint64_t base) {
+			append(table, Kind::Compact, base);
+		}
+
+		// ends the calling thread's transaction; returns its LSN to wait() for
+		uint64_t commit() {
+			uint64_t lsn = append(0, Kind::Commit);
+			uint64_t r = requested.load(std::memory_order_relaxed);
+			// picked up by the writer's next round
+			while (r < lsn && !requested.compare_exchange_weak(r, lsn)) {}
+			return lsn;
+		}
+
+		// drops the calling thread's records since its last commit or abort
+		void abort() {
+			append(0, Kind::Abort);
+		}
+
+		// blocks until everything up to lsn is on disk
+		void wait(uint64_t lsn) {
+			std::unique_lock<std::mutex> lock(m);
+			if (durable >= lsn) return;
+			uint64_t r = requested.load(std::memory_order_relaxed);
+			while (r < lsn && !requested.compare_exchange_weak(r, lsn)) {}
+			++waiting;
+			wake.notify_one();
+			done.wait(lock, [this, lsn]() {return durable >= lsn;});
+			--waiting;
+		}
+
+		void flush() {wait(commit());}
+
+	private:
+		struct Buffer {
+			Shared_Latch latch;
+			std::vector<char> data;
+			std::vector<char> flushing;// swapped with data by the writer thread
+			uint32_t writer;
+			bool exited = false;// its thread ended, guarded by m
+		};
+		// the calling thread's buffers, one per log; they are dropped by the
+		// writer thread once the thread has ended and they are drained
+		struct Thread_Buffers {
+			std::unordered_map<Log*,Buffer*> mine;
+			~Thread_Buffers() {
+				for (auto& b : mine) {
+					std::lock_guard<std::mutex> lock(b.first->m);
+					b.second->exited = true;
+				}
+			}
+		};
+
+		std::atomic<bool> active{false};
+		std::atomic<uint64_t> next_lsn{1};
+		std::atomic<uint64_t> requested{0};
+		uint64_t durable = 0;// guarded by m
+		size_t waiting = 0;// threads in wait(), guarded by m
+		int fd = -1;
+		std::chrono::microseconds interval;
+		bool stop = false;
+		std::mutex m;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::vector<std::unique_ptr<Buffer>> buffers;// guarded by m
+		uint32_t writers = 0;// buffers ever created, guarded by m; writer 0 is the replayed prefix
+		std::thread writer;
+
+		Buffer& buffer() {
+			// one buffer per thread and log, kept while the thread runs
+			static thread_local const Log* last = nullptr;
+			static thread_local Buffer* last_buffer = nullptr;
+			if (last == this) return *last_buffer;
+			static thread_local Thread_Buffers mine;
+			Buffer*& b = mine.mine[this];
+			if (b == nullptr) {
+				std::lock_guard<std::mutex> lock(m);
+				buffers.emplace_back(new Buffer());
+				b = buffers.back().get();
+				// never reused: replay tells writers apart by it
+				b->writer = ++writers;
+				b->data.reserve(1 << 16);
+				b->data.resize(frame_header_size);
+			}
+			last = this;
+			last_buffer = b;
+			return *b;
+		}
+
+		// the LSN is drawn under the buffer latch: the writer thread, taking the
+		// latch after reading next_lsn, finds every smaller LSN in some buffer
+		template <class... Values>
+		uint64_t append(uint16_t table, Kind kind, const Values&... values) {
+			Buffer& b = buffer();
+			uint32_t size = encodedAll(values...);
+			std::lock_guard<Shared_Latch> lock(b.latch);
+			size_t at = b.data.size();
+			b.data.resize(at + header_size + size);
+			char* h = &b.data[at];
+			uint64_t lsn = next_lsn.fetch_add(1, std::memory_order_relaxed);
+			uint8_t k = uint8_t(kind);
+			memcpy(h, &lsn, 8);
+			memcpy(h + 8, &size, 4);
+			memcpy(h + 12, &table, 2);
+			memcpy(h + 14, &k, 1);
+			h[15] = 0;
+			putAll(h + header_size, values...);
+			return lsn;
+		}
+
+		void run() {
+			std::vector<Buffer*> round;
+			std::unique_lock<std::mutex> lock(m);
+			while (true) {
+				// one round per interval gathers the commits of all threads,
+				// unless someone blocks in wait()
+				wake.wait_for(lock, interval, [this]() {return stop || (waiting > 0 && requested.load() > durable);});
+				if (stop) return;
+				if (requested.load() <= durable) continue;
+				uint64_t snapshot = next_lsn.load();
+				round.clear();
+				size_t kept = 0;
+				for (size_t i = 0; i < buffers.size(); ++i) {
+					Buffer* b = buffers[i].get();
+					{
+						std::lock_guard<Shared_Latch> buffer_lock(b->latch);
+						if (b->data.size() != frame_header_size) {
+							b->flushing.swap(b->data);
+							b->data.resize(frame_header_size);
+							round.push_back(b);
+						} else if (b->exited) {
+							// drained by an earlier round
+							continue;
+						}
+					}
+					if (kept != i) buffers[kept] = std::move(buffers[i]);
+					++kept;
+				}
+				buffers.resize(kept);
+				lock.unlock();
+				// frame headers are filled in here, off the transactions' path
+				for (Buffer* b : round) {
+					std::vector<char>& frame = b->flushing;
+					seal(frame, b->writer);
+					if (!write_all(fd, frame.data(), frame.size())) {
+						perror("log write");
+						std::abort();
+					}
+					frame.clear();// keeps the capacity for the next swap
+				}
+				if (::fdatasync(fd) != 0) {
+					perror("log fdatasync");
+					std::abort();
+				}
+				lock.lock();
+				durable = snapshot - 1;
+				done.notify_all();
+			}
+		}
+	};
+
+	inline Log& log() {
+		static Log instance;
+		return instance;
+	}
+
+	// LSN of the calling thread's last commit, 0 before the first
+	inline uint64_t& last_commit() {
+		thread_local uint64_t lsn = 0;
+		return lsn;
+	}
+
+	// exceptions being thrown on the calling thread
+	inline int uncaught_exceptions() {
+#if __cplusplus >= 201703L
+		return std::uncaught_exceptions();
+#else
+		return std::uncaught_exception() ? 1 : 0;
+#endif
+	}
+
+	// commits the calling thread's records when it goes out of scope, without
+	// waiting for the commit to be durable; aborts them if an exception leaves it
+	struct Transaction {
+		Transaction() : exceptions(uncaught_exceptions()) {}
+		Transaction(const Transaction&) = delete;
+		Transaction& operator=(const Transaction&) = delete;
+		~Transaction() {
+			if (!log().enabled()) return;
+			if (uncaught_exceptions() > exceptions) log().abort();
+			else last_commit() = log().commit();
+		}
+	private:
+		int exceptions;
+	};
+
+	// Applies the log at path through apply(table, kind, payload), rewrites the
+	// file to the applied records and returns where logging continues. A torn
+	// tail, LSNs after a gap and records whose writer's next commit or abort is
+	// not a commit are dropped, as are records before from, which a checkpoint
+	// already holds.
+	inline Position replay(const std::string& path, const std::function<void(uint16_t,Kind,const char*)>& apply, const Position& from = Position()) {
+		Position res = from;
+		std::vector<char> file;
+		{
+			FILE* in = fopen(path.c_str(), "rb");
+			if (in == nullptr) return res;
+			char chunk[1 << 16];
+			size_t n;
+			while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) file.insert(file.end(), chunk, chunk + n);
+			fclose(in);
+		}
+		struct Record {
+			uint64_t lsn;
+			uint32_t writer;
+			size_t at;
+		};
+		std::vector<Record> records;
+		for (size_t frame = 0; frame + frame_header_size <= file.size(); ) {
+			uint32_t size, sum, writer;
+			memcpy(&size, &file[frame], 4);
+			memcpy(&sum, &file[frame + 4], 4);
+			memcpy(&writer, &file[frame + 8], 4);
+			size_t end = frame + frame_header_size + size;
+			if (end > file.size() || checksum(&file[frame + 8], end - frame - 8) != sum) break;
+			for (size_t at = frame + frame_header_size; at < end; ) {
+				Record r;
+				uint32_t record_size;
+				memcpy(&r.lsn, &file[at], 8);
+				memcpy(&record_size, &file[at + 8], 4);
+				r.writer = writer;
+				r.at = at;
+				records.push_back(r);
+				at += header_size + record_size;
+			}
+			frame = end;
+		}
+		std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) {return a.lsn < b.lsn;});
+		size_t prefix = 0;
+		while (prefix < records.size() && (prefix == 0 || records[prefix].lsn == records[prefix-1].lsn + 1)) ++prefix;
+		if (prefix > 0 && records[0].lsn > from.next_lsn) throw std::runtime_error("log " + path + " starts after the checkpoint");
+		// by record: the next commit or abort of its writer is a commit
+		std::vector<bool> committed(prefix, false);
+		std::unordered_map<uint32_t,Kind> ending;// writer -> kind of the next end seen
+		for (size_t i = prefix; i-- > 0; ) {
+			Kind kind = Kind(file[records[i].at + 14]);
+			if (kind == Kind::Commit || kind == Kind::Abort) {
+				ending[records[i].writer] = kind;
+				continue;
+			}
+			auto e = ending.find(records[i].writer);
+			committed[i] = e != ending.end() && e->second == Kind::Commit;
+		}
+		// the applied records, renumbered from from, in one frame of writer 0 ending with a commit
+		std::vector<char> kept(frame_header_size);
+		uint64_t lsn = from.next_lsn - 1;
+		for (size_t i = 0; i < prefix; ++i) {
+			const Record& r = records[i];
+			const char* h = &file[r.at];
+			Kind kind = Kind(h[14]);
+			if (!committed[i] || r.lsn < from.next_lsn) continue;
+			uint16_t table;
+			uint32_t size;
+			memcpy(&size, h + 8, 4);
+			memcpy(&table, h + 12, 2);
+			apply(table, kind, h + header_size);
+			size_t at = kept.size();
+			kept.insert(kept.end(), h, h + header_size + size);
+			++lsn;
+			memcpy(&kept[at], &lsn, 8);
+		}
+		bool applied = kept.size() > frame_header_size;
+		if (applied) {
+			size_t at = kept.size();
+			kept.resize(at + header_size, 0);
+			++lsn;
+			uint8_t k = uint8_t(Kind::Commit);
+			memcpy(&kept[at], &lsn, 8);
+			memcpy(&kept[at + 14], &k, 1);
+		}
+		std::string tmp = path + ".tmp";
+		int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) throw std::runtime_error("cannot write " + tmp);
+		if (applied) {
+			seal(kept, 0);
+			if (!write_all(fd, kept.data(), kept.size())) {
+				::close(fd);
+				throw std::runtime_error("cannot write " + tmp);
+			}
+		}
+		::fsync(fd);
+		::close(fd);
+		if (std::rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("cannot replace " + path);
+		res.next_lsn = lsn + 1;
+		return res;
+	}
+}
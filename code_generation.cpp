@@ -1,6 +1,8 @@
 #include <sstream>
 #include <unordered_map>
 #include <algorithm>
+#include <set>
+#include <cctype>
 #include <assert.h>
 #include "code_generation.h"
 
@@ -18,87 +20,651 @@ struct TabPredicate {
 	bool operator()(const T& t) const { return t.tab == tab; }
 };
 
-class Name_Generator {
-	unordered_map<string,size_t> used_names;
-public:
-	string request_name(const string& suggested) {
-		auto it = used_names.find(suggested);
-		if (it == used_names.end()) {
-			used_names.insert(make_pair(suggested,0));
-			return suggested;
-		} else {
-			size_t num = ++it->second;
-			return suggested + to_string(num);
+void Context::setTabInstances(const vector<Tab_Instance>& tab_instances) {
+	this->tab_instances = tab_instances;
+	tid_names.assign(tab_instances.size(), string());
+	partition_exprs.assign(tab_instances.size(), string());
+	field_offsets.clear();
+	size_t total = 0;
+	for (const Tab_Instance& t : tab_instances) {
+		field_offsets.push_back(total);
+		total += schema->relations[t.def_pos].attributes.size();
+	}
+	field_marks.assign(total, 0);
+	field_exprs.assign(total, string());
+	mark_epoch = 0;
+}
+
+void Context::reset() {
+	names.reset();
+	for (string& name : tid_names) name.clear();
+	for (string& expr : partition_exprs) expr.clear();
+	for (string& expr : field_exprs) expr.clear();
+}
+
+void Context::mergeFields(vector<Field_Unit>& dst, const vector<Field_Unit>& src) {
+	if (++mark_epoch == 0) {
+		fill(field_marks.begin(), field_marks.end(), 0);
+		mark_epoch = 1;
+	}
+	for (const Field_Unit& t : dst) field_marks[fieldId(t)] = mark_epoch;
+	for (const Field_Unit& t : src) {
+		uint32_t& mark = field_marks[fieldId(t)];
+		if (mark != mark_epoch) {
+			mark = mark_epoch;
+			dst.push_back(t);
 		}
 	}
-} name_generator;
+}
+
+void* Plan::allocate(size_t size, size_t align) {
+	assert(size <= block_size);
+	offset = (offset + align - 1) & ~(align - 1);
+	if (blocks.empty() || offset + size > block_size) {
+		if (!blocks.empty()) ++block;
+		if (block == blocks.size()) blocks.emplace_back(new char[block_size]);
+		offset = 0;
+	}
+	void* res = blocks[block].get() + offset;
+	offset += size;
+	return res;
+}
+
+void Plan::reset() {
+	for (Operator* op : operators) op->~Operator();
+	operators.clear();
+	block = 0;
+	offset = 0;
+	context.reset();
+	out.str(string());
+	out.clear();
+}
+
+void Plan::generate(Operator* root) {
+	root->computeProduced();
+	root->computeRequired();
+	// the tables the plan reads get new tid names
+	vector<string> tid_names = context.tid_names;
+	root->computeTIDs();
+	// synchronized tables are latched shared while the plan runs, so that
+	// concurrent inserts and removes neither grow nor move their columns
+	string latches, delim;
+	for (size_t tab = 0; tab < tid_names.size(); ++tab) {
+		if (context.tid_names[tab] == tid_names[tab] || !context.getTabDef(tab).synchronized) continue;
+		latches += delim + "&" + context.getTabName(tab) + ".latch";
+		delim = ",";
+	}
+	if (!latches.empty()) out << "{Latch_Guard " << context.requestName("guard") << "({},{" << latches << "});";
+	root->produce();
+	if (!latches.empty()) out << "}";
+}
 
 void OperatorScan::computeProduced() {
-	auto def = context->getTabDef(tab);
+	const Schema::Relation& def = context->getTabDef(tab);
+	filters.clear();
+	produced.clear();
 	for (size_t i = 0; i < def.attributes.size(); ++i) {
 		produced.push_back({tab, i});
 	}
 }
 
 void OperatorScan::computeTIDs() {
-	string tid = name_generator.request_name("tid");
-	TIDs.push_back({tid, tab});
+	string tid = context->requestName("tid");
+	context->setTidName(tab, tid);
+	TIDs.assign(1, {tid, tab});
+}
+
+bool OperatorScan::pushFilter(const Expr_Ptr& filter) {
+	if (!filter->vectorizable(context)) return false;
+	filters.push_back(filter);
+	return true;
+}
+
+// compressed Integer/Numeric column: a Packed_Vector, read a decoded batch at a time
+static bool packedColumn(const Schema::Relation::Attribute& attr) {
+	return attr.compressed && (attr.type == Types::Tag::Integer || attr.type == Types::Tag::Numeric);
 }
 
 void OperatorScan::produce() {
+	const Schema::Relation& def = context->getTabDef(tab);
+	if (!def.partitioned) {
+		produceRows(context->getTabName(tab), TIDs[0].name);
+		return;
+	}
+	// partition by partition: the consumer reads the fields from the partition's
+	// columns by row, tids stay those of the table
+	string tid = TIDs[0].name;
+	string tab_name = context->getTabName(tab);
+	string part = tid + "_part", row = tid + "_row";
+	const string& fixed = context->getPartitionExpr(tab);
+	vector<Expr_Ptr> row_filters;
+	if (!fixed.empty()) {
+		out << "if (auto* " << part << "_ptr=" << fixed << "){auto& " << part << "=*" << part << "_ptr;";
+		row_filters = filters;
+	} else {
+		// filters on the partitioning attribute hold for all rows of a partition or for none
+		string p = tid + "_p";
+		Field_Unit key = {tab, def.partitionAttribute};
+		out << "for (size_t " << p << "=0;" << p << "<" << tab_name << ".partitions.size();++" << p << "){";
+		context->setFieldExpr(key, tab_name + ".partitions.keys[" + p + "]");
+		for (const Expr_Ptr& filter : filters) {
+			if (filter->field == key) {
+				out << "if (!" << filter->generate(context, this) << ") continue;";
+			} else {
+				row_filters.push_back(filter);
+			}
+		}
+		context->setFieldExpr(key, string());
+		out << "auto& " << part << "=" << tab_name << ".partitions[" << p << "];";
+	}
+	vector<Field_Unit> fields;
+	for (const Field_Unit& t : *getRequired()) {
+		if (t.tab == tab && !packedColumn(context->getAttr(tab, t.attr))) fields.push_back(t);
+	}
+	for (const Field_Unit& t : fields) {
+		context->setFieldExpr(t, part + "." + context->getAttr(tab, t.attr).name + "[" + row + "]");
+	}
+	swap(filters, row_filters);
+	produceRows(part, row);
+	swap(filters, row_filters);
+	for (const Field_Unit& t : fields) context->setFieldExpr(t, string());
+	out << "}";
+}
+
+void OperatorScan::produceRows(const string& source, const string& row) {
 	string tid = TIDs[0].name;
-	const string tmplt = "for (Tid &tid; = 0;&tid; < &tab;.size(); ++&tid;)";
-	string tmp = ReplaceString(tmplt,"&tid;",tid);
-	ReplaceStringInPlace(tmp, "&tab;", context->getTabName(tab));
-	out << tmp << "{";
+	// rows of a partition are numbered from its base
+	string global = row == tid ? "" : "Tid " + tid + "=" + source + ".base+" + row + ";";
+	// compressed columns needed above are unpacked a batch at a time
+	vector<Field_Unit> packed;
+	for (const Field_Unit& t : *getRequired()) {
+		if (t.tab == tab && packedColumn(context->getAttr(tab, t.attr))) packed.push_back(t);
+	}
+	if (!filters.empty() || !packed.empty()) {
+		// batches of kernels::batch_size rows are narrowed to a selection vector first
+		string batch = tid + "_batch", sel = tid + "_sel", count = tid + "_count", k = tid + "_k";
+		if (context->getTabDef(tab).chunked) {
+			out << "static_assert(chunked::chunk_size%kernels::batch_size==0,\"batches must not cross chunks\");";
+		}
+		if (!filters.empty()) {
+			out << "uint32_t " << sel << "[kernels::batch_size];";
+		}
+		vector<string> buffers;
+		for (const Field_Unit& t : packed) {
+			const auto& attr = context->getAttr(tab, t.attr);
+			buffers.push_back(context->requestName(tid + "_" + attr.name));
+			out << type(attr) << " " << buffers.back() << "[kernels::batch_size];";
+		}
+		out << "for (Tid " << batch << "=0;" << batch << "<" << source << ".size();" << batch << "+=kernels::batch_size){";
+		out << "size_t " << count << "=min<size_t>(kernels::batch_size," << source << ".size()-" << batch << ");";
+		bool refine = false;
+		for (const Expr_Ptr& filter : filters) {
+			string column = source + "." + context->getAttr(tab, filter->field.attr).name;
+			out << filter->generateKernel(context, column, batch, sel, count, refine);
+			refine = true;
+		}
+		// rows removed by remove_batch() leave the selection vector with the filtered ones
+		if (!filters.empty()) {
+			out << count << "=" << source << ".tombstones.refine(" << batch << "," << sel << "," << count << "," << sel << ");";
+		}
+		if (!filters.empty() && !packed.empty()) {
+			out << "if (" << count << "==0) continue;";
+		}
+		for (size_t i = 0; i < packed.size(); ++i) {
+			out << source << "." << context->getAttr(tab, packed[i].attr).name << ".decode(" << batch << "," << buffers[i] << ");";
+			context->setFieldExpr(packed[i], buffers[i] + "[" + row + "-" + batch + "]");
+		}
+		out << "for (size_t " << k << "=0;" << k << "<" << count << ";++" << k << "){";
+		if (filters.empty()) {
+			out << "Tid " << row << "=" << batch << "+" << k << ";";
+			out << "if (" << source << ".tombstones.test(" << row << ")) continue;";
+		} else {
+			out << "Tid " << row << "=" << batch << "+" << sel << "[" << k << "];";
+		}
+		out << global;
+		consumer->consume(this);
+		out << "}}";
+		for (const Field_Unit& t : packed) context->setFieldExpr(t, string());
+		return;
+	}
+	string tmplt = "for (Tid &tid; = 0;&tid; < &tab;.size(); ++&tid;)";
+	if (context->getTabDef(tab).chunked) {
+		// chunk by chunk: the inner loop stays within one chunk of every column
+		tmplt = "for (Tid &tid;_chunk = 0;&tid;_chunk < &tab;.size(); &tid;_chunk += chunked::chunk_size)"
+			"for (Tid &tid; = &tid;_chunk, &tid;_end = min<Tid>(&tab;.size(), &tid;_chunk + chunked::chunk_size);&tid; < &tid;_end; ++&tid;)";
+	}
+	string tmp = ReplaceString(tmplt,"&tid;",row);
+	ReplaceStringInPlace(tmp, "&tab;", source);
+	out << tmp << "{if (" << source << ".tombstones.test(" << row << ")) continue;" << global;
 	consumer->consume(this);
 	out << "}";
 }
 
+// the value of field read through the tid variable of its table instance
+static string tidFieldExpr(const Context* context, const Field_Unit& field) {
+	return context->getTabName(field.tab) + "."
+		+ context->getAttr(field.tab, field.attr).name
+		+ "[" + context->getTidName(field.tab) + "]";
+}
+
+string Operator::getFieldExpr(const Field_Unit& field) const {
+	assert(find_if(getTIDs()->begin(), getTIDs()->end(), TabPredicate<TID_Unit>(field.tab)) != getTIDs()->end());
+	const string& decoded = context->getFieldExpr(field);
+	if (!decoded.empty()) return decoded;
+	return tidFieldExpr(context, field);
+}
+
+static string quote(const string& str) {
+	string res = "\"";
+	for (char c : str) {
+		if (c == '"' || c == '\\') res.push_back('\\');
+		res.push_back(c);
+	}
+	res.push_back('"');
+	return res;
+}
+
+// 64-bit FNV-1a of code, in hex
+static string fingerprint(const string& code) {
+	uint64_t h = 14695981039346656037ull;
+	for (char c : code) h = (h ^ (unsigned char)c) * 1099511628211ull;
+	stringstream res;
+	res << hex << h;
+	return res.str();
+}
+
+static const char* cmpOperator(Expr::Cmp cmp) {
+	switch(cmp) {
+		case Expr::Cmp::Eq: return "==";
+		case Expr::Cmp::Ne: return "!=";
+		case Expr::Cmp::Lt: return "<";
+		case Expr::Cmp::Le: return "<=";
+		case Expr::Cmp::Gt: return ">";
+		case Expr::Cmp::Ge: return ">=";
+	}
+	throw;
+}
+
+Expr_Ptr exprCompare(const Field_Unit& field, Expr::Cmp cmp, const string& constant) {
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::Compare);
+	e->field = field;
+	e->cmp = cmp;
+	e->constants = {constant};
+	return e;
+}
+
+Expr_Ptr exprBetween(const Field_Unit& field, const string& low, const string& high) {
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::Between);
+	e->field = field;
+	e->constants = {low, high};
+	return e;
+}
+
+Expr_Ptr exprIn(const Field_Unit& field, const vector<string>& constants) {
+	assert(!constants.empty());
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::In);
+	e->field = field;
+	e->constants = constants;
+	return e;
+}
+
+Expr_Ptr exprLikePrefix(const Field_Unit& field, const string& prefix) {
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::LikePrefix);
+	e->field = field;
+	e->constants = {prefix};
+	return e;
+}
+
+Expr_Ptr exprAnd(const vector<Expr_Ptr>& children) {
+	assert(!children.empty());
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::And);
+	e->children = children;
+	return e;
+}
+
+Expr_Ptr exprOr(const vector<Expr_Ptr>& children) {
+	assert(!children.empty());
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::Or);
+	e->children = children;
+	return e;
+}
+
+Expr_Ptr exprNot(const Expr_Ptr& child) {
+	Expr_Ptr e = make_shared<Expr>(Expr::Kind::Not);
+	e->children = {child};
+	return e;
+}
+
+void Expr::collectFields(vector<Field_Unit>& fields) const {
+	if (children.empty()) {
+		auto it = find(fields.begin(), fields.end(), field);
+		if (it == fields.end()) fields.push_back(field);
+	}
+	for (const Expr_Ptr& child : children) {
+		child->collectFields(fields);
+	}
+}
+
+// rough estimate in "integer comparisons"; strings cost per 8 bytes touched
+unsigned Expr::cost(const Context* context) const {
+	unsigned res = 0;
+	switch(kind) {
+		case Kind::And: /* fallthrough */
+		case Kind::Or: /* fallthrough */
+		case Kind::Not:
+			for (const Expr_Ptr& child : children) res += child->cost(context);
+			return res;
+		case Kind::LikePrefix:
+			return 1 + constants[0].size() / 8;
+		default: {
+			const auto& attr = context->getAttr(field.tab, field.attr);
+			unsigned one = 1;
+			if (attr.type == Types::Tag::Char || attr.type == Types::Tag::Varchar) one += attr.len / 8;
+			return one * constants.size();
+		}
+	}
+}
+
+Expr_Ptr Expr::declareConstants(Context* context, stringstream& out) const {
+	Expr_Ptr res = make_shared<Expr>(*this);
+	for (Expr_Ptr& child : res->children) {
+		child = child->declareConstants(context, out);
+	}
+	if (kind == Kind::LikePrefix || constants.empty()) return res;
+	string type_name = type(context->getAttr(field.tab, field.attr));
+	res->const_names.clear();
+	for (const string& c : constants) {
+		res->const_names.push_back(context->requestName("constant"));
+		out << "const " << type_name << " " << res->const_names.back() 
+			<< "=" << type_name << "::castString(" << quote(c) << "," << c.size() << ");";
+	}
+	return res;
+}
+
+// cheap children are combined with & and | so that no branches are emitted
+static const unsigned branch_free_cost = 8;
+
+string Expr::generate(const Context* context, const Operator* input) const {
+	stringstream res;
+	string delim;
+	switch(kind) {
+		case Kind::Compare:
+			res << "(" << input->getFieldExpr(field) << cmpOperator(cmp) << const_names[0] << ")";
+			break;
+		case Kind::Between: {
+			string value = input->getFieldExpr(field);
+			res << "((" << const_names[0] << "<=" << value << ")&(" << value << "<=" << const_names[1] << "))";
+			break;
+		}
+		case Kind::In: {
+			string value = input->getFieldExpr(field);
+			res << "(";
+			delim = "";
+			for (const string& c : const_names) {
+				res << delim << "(" << value << "==" << c << ")";
+				delim = "|";
+			}
+			res << ")";
+			break;
+		}
+		case Kind::LikePrefix: {
+			const auto& attr = context->getAttr(field.tab, field.attr);
+			const string& prefix = constants[0];
+			string value = input->getFieldExpr(field);
+			assert(attr.type == Types::Tag::Char || attr.type == Types::Tag::Varchar);
+			if (prefix.size() > attr.len) {
+				res << "false";
+			} else if (attr.type == Types::Tag::Varchar) {
+				res << "((" << value << ".len>=" << prefix.size() << ")&"
+					<< "(memcmp(" << value << ".value," << quote(prefix) << "," << prefix.size() << ")==0))";
+			} else {
+				res << "(memcmp(" << value << ".value," << quote(prefix) << "," << prefix.size() << ")==0)";
+			}
+			break;
+		}
+		case Kind::Not:
+			res << "(!" << children[0]->generate(context, input) << ")";
+			break;
+		case Kind::And: /* fallthrough */
+		case Kind::Or: {
+			bool branch_free = cost(context) <= branch_free_cost;
+			vector<Expr_Ptr> sorted = children;
+			stable_sort(sorted.begin(), sorted.end(), [context](const Expr_Ptr& a, const Expr_Ptr& b) {
+				return a->cost(context) < b->cost(context);
+			});
+			string op = kind == Kind::And ? (branch_free ? "&" : "&&") : (branch_free ? "|" : "||");
+			res << "(";
+			delim = "";
+			for (const Expr_Ptr& child : sorted) {
+				res << delim << child->generate(context, input);
+				delim = op;
+			}
+			res << ")";
+			break;
+		}
+	}
+	return res.str();
+}
+
+bool Expr::vectorizable(const Context* context) const {
+	if (!children.empty()) return false;
+	const auto& attr = context->getAttr(field.tab, field.attr);
+	switch(attr.type) {
+		case Types::Tag::Integer: /* fallthrough */
+		case Types::Tag::Numeric:
+			return kind == Kind::Compare || kind == Kind::Between;
+		case Types::Tag::Char:
+			return (kind == Kind::Compare && cmp == Cmp::Eq)
+				|| (kind == Kind::LikePrefix && constants[0].size() <= attr.len);
+		case Types::Tag::Varchar:
+			return kind == Kind::LikePrefix && constants[0].size() <= attr.len;
+		default:
+			return false;
+	}
+}
+
+static const char* kernelCmp(Expr::Cmp cmp) {
+	switch(cmp) {
+		case Expr::Cmp::Eq: return "kernels::Cmp::Eq";
+		case Expr::Cmp::Ne: return "kernels::Cmp::Ne";
+		case Expr::Cmp::Lt: return "kernels::Cmp::Lt";
+		case Expr::Cmp::Le: return "kernels::Cmp::Le";
+		case Expr::Cmp::Gt: return "kernels::Cmp::Gt";
+		case Expr::Cmp::Ge: return "kernels::Cmp::Ge";
+	}
+	throw;
+}
+
+string Expr::generateKernel(const Context* context, const string& column, const string& batch, const string& sel, const string& count, bool refine) const {
+	assert(vectorizable(context));
+	const auto& attr = context->getAttr(field.tab, field.attr);
+	string rows = "&" + column + "[" + batch + "]";
+	stringstream res;
+	if (attr.type == Types::Tag::Integer || attr.type == Types::Tag::Numeric) {
+		// compared on the int32_t / int64_t representation; packed columns
+		// evaluate the comparison on their blocks
+		string raw = attr.type == Types::Tag::Integer ? "int32_t" : "int64_t";
+		string values = "reinterpret_cast<const " + raw + "*>(" + rows + ")";
+		vector<pair<Cmp,string>> tests;
+		if (kind == Kind::Between) {
+			tests = {{Cmp::Ge, const_names[0]}, {Cmp::Le, const_names[1]}};
+		} else {
+			tests = {{cmp, const_names[0]}};
+		}
+		for (const auto& test : tests) {
+			res << count << "=";
+			if (attr.compressed && refine) {
+				res << column << ".refine(" << batch << "," << sel << "," << count;
+			} else if (attr.compressed) {
+				res << column << ".select(" << batch << "," << count;
+			} else if (refine) {
+				res << "kernels::refine(" << values << "," << sel << "," << count;
+			} else {
+				res << "kernels::select(" << values << "," << count;
+			}
+			res << "," << kernelCmp(test.first) << ",kernels::raw<" << raw << ">(" << test.second << ")," << sel << ");";
+			refine = true;
+		}
+	} else if (attr.compressed) {
+		// String_Vector: decided on the row headers
+		res << count << "=" << column << (refine ? ".refine_" : ".select_") << (kind == Kind::LikePrefix ? "prefix(" : "equal(") << batch;
+		if (refine) res << "," << sel;
+		res << "," << count;
+		if (kind == Kind::LikePrefix) {
+			res << "," << quote(constants[0]) << "," << constants[0].size();
+		} else {
+			res << "," << const_names[0];
+		}
+		res << "," << sel << ");";
+	} else if (attr.type == Types::Tag::Varchar) {
+		const string& prefix = constants[0];
+		res << count << "=";
+		if (refine) {
+			res << "kernels::refine_prefix_varchar(" << rows << "," << sel << "," << count;
+		} else {
+			res << "kernels::prefix_varchar(" << rows << "," << count;
+		}
+		res << "," << quote(prefix) << "," << prefix.size() << "," << sel << ");";
+	} else {
+		// Char: a prefix, or the whole value for equality
+		string value = kind == Kind::LikePrefix ? quote(constants[0]) : const_names[0] + ".value";
+		size_t len = kind == Kind::LikePrefix ? constants[0].size() : attr.len;
+		res << count << "=";
+		if (refine) {
+			res << "kernels::refine_prefix_char(" << rows << "," << sel << "," << count;
+		} else {
+			res << "kernels::prefix_char(" << rows << "," << count;
+		}
+		res << "," << value << "," << len << "," << sel << ");";
+	}
+	return res.str();
+}
+
 void OperatorPrint::consume(const Operator* caller) {
-	auto TIDs = *input->getTIDs();
-	auto produced = *input->getProduced();
+	const vector<Field_Unit>& produced = *input->getProduced();
 	
 	out << "cout<<";
 	for (size_t i = 0; i < produced.size(); ++i) {
-		// get tid.name
-		auto it = find_if(TIDs.begin(), TIDs.end(), TabPredicate<TID_Unit>(produced[i].tab));
-		assert(it != TIDs.end());
-		
 		out << (i > 0? "\",\"<<": "")
-			<< context->getTabName(produced[i].tab) << "."
-			<< context->getAttr(produced[i].tab, produced[i].attr).name
-			<< "[" << it->name << "]" << "<<";
+			<< input->getFieldExpr(produced[i])
+			<< "<<";
 	}
 	out << "endl;";
 }
 
+string OperatorEmit::declareBatch() {
+	stringstream res;
+	Name_Generator names;
+	names.request_name("count");
+	members.clear();
+	res << "struct " << batch_typename << " {";
+	res << "size_t count;";
+	for (const Field_Unit& t : fields) {
+		const auto& attr = context->getAttr(t.tab, t.attr);
+		members.push_back(names.request_name(attr.name));
+		res << type(attr) << " " << members.back() << "[emit::batch_size];";
+	}
+	res << "};";
+	return res.str();
+}
+
+void OperatorEmit::produce() {
+	assert(members.size() == fields.size());
+	emitter_name = context->requestName("emitter");
+	batch_name = context->requestName("batch");
+	out << "Batch_Emitter<" << batch_typename << "> " << emitter_name << "(" << callback_name << ");";
+	out << batch_typename << "* " << batch_name << "=&" << emitter_name << ".current();";
+	input->produce();
+	out << emitter_name << ".finish();";
+}
+
+void OperatorEmit::consume(const Operator* caller) {
+	for (size_t i = 0; i < fields.size(); ++i) {
+		out << batch_name << "->" << members[i] << "[" << batch_name << "->count]="
+			<< input->getFieldExpr(fields[i]) << ";";
+	}
+	out << "if (++" << batch_name << "->count==emit::batch_size) " 
+		<< batch_name << "=&" << emitter_name << ".flush();";
+}
+
 void OperatorSelect::computeRequired() {
 	required = *consumer->getRequired();
-	auto it = find(required.begin(), required.end(), fc.field);
-	if (it == required.end()) {
-		required.push_back(fc.field);
-	}
+	condition->collectFields(required);
 	OperatorUnary::computeRequired();
 }
 
+void OperatorSelect::produce() {
+	Expr_Ptr declared = condition->declareConstants(context, out);
+	// conjuncts the input can evaluate itself (column kernels in a scan) leave the residual
+	vector<Expr_Ptr> conjuncts;
+	if (declared->kind == Expr::Kind::And) {
+		conjuncts = declared->children;
+	} else {
+		conjuncts = {declared};
+	}
+	stable_sort(conjuncts.begin(), conjuncts.end(), [this](const Expr_Ptr& a, const Expr_Ptr& b) {
+		return a->cost(context) < b->cost(context);
+	});
+	vector<Expr_Ptr> rest;
+	for (const Expr_Ptr& conjunct : conjuncts) {
+		if (!input->pushFilter(conjunct)) rest.push_back(conjunct);
+	}
+	if (rest.size() == conjuncts.size()) {
+		residual = declared;
+	} else if (rest.empty()) {
+		residual = nullptr;
+	} else if (rest.size() == 1) {
+		residual = rest[0];
+	} else {
+		residual = exprAnd(rest);
+	}
+	if (residual && residual->kind == Expr::Kind::And && residual->children.size() > 1) {
+		const auto& conjuncts = residual->children;
+		adaptive_name = context->requestName("selection");
+		string costs_name = adaptive_name + "_cost";
+		out << "const unsigned " << costs_name << "[]={";
+		string delim = "";
+		for (const Expr_Ptr& conjunct : conjuncts) {
+			out << delim << conjunct->cost(context);
+			delim = ",";
+		}
+		out << "};";
+		out << "Adaptive_Conjunction<" << conjuncts.size() << "> " 
+			<< adaptive_name << "(" << costs_name << ");";
+	}
+	input->produce();
+}
+
 void OperatorSelect::consume(const Operator* caller) {
-	auto TIDs = *input->getTIDs();
-	
-	{
-		auto produced = *input->getProduced();
-		auto it = find_if(produced.begin(), produced.end(), TabPredicate<Field_Unit>(fc.field.tab));
-		assert(it != produced.end());
+	if (!residual) {
+		consumer->consume(this);
+		return;
 	}
-	
-	
-	auto it = find_if(TIDs.begin(), TIDs.end(), TabPredicate<TID_Unit>(fc.field.tab));
-	assert(it != TIDs.end());
-	out << "if (" << fc.predicat << "("
-		<< context->getTabName(fc.field.tab) << "."
-		<< context->getAttr(fc.field.tab,fc.field.attr).name
-		<< "[" << it->name << "]"
-		<< ")){";
+	if (adaptive_name.empty()) {
+		out << "if (" << residual->generate(context, input) << "){";
+		consumer->consume(this);
+		out << "}";
+		return;
+	}
+	// sampled tuples evaluate every conjunct and time it, the rest use the current order
+	const auto& conjuncts = residual->children;
+	string pass = adaptive_name + "_pass";
+	out << "bool " << pass << "=true;";
+	out << "if (__builtin_expect(" << adaptive_name << ".sample(),0)){";
+	for (size_t i = 0; i < conjuncts.size(); ++i) {
+		out << "{uint64_t t0=adaptive_clock();"
+			<< "bool r=" << conjuncts[i]->generate(context, input) << ";"
+			<< adaptive_name << ".record(" << i << ",r,t0,adaptive_clock());"
+			<< pass << "&=r;}";
+	}
+	out << "} else {";
+	out << "for (unsigned k=0;" << pass << "&&k<" << conjuncts.size() << ";++k){";
+	out << "switch(" << adaptive_name << ".order[k]){";
+	for (size_t i = 0; i < conjuncts.size(); ++i) {
+		out << "case " << i << ":" << pass << "=" << conjuncts[i]->generate(context, input) << ";break;";
+	}
+	out << "}}}";
+	out << "if (" << pass << "){";
 	consumer->consume(this);
 	out << "}";
 }
@@ -114,7 +680,7 @@ void OperatorProjection::check() {
 		assert(it != fields.end());
 	}
 	// check: fields <= produced by child
-	auto available = *input->getProduced();
+	const vector<Field_Unit>& available = *input->getProduced();
 	for (const Field_Unit& t : fields) {
 		auto it = find(available.cbegin(), available.cend(), t);
 		assert(it != available.end());
@@ -134,65 +700,324 @@ void OperatorHashJoin::produce(){
 	string delim ;
 //	using type_wdc = tuple<Integer,Integer,Integer>;//w_id,d_id,c_id
 //	unordered_map<type_wdc,Tid,hash_types::hash<type_wdc>> customer_wdc;
-	tuple_typename = name_generator.request_name("type_tuple");
-	tuple_tids = name_generator.request_name("type_tids");
-	hash_name = name_generator.request_name("hash");
+	tuple_typename = context->requestName("type_tuple");
+	tuple_tids = context->requestName("type_tids");
+	hash_name = context->requestName("hash");
+	if (kind == Kind::Mark) mark_name = context->requestName("mark");
 	// tuple_typename definition
 	out << "using " << tuple_typename << "=tuple<";
 	delim = "";
-	for (auto t : left_fields) {
+	for (const Field_Unit& t : left_fields) {
 		out << delim << type(context->getAttr(t.tab,t.attr));
 		delim = ",";
 	}
 	out << ">;";
 	// tuple_tids definition
-	out << "using " << tuple_tids << "=tuple<";
+	if (kind == Kind::Inner) {
+		out << "using " << tuple_tids << "=tuple<";
+		delim = "";
+		for (size_t i = 0; i < left->getTIDs()->size(); ++i) {
+			out << delim << "Tid";
+			delim = ",";
+		}
+		out << ">;";
+	}
+	// unordered_multimap definition, a set of the distinct keys unless the join is Inner;
+	// a Join_Hash_Table when probing in groups or per partition of a hybrid table
+	string hash_typename = context->requestName("type_hash");
+	stringstream hash_type;
+	if (group || spilling()) {
+		hash_type << "using " << hash_typename << "=Join_Hash_Table<" 
+		<< tuple_typename 
+		<< "," << (kind == Kind::Inner ? tuple_tids : "tuple<>") 
+		<< "," << "hash_types::hash<" << tuple_typename << ">" 
+		<< "," << "equal_to<" << tuple_typename << ">>;";
+	} else if (kind == Kind::Inner) {
+		hash_type << "using " << hash_typename << "=unordered_multimap<" 
+		<< tuple_typename 
+		<< "," << tuple_tids 
+		<< "," << "hash_types::hash<" << tuple_typename << ">" 
+		<< "," << "equal_to<" << tuple_typename << ">"
+		<< "," << "Column_Allocator<pair<const " << tuple_typename << "," << tuple_tids << ">>>;";
+	} else {
+		hash_type << "using " << hash_typename << "=unordered_set<" 
+		<< tuple_typename 
+		<< "," << "hash_types::hash<" << tuple_typename << ">" 
+		<< "," << "equal_to<" << tuple_typename << ">"
+		<< "," << "Column_Allocator<" << tuple_typename << ">>;";
+	}
+	out << hash_type.str();
+	if (!cached) {
+		size_t key = partitionKey();
+		if (key < left_fields.size()) {
+			producePartitions(hash_typename, key);
+			return;
+		}
+		produceJoin(hash_typename);
+		return;
+	}
+	// the build side is generated aside: its code identifies the cached table
+	string before = out.str();
+	out.str(string());
+	left->produce();
+	string build = out.str();
+	out.str(before);
+	out.seekp(0, ios::end);
+	string key = fingerprint(hash_type.str() + build);
+	string versions = hash_name + "_versions";
+	string ptr = hash_name + "_cached";
+	// every table read by the build side, also those whose tids are not unpacked
+	vector<size_t> tabs;
+	left->collectTables(tabs);
+	vector<string> tables;
+	for (size_t tab : tabs) {
+		const string& name = context->getTabName(tab);
+		if (find(tables.begin(), tables.end(), name) == tables.end()) tables.push_back(name);
+	}
+	out << "const vector<uint64_t> " << versions << "={";
 	delim = "";
-	for (auto t : *left->getTIDs()) {
-		out << delim << "Tid";
+	for (const string& name : tables) {
+		out << delim << name << ".version";
 		delim = ",";
 	}
-	out << ">;";
-	// unordered_multimap definition	
-	out << "unordered_multimap<" 
-	<< tuple_typename 
-	<< "," << tuple_tids 
-	<< "," << "hash_types::hash<" << tuple_typename << ">> " 
-	<< hash_name << ";";
-	
+	out << "};";
+	out << "shared_ptr<" << hash_typename << "> " << ptr << "=join_cache().get<" << hash_typename << ">(\"" << key << "\"," << versions << ");";
+	out << "if (!" << ptr << "){";
+	out << ptr << "=make_shared<" << hash_typename << ">();";
+	out << hash_typename << "& " << hash_name << "=*" << ptr << ";";
+	out << build;
+	out << "join_cache().put(\"" << key << "\"," << versions << "," << ptr << ",hash_table_bytes(" << hash_name << "));";
+	out << "}";
+	out << hash_typename << "& " << hash_name << "=*" << ptr << ";";
+	produceProbe();
+}
+
+// position of a join key pairing the partitioning attributes of partitioned
+// tables on both sides, left_fields.size() if the join is not partition-wise
+size_t OperatorHashJoin::partitionKey() const {
+	if (!partition_wise) return left_fields.size();
+	for (size_t k = 0; k < left_fields.size(); ++k) {
+		const Field_Unit& l = left_fields[k];
+		const Field_Unit& r = right_fields[k];
+		const Schema::Relation& left_def = context->getTabDef(l.tab);
+		const Schema::Relation& right_def = context->getTabDef(r.tab);
+		if (!left_def.partitioned || left_def.partitionAttribute != l.attr) continue;
+		if (!right_def.partitioned || right_def.partitionAttribute != r.attr) continue;
+		// an enclosing partition-wise join restricts the scans already
+		if (!context->getPartitionExpr(l.tab).empty() || !context->getPartitionExpr(r.tab).empty()) continue;
+		return k;
+	}
+	return left_fields.size();
+}
+
+// one build and probe per partition of the right table: its scan and that of the
+// left table are restricted to the partitions of the same key, every partition
+// has a hash table of its own
+void OperatorHashJoin::producePartitions(const string& hash_typename, size_t key) {
+	const string& left_tab = context->getTabName(left_fields[key].tab);
+	const string& right_tab = context->getTabName(right_fields[key].tab);
+	string p = hash_name + "_p";
+	context->setPartitionExpr(right_fields[key].tab, "&" + right_tab + ".partitions[" + p + "]");
+	context->setPartitionExpr(left_fields[key].tab, left_tab + ".partitions.find(" + right_tab + ".partitions.keys[" + p + "])");
+	if (parallel) {
+		lock_name = hash_name + "_lock";
+		out << "mutex " << lock_name << ";";
+		out << "partition::parallel_for(" << right_tab << ".partitions.size(),[&](size_t " << p << "){";
+	} else {
+		out << "for (size_t " << p << "=0;" << p << "<" << right_tab << ".partitions.size();++" << p << "){";
+	}
+	produceJoin(hash_typename);
+	out << (parallel ? "});" : "}");
+	lock_name.clear();
+	context->setPartitionExpr(right_fields[key].tab, string());
+	context->setPartitionExpr(left_fields[key].tab, string());
+}
+
+// declares the table, builds it from left and probes it with right
+void OperatorHashJoin::produceJoin(const string& hash_typename) {
+	if (spilling()) {
+		produceSpill(hash_typename);
+		return;
+	}
+	out << hash_typename << " " << hash_name << ";";
 	left->produce();
+	produceProbe();
+}
+
+// the joined tuple to the consumer, one thread at a time while partitions are joined in parallel
+void OperatorHashJoin::handOver() {
+	if (lock_name.empty()) {
+		consumer->consume(this);
+		return;
+	}
+	out << "{lock_guard<mutex> " << lock_name << "_guard(" << lock_name << ");";
+	consumer->consume(this);
+	out << "}";
+}
+
+// true if code contains the identifier name
+static bool mentions(const string& code, const string& name) {
+	auto identifier = [](char c) {return isalnum((unsigned char)c) || c == '_';};
+	for (size_t at = code.find(name); at != string::npos; at = code.find(name, at + 1)) {
+		if (at > 0 && identifier(code[at - 1])) continue;
+		if (at + name.size() < code.size() && identifier(code[at + name.size()])) continue;
+		return true;
+	}
+	return false;
+}
+
+// the matches of a buffered right tuple record; its tids are restored for
+// those the pipeline above reads, the others only went through copied fields
+void OperatorHashJoin::produceRecordMatches(const string& record, const string& table, const string& entry) {
+	string before = out.str();
+	out.str(string());
+	produceMatches(table, entry, record + ".hash", record + ".key");
+	string matches = out.str();
+	out.str(before);
+	out.seekp(0, ios::end);
+	for (const TID_Unit& t : *right->getTIDs()) {
+		if (mentions(matches, t.name)) out << "Tid " << t.name << "=" << record << "." << t.name << ";";
+	}
+	out << matches;
+}
+
+void OperatorHashJoin::produceProbe() {
+	if (!group) {
+		right->produce();
+		return;
+	}
+	string group_type = context->requestName("type_probe");
+	group_name = context->requestName("probe");
+	string size = group_name + "_size", i = group_name + "_i";
+	// the probe pipeline is generated aside: its consume() decides which fields are copied
+	probe_fields.clear();
+	string before = out.str();
+	out.str(string());
+	right->produce();
+	string probe = out.str();
+	out.str(before);
+	out.seekp(0, ios::end);
+	out << "struct " << group_type << "{uint64_t hash;size_t entry;" << tuple_typename << " key;";
+	for (const TID_Unit& t : *right->getTIDs()) {
+		out << "Tid " << t.name << ";";
+	}
+	for (size_t f = 0; f < probe_fields.size(); ++f) {
+		out << type(context->getAttr(probe_fields[f].tab, probe_fields[f].attr)) << " f" << f << ";";
+	}
+	out << "};";
+	out << group_type << " " << group_name << "[" << group << "];size_t " << size << "=0;";
+	// second pass: the buckets prefetched while buffering give the chains, prefetched in turn;
+	// third pass: the keys are compared
+	out << "auto " << group_name << "_resolve=[&](){";
+	out << "for (size_t " << i << "=0;" << i << "<" << size << ";++" << i << ") "
+		<< group_name << "[" << i << "].entry=" << hash_name << ".head(" << group_name << "[" << i << "].hash);";
+	out << "for (size_t " << i << "=0;" << i << "<" << size << ";++" << i << "){";
+	probe_name = group_name + "_p";
+	out << "const " << group_type << "& " << probe_name << "=" << group_name << "[" << i << "];";
+	produceRecordMatches(probe_name, hash_name, probe_name + ".entry");
+	probe_name.clear();
+	out << "}" << size << "=0;};";
+	out << probe;
+	out << group_name << "_resolve();";
+}
+
+// the matches of key in table, looked up from entry, the head of the chain of hash
+void OperatorHashJoin::produceMatches(const string& table, const string& entry, const string& hash, const string& key) {
+	string lookup = hash + "," + key;
+	string found = table + ".find(" + entry + "," + lookup + ")";
+	switch (kind) {
+		case Kind::Inner: {
+			string e = table + "_e";
+			out << "for (size_t " << e << "=" << found << ";" << e << "!=" << table << ".end();"
+				<< e << "=" << table << ".next(" << e << "," << lookup << ")){";
+			const vector<TID_Unit>& TIDs_left = *left->getTIDs();
+			for (size_t t = 0; t < TIDs_left.size(); ++t) {
+				if (!unpacks(TIDs_left[t])) continue;
+				out << "auto " << TIDs_left[t].name 
+					<< "= get<" << t << ">(" << table << ".value(" << e << "));";
+			}
+			handOver();
+			out << "}";
+			break;
+		}
+		case Kind::Semi:
+		case Kind::Anti:
+			out << "if (" << found << (kind == Kind::Semi ? "!=" : "==") << table << ".end()){";
+			handOver();
+			out << "}";
+			break;
+		case Kind::Mark:
+			out << "{const bool " << mark_name << "=" << found << "!=" << table << ".end();";
+			handOver();
+			out << "}";
+			break;
+	}
+}
+
+// the hybrid table: built from left, probed by right with the tuples of spilled
+// partitions recorded, then the spilled partitions are joined one by one
+void OperatorHashJoin::produceSpill(const string& hash_typename) {
+	spill_typename = context->requestName("type_spill");
+	spill_name = context->requestName("spill");
+	// the probe pipeline is generated aside: its consume() decides which fields are recorded
+	probe_fields.clear();
+	string before = out.str();
+	out.str(string());
 	right->produce();
+	string probe = out.str();
+	out.str(before);
+	out.seekp(0, ios::end);
+	out << "struct " << spill_typename << "{uint64_t hash;" << tuple_typename << " key;";
+	for (const TID_Unit& t : *right->getTIDs()) {
+		out << "Tid " << t.name << ";";
+	}
+	for (size_t f = 0; f < probe_fields.size(); ++f) {
+		out << type(context->getAttr(probe_fields[f].tab, probe_fields[f].attr)) << " f" << f << ";";
+	}
+	out << "};";
+	out << "spill::Hybrid_Hash_Table<" << hash_typename << "," << spill_typename << "> " << hash_name << "(" << budget << "ull);";
+	left->produce();
+	out << probe;
+	string table = spill_name + "_t";
+	out << hash_name << ".join_spilled([&](const " << hash_typename << "& " << table << ",const " << spill_typename << "& " << spill_name << "){";
+	probe_name = spill_name;
+	produceRecordMatches(spill_name, table, table + ".head(" + spill_name + ".hash)");
+	probe_name.clear();
+	out << "});";
 }
 
 void OperatorHashJoin::computeRequired() {
 	required = *consumer->getRequired();
-	for (const Field_Unit& t : left_fields) {
-		auto it = find(required.cbegin(), required.cend(), t);
-		if (it == required.end()) required.push_back(t);
-	}
-	for (const Field_Unit& t : right_fields) {
-		auto it = find(required.cbegin(), required.cend(), t);
-		if (it == required.end()) required.push_back(t);
-	}
+	context->mergeFields(required, left_fields);
+	context->mergeFields(required, right_fields);
 	OperatorBinary::computeRequired();
 }
 
 void OperatorHashJoin::computeProduced() {
 	OperatorBinary::computeProduced();
-	produced = *left->getProduced();
-	
-	for (const Field_Unit& t : *right->getProduced()) {
-		auto it = find(produced.cbegin(), produced.cend(), t);
-		if (it == produced.end()) produced.push_back(t);
+	if (kind != Kind::Inner) {
+		produced = *right->getProduced();
+		return;
 	}
+	produced = *left->getProduced();
+	context->mergeFields(produced, *right->getProduced());
 }
 
 void OperatorHashJoin::computeTIDs() {
 	OperatorBinary::computeTIDs();
-	TIDs = *left->getTIDs();
-	for (auto t : *right->getTIDs()) {
-		TIDs.push_back(t);
+	TIDs.clear();
+	if (kind == Kind::Inner) {
+		// the hash table keeps all left tids, matches only unpack those of tables read above
+		const vector<Field_Unit>& above = *consumer->getRequired();
+		for (const TID_Unit& t : *left->getTIDs()) {
+			if (find_if(above.begin(), above.end(), TabPredicate<Field_Unit>(t.tab)) != above.end()) TIDs.push_back(t);
+		}
 	}
+	TIDs.insert(TIDs.end(), right->getTIDs()->begin(), right->getTIDs()->end());
+}
+
+bool OperatorHashJoin::unpacks(const TID_Unit& tid) const {
+	return find_if(TIDs.begin(), TIDs.end(), [&tid](const TID_Unit& t) {return t.name == tid.name;}) != TIDs.end();
 }
 
 void OperatorHashJoin::consume(const Operator* caller){
@@ -201,52 +1026,1057 @@ void OperatorHashJoin::consume(const Operator* caller){
 		//auto t = make_tuple(customer.c_w_id[tid1], customer.c_d_id[tid1], customer.c_id[tid2]);
 		out << "auto t = make_tuple(";
 		delim = "";
-		auto TIDs_left = *left->getTIDs();
-		for (auto t : left_fields) {
-			auto it = find_if(TIDs_left.begin(), TIDs_left.end(), TabPredicate<TID_Unit>(t.tab));
-			assert(it != TIDs_left.end());
-			out << delim 
-				<< context->getTabName(t.tab) 
-				<< "." << context->getAttr(t.tab,t.attr).name
-				<< "[" << it->name << "]";
+		const vector<TID_Unit>& TIDs_left = *left->getTIDs();
+		for (const Field_Unit& t : left_fields) {
+			out << delim << left->getFieldExpr(t);
 			delim = ",";
 		}
 		out << ");";
+		if (kind != Kind::Inner) {
+			out << hash_name << (group || spilling() ? ".insert_unique(t,tuple<>());" : ".insert(t);");
+			return;
+		}
 		//auto t_tids = make_tuple(tid1,tid2);
 		out << "auto t_tids = make_tuple(";
 		delim = "";
-		for (auto t : TIDs_left) {
+		for (const TID_Unit& t : TIDs_left) {
 			out << delim << t.name;
 			delim = ",";
 		}
 		out << ");";
 		//customer_wdc.insert(make_pair(t,t_tids));
-		out << hash_name << ".insert(make_pair(t,t_tids));";
+		out << hash_name << (group || spilling() ? ".insert(t,t_tids);" : ".insert(make_pair(t,t_tids));");
+	} else if (spilling()) {
+		consumeSpill();
+	} else if (group) {
+		consumeGroup();
 	} else {
 		//auto t = make_tuple(order.o_w_id[tid], order.o_d_id[tid], order.o_c_id[tid]);
 		out << "auto t = make_tuple(";
 		delim = "";
-		auto TIDs_right = *right->getTIDs();
-		for (auto t : right_fields) {
-			auto it = find_if(TIDs_right.begin(), TIDs_right.end(), TabPredicate<TID_Unit>(t.tab));
-			assert(it != TIDs_right.end());
-			out << delim 
-				<< context->getTabName(t.tab) 
-				<< "." << context->getAttr(t.tab,t.attr).name
-				<< "[" << it->name << "]";
+		for (const Field_Unit& t : right_fields) {
+			out << delim << right->getFieldExpr(t);
 			delim = ",";
 		}
 		out << ");";
+		// one lookup per probe tuple, however many left tuples share the key
+		switch (kind) {
+			case Kind::Semi:
+			case Kind::Anti:
+				out << "if (" << hash_name << ".find(t)" << (kind == Kind::Semi ? "!=" : "==") << hash_name << ".end()){";
+				handOver();
+				out << "}";
+				return;
+			case Kind::Mark:
+				out << "{const bool " << mark_name << "=" << hash_name << ".find(t)!=" << hash_name << ".end();";
+				handOver();
+				out << "}";
+				return;
+			case Kind::Inner:
+				break;
+		}
 		//auto it = customer_wdc.find(t);
 		out << "for(auto it = " << hash_name << ".equal_range(t);"
 			<< "it.first != it.second;"
 			<< "++it.first) {";
-		auto TIDs_left = *left->getTIDs();
+		const vector<TID_Unit>& TIDs_left = *left->getTIDs();
 		for (size_t i = 0; i < TIDs_left.size(); ++i) {
+			if (!unpacks(TIDs_left[i])) continue;
 			out << "auto " << TIDs_left[i].name 
 				<< "= get<" << i << ">(it.first->second);";
 		}
-		consumer->consume(this);
+		handOver();
 		out << "}";
 	}
-}
\ No newline at end of file
+}
+// buffers the right tuple and prefetches its bucket; a full group is resolved
+void OperatorHashJoin::consumeGroup() {
+	string probe = group_name + "_q", size = group_name + "_size";
+	out << "{auto& " << probe << "=" << group_name << "[" << size << "];";
+	out << probe << ".key=make_tuple(";
+	string delim = "";
+	for (const Field_Unit& t : right_fields) {
+		out << delim << right->getFieldExpr(t);
+		delim = ",";
+	}
+	out << ");";
+	out << probe << ".hash=" << hash_name << ".hash(" << probe << ".key);";
+	out << hash_name << ".prefetch(" << probe << ".hash);";
+	for (const TID_Unit& t : *right->getTIDs()) {
+		out << probe << "." << t.name << "=" << t.name << ";";
+	}
+	copyProbeFields(probe);
+	out << "if (++" << size << "==" << group << ") " << group_name << "_resolve();}";
+}
+
+// looks the right tuple up if its partition is resident, records it for join_spilled() otherwise
+void OperatorHashJoin::consumeSpill() {
+	string table = spill_name + "_t";
+	out << "{" << spill_typename << " " << spill_name << ";";
+	out << spill_name << ".key=make_tuple(";
+	string delim = "";
+	for (const Field_Unit& t : right_fields) {
+		out << delim << right->getFieldExpr(t);
+		delim = ",";
+	}
+	out << ");";
+	out << spill_name << ".hash=" << hash_name << ".hash(" << spill_name << ".key);";
+	out << "if (auto " << spill_name << "_p=" << hash_name << ".resident(" << spill_name << ".hash)){";
+	out << "const auto& " << table << "=*" << spill_name << "_p;";
+	produceMatches(table, table + ".head(" + spill_name + ".hash)", spill_name + ".hash", spill_name + ".key");
+	out << "}else{";
+	for (const TID_Unit& t : *right->getTIDs()) {
+		out << spill_name << "." << t.name << "=" << t.name << ";";
+	}
+	copyProbeFields(spill_name);
+	out << hash_name << ".spill(" << spill_name << ");}}";
+}
+
+// fields not readable through the tids later on, e.g. decoded into a scan buffer
+void OperatorHashJoin::copyProbeFields(const string& record) {
+	const vector<Field_Unit>& produced_right = *right->getProduced();
+	for (const Field_Unit& t : *consumer->getRequired()) {
+		if (find(produced_right.cbegin(), produced_right.cend(), t) == produced_right.end()) continue;
+		string expr = right->getFieldExpr(t);
+		if (expr == tidFieldExpr(context, t)) continue;
+		out << record << ".f" << probe_fields.size() << "=" << expr << ";";
+		probe_fields.push_back(t);
+	}
+}
+
+string OperatorHashJoin::getFieldExpr(const Field_Unit& field) const {
+	if (!probe_name.empty()) {
+		auto it = find(probe_fields.cbegin(), probe_fields.cend(), field);
+		if (it != probe_fields.end()) return probe_name + ".f" + to_string(distance(probe_fields.cbegin(), it));
+	}
+	return Operator::getFieldExpr(field);
+}
+
+void OperatorSort::computeRequired() {
+	required = *consumer->getRequired();
+	for (const Sort_Key& key : keys) {
+		auto it = find(required.cbegin(), required.cend(), key.field);
+		if (it == required.end()) required.push_back(key.field);
+	}
+	// rows hold only what is read above the sort and the keys
+	const vector<Field_Unit>& produced_input = *input->getProduced();
+	members.clear();
+	for (const Field_Unit& t : required) {
+		if (find(produced_input.cbegin(), produced_input.cend(), t) != produced_input.end()) members.push_back(t);
+	}
+	// the consumer can only bind what a row holds
+	produced = members;
+	OperatorUnary::computeRequired();
+}
+
+void OperatorSort::computeProduced() {
+	OperatorUnary::computeProduced();
+	produced = *input->getProduced();
+}
+
+size_t OperatorSort::rowMember(const Field_Unit& field) const {
+	auto it = find(members.cbegin(), members.cend(), field);
+	assert(it != members.end());
+	return distance(members.cbegin(), it);
+}
+
+string OperatorSort::getFieldExpr(const Field_Unit& field) const {
+	return row_name + ".f" + to_string(rowMember(field));
+}
+
+void OperatorSort::declareRow() {
+	row_typename = context->requestName("type_row");
+	cmp_typename = context->requestName("type_row_cmp");
+	row_name = context->requestName("row");
+	//struct type_row {Varchar<16> f0;Numeric<6,2> f1;};
+	out << "struct " << row_typename << "{";
+	for (size_t i = 0; i < members.size(); ++i) {
+		out << type(context->getAttr(members[i].tab, members[i].attr)) << " f" << i << ";";
+	}
+	out << "};";
+	// lexicographic comparator over the keys
+	out << "struct " << cmp_typename << "{"
+		<< "bool operator()(const " << row_typename << "& a,const " << row_typename << "& b) const {";
+	for (const Sort_Key& key : keys) {
+		string member = ".f" + to_string(rowMember(key.field));
+		string lhs = (key.descending ? "b" : "a") + member;
+		string rhs = (key.descending ? "a" : "b") + member;
+		out << "if (" << lhs << "<" << rhs << ") return true;"
+			<< "if (" << rhs << "<" << lhs << ") return false;";
+	}
+	out << "return false;}};";
+}
+
+string OperatorSort::makeRow() const {
+	stringstream res;
+	string delim = "";
+	res << row_typename << "{";
+	for (const Field_Unit& t : members) {
+		res << delim << input->getFieldExpr(t);
+		delim = ",";
+	}
+	res << "}";
+	return res.str();
+}
+
+void OperatorSort::produce() {
+	declareRow();
+	rows_name = context->requestName("rows");
+	out << "vector<" << row_typename << ",Column_Allocator<" << row_typename << ">> " << rows_name << ";";
+	input->produce();
+	out << "parallel_sort(" << rows_name << "," << cmp_typename << "());";
+	out << "for (const " << row_typename << "& " << row_name << " : " << rows_name << "){";
+	consumer->consume(this);
+	out << "}";
+}
+
+void OperatorSort::consume(const Operator* caller) {
+	out << rows_name << ".push_back(" << makeRow() << ");";
+}
+
+void OperatorTopK::produce() {
+	assert(limit > 0);
+	declareRow();
+	rows_name = context->requestName("top_k");
+	out << "Top_K<" << row_typename << "," << cmp_typename << ",Column_Allocator<" << row_typename << ">> " << rows_name << "(" << limit << ");";
+	input->produce();
+	out << "for (const " << row_typename << "& " << row_name << " : " << rows_name << ".finish()){";
+	consumer->consume(this);
+	out << "}";
+}
+
+void OperatorTopK::consume(const Operator* caller) {
+	// key of the current tuple < key of the worst kept row, without building a row
+	string less = "false";
+	for (auto it = keys.rbegin(); it != keys.rend(); ++it) {
+		string current = input->getFieldExpr(it->field);
+		string worst = rows_name + ".top().f" + to_string(rowMember(it->field));
+		string lhs = it->descending ? worst : current;
+		string rhs = it->descending ? current : worst;
+		less = "(" + lhs + "<" + rhs + "||(!(" + rhs + "<" + lhs + ")&&" + less + "))";
+	}
+	out << "if (!" << rows_name << ".full()||" << less << "){"
+		<< rows_name << ".push(" << makeRow() << ");"
+		<< "}";
+}
+
+void OperatorExchange::computeRequired() {
+	required = *consumer->getRequired();
+	OperatorUnary::computeRequired();
+}
+
+void OperatorExchange::computeProduced() {
+	OperatorUnary::computeProduced();
+	produced = *input->getProduced();
+}
+
+string OperatorExchange::getFieldExpr(const Field_Unit& field) const {
+	auto it = find(produced.cbegin(), produced.cend(), field);
+	assert(it != produced.end());
+	return row_name + ".f" + to_string(distance(produced.cbegin(), it));
+}
+
+void OperatorExchange::produce() {
+	assert(!cluster_name.empty());
+	row_typename = context->requestName("type_exchange_row");
+	row_name = context->requestName("row");
+	sender_name = context->requestName("sender");
+	out << "struct " << row_typename << "{";
+	for (size_t i = 0; i < produced.size(); ++i) {
+		out << type(context->getAttr(produced[i].tab, produced[i].attr)) << " f" << i << ";";
+	}
+	out << "};";
+	// the workers' part as a function pointer, the coordinator's as a callback
+	out << cluster_name << ".gather<" << row_typename << ">(+[](exchange::Sender<" << row_typename << ">& " << sender_name << "){";
+	input->produce();
+	out << "},[&](const " << row_typename << "& " << row_name << "){";
+	consumer->consume(this);
+	out << "});";
+}
+
+void OperatorExchange::consume(const Operator* caller) {
+	out << sender_name << ".push(" << row_typename << "{";
+	string delim = "";
+	for (const Field_Unit& t : produced) {
+		out << delim << input->getFieldExpr(t);
+		delim = ",";
+	}
+	out << "});";
+}
+
+void OperatorRow::assignRow(size_t tab, const string& tid_name) {
+	const Schema::Relation& def = context->getTabDef(tab);
+	produced.clear();
+	for (size_t i = 0; i < def.attributes.size(); ++i) {
+		produced.push_back({tab, i});
+	}
+	TIDs.assign(1, {tid_name, tab});
+	context->setTidName(tab, tid_name);
+}
+
+void Incremental_View::setChain(const vector<size_t>& tabs, const vector<View_Join>& joins) {
+	assert(joins.size() + 1 == tabs.size());
+	for (size_t i = 0; i < joins.size(); ++i) {
+		assert(joins[i].left.size() == joins[i].right.size());
+		assert(all_of(joins[i].left.begin(), joins[i].left.end(), [&](const Field_Unit& t) {return t.tab == tabs[i];}));
+		assert(all_of(joins[i].right.begin(), joins[i].right.end(), [&](const Field_Unit& t) {return t.tab == tabs[i+1];}));
+	}
+	this->tabs = tabs;
+	this->joins = joins;
+	filters.assign(tabs.size(), nullptr);
+}
+
+void Incremental_View::setFilter(size_t tab, const Expr_Ptr& filter) {
+	filters[position(tab)] = filter;
+}
+
+size_t Incremental_View::position(size_t tab) const {
+	auto it = find(tabs.begin(), tabs.end(), tab);
+	assert(it != tabs.end());
+	return it - tabs.begin();
+}
+
+string Incremental_View::rowField(size_t pos, const string& row, const Field_Unit& field) const {
+	auto it = find(rows[pos].begin(), rows[pos].end(), field);
+	assert(it != rows[pos].end());
+	return "get<" + to_string(it - rows[pos].begin()) + ">(" + row + ")";
+}
+
+string Incremental_View::rowKey(size_t pos, const string& row, const vector<Field_Unit>& key) const {
+	string res = "make_tuple(";
+	string delim = "";
+	for (const Field_Unit& t : key) {
+		res += delim + rowField(pos, row, t);
+		delim = ",";
+	}
+	return res + ")";
+}
+
+void Incremental_View::generate(const string& name) {
+	// per table: the result fields and both join keys
+	rows.assign(tabs.size(), vector<Field_Unit>());
+	for (size_t pos = 0; pos < tabs.size(); ++pos) {
+		vector<Field_Unit> needed;
+		for (const Field_Unit& t : fields) {
+			if (t.tab == tabs[pos]) needed.push_back(t);
+		}
+		if (pos > 0) needed.insert(needed.end(), joins[pos-1].right.begin(), joins[pos-1].right.end());
+		if (pos + 1 < tabs.size()) needed.insert(needed.end(), joins[pos].left.begin(), joins[pos].left.end());
+		context->mergeFields(rows[pos], needed);
+	}
+	auto tupleOf = [this](const vector<Field_Unit>& fields) {
+		string res = "tuple<";
+		string delim = "";
+		for (const Field_Unit& t : fields) {
+			res += delim + type(context->getAttr(t.tab, t.attr));
+			delim = ",";
+		}
+		return res + ">";
+	};
+	auto multimapOf = [](const string& key, const string& value) {
+		return "unordered_multimap<" + key + "," + value + ",hash_types::hash<" + key + ">,equal_to<" + key + ">,"
+			+ "Column_Allocator<pair<const " + key + "," + value + ">>>";
+	};
+	out << "struct " << name << " {";
+	for (size_t pos = 0; pos < tabs.size(); ++pos) {
+		out << "using row" << pos << "=" << tupleOf(rows[pos]) << ";";
+	}
+	for (size_t i = 0; i < joins.size(); ++i) {
+		out << "using key" << i << "=" << tupleOf(joins[i].left) << ";";
+	}
+	// prev<i>: rows of tabs[i] by key<i-1>, next<i>: by key<i>
+	for (size_t pos = 0; pos < tabs.size(); ++pos) {
+		string row = "row" + to_string(pos);
+		if (pos > 0) out << multimapOf("key" + to_string(pos-1), row) << " prev" << pos << ";";
+		if (pos + 1 < tabs.size()) out << multimapOf("key" + to_string(pos), row) << " next" << pos << ";";
+	}
+	out << "using result_type=" << tupleOf(fields) << ";";
+	out << "unordered_map<result_type,long,hash_types::hash<result_type>,equal_to<result_type>,"
+		<< "Column_Allocator<pair<const result_type,long>>> result;";
+	vector<Expr_Ptr> declared(filters.size());
+	for (size_t pos = 0; pos < filters.size(); ++pos) {
+		if (filters[pos]) declared[pos] = filters[pos]->declareConstants(context, out);
+	}
+	swap(filters, declared);
+	for (size_t pos = 0; pos < tabs.size(); ++pos) {
+		generateDelta(pos);
+	}
+	swap(filters, declared);
+	// computes the view from the current tables and follows their changes from then on;
+	// the view must outlive the tables' on_change hooks
+	out << "void attach(){";
+	for (size_t tab : tabs) {
+		const string& tab_name = context->getTabName(tab);
+		if (context->getTabDef(tab).partitioned) {
+			out << "for (size_t p=0;p<" << tab_name << ".partitions.size();++p){auto& part=" << tab_name << ".partitions[p];"
+				<< "for (Tid row=0;row<part.size();++row) if (!part.tombstones.test(row)) delta_" << tab_name << "(part.base+row,1);}";
+		} else {
+			out << "for (Tid tid=0;tid<" << tab_name << ".size();++tid) if (!" << tab_name << ".tombstones.test(tid)) delta_" << tab_name << "(tid,1);";
+		}
+	}
+	for (size_t tab : tabs) {
+		const string& tab_name = context->getTabName(tab);
+		out << tab_name << ".on_change.push_back([this](Tid tid,long sign){delta_" << tab_name << "(tid,sign);});";
+	}
+	out << "}";
+	out << "};" << endl;
+}
+
+// joins one changed row of tabs[pos] with the state of the other tables,
+// walking the chain outwards, then adds it to or removes it from the state
+void Incremental_View::generateDelta(size_t pos) {
+	size_t tab = tabs[pos];
+	OperatorRow row(context, out);
+	row.assignRow(tab, "tid");
+	out << "void delta_" << context->getTabName(tab) << "(Tid tid,long sign){";
+	if (filters[pos]) {
+		out << "if (!" << filters[pos]->generate(context, &row) << ") return;";
+	}
+	out << "row" << pos << " row=make_tuple(";
+	string delim = "";
+	for (const Field_Unit& t : rows[pos]) {
+		out << delim << row.getFieldExpr(t);
+		delim = ",";
+	}
+	out << ");";
+	vector<string> row_names(tabs.size());
+	row_names[pos] = "row";
+	size_t loops = 0;
+	auto loop = [&](size_t other, const string& state, const string& key) {
+		string i = to_string(other);
+		out << "auto range" << i << "=" << state << ".equal_range(" << key << ");";
+		out << "for (auto it" << i << "=range" << i << ".first;it" << i << "!=range" << i << ".second;++it" << i << "){";
+		out << "const row" << i << "& r" << i << "=it" << i << "->second;";
+		row_names[other] = "r" + i;
+		++loops;
+	};
+	for (size_t other = pos; other-- > 0; ) {
+		loop(other, "next" + to_string(other), rowKey(other+1, row_names[other+1], joins[other].right));
+	}
+	for (size_t other = pos + 1; other < tabs.size(); ++other) {
+		loop(other, "prev" + to_string(other), rowKey(other-1, row_names[other-1], joins[other-1].left));
+	}
+	out << "auto res=result.emplace(make_tuple(";
+	delim = "";
+	for (const Field_Unit& t : fields) {
+		size_t p = position(t.tab);
+		out << delim << rowField(p, row_names[p], t);
+		delim = ",";
+	}
+	out << "),0).first;";
+	out << "res->second+=sign;if (res->second==0) result.erase(res);";
+	for (size_t i = 0; i < loops; ++i) out << "}";
+	// state of this table
+	vector<pair<string,string>> states;// name, key
+	if (pos > 0) states.push_back({"prev" + to_string(pos), rowKey(pos, "row", joins[pos-1].right)});
+	if (pos + 1 < tabs.size()) states.push_back({"next" + to_string(pos), rowKey(pos, "row", joins[pos].left)});
+	out << "if (sign>0){";
+	for (const auto& state : states) {
+		out << state.first << ".emplace(" << state.second << ",row);";
+	}
+	out << "} else {";
+	for (const auto& state : states) {
+		out << "{auto range=" << state.first << ".equal_range(" << state.second << ");"
+			<< "for (auto it=range.first;it!=range.second;++it) if (it->second==row){" << state.first << ".erase(it);break;}}";
+	}
+	out << "}";
+	out << "}";
+}
+
+Proc_Value_Ptr procVar(const string& name) {
+	auto res = make_shared<Proc_Value>(Proc_Value::Kind::Var);
+	res->name = name;
+	return res;
+}
+
+Proc_Value_Ptr procField(size_t row, size_t attr) {
+	auto res = make_shared<Proc_Value>(Proc_Value::Kind::Field);
+	res->row = row;
+	res->attr = attr;
+	return res;
+}
+
+Proc_Value_Ptr procConstant(const string& text) {
+	auto res = make_shared<Proc_Value>(Proc_Value::Kind::Constant);
+	res->name = text;
+	return res;
+}
+
+Proc_Value_Ptr procPosition() {
+	return make_shared<Proc_Value>(Proc_Value::Kind::Position);
+}
+
+Proc_Value_Ptr procAdd(const Proc_Value_Ptr& left, const Proc_Value_Ptr& right) {
+	auto res = make_shared<Proc_Value>(Proc_Value::Kind::Add);
+	res->children = {left, right};
+	return res;
+}
+
+Proc_Value_Ptr procSub(const Proc_Value_Ptr& left, const Proc_Value_Ptr& right) {
+	auto res = make_shared<Proc_Value>(Proc_Value::Kind::Sub);
+	res->children = {left, right};
+	return res;
+}
+
+Proc_Value_Ptr procMul(const Proc_Value_Ptr& left, const Proc_Value_Ptr& right) {
+	auto res = make_shared<Proc_Value>(Proc_Value::Kind::Mul);
+	res->children = {left, right};
+	return res;
+}
+
+// digits after the point of Integer (0) and Numeric<len,precision>
+static unsigned precision(const string& type) {
+	if (type == "Integer") return 0;
+	if (type.compare(0, 8, "Numeric<") != 0) throw ProcedureError("no arithmetic on " + type);
+	return stoul(type.substr(type.find(',') + 1, type.size() - type.find(',') - 2));
+}
+
+void Procedure::addParam(const string& name, const Field_Unit& like, bool array) {
+	if (!statements.empty()) throw ProcedureError("parameter " + name + " after the first statement");
+	params.push_back({name, type(context->getAttr(like.tab, like.attr)), array});
+	vars.push_back(params.back());
+}
+
+size_t Procedure::lookup(size_t tab, size_t index, const vector<Proc_Value_Ptr>& key) {
+	const Schema::Relation& def = context->getTabDef(tab);
+	if (index >= def.indices.size()) throw ProcedureError("lookup in " + def.name + ": no index " + to_string(index));
+	if (key.size() != def.indices[index].fields.size()) throw ProcedureError("lookup in " + def.name + ": key of " + to_string(key.size()) + " values for index " + def.indices[index].name);
+	string sig;
+	for (const Proc_Value_Ptr& value : key) sig += signature(value) + ";";
+	// the same probe done before in this scope
+	size_t loop = in_loop ? loops : 0;
+	for (size_t i = 0; i < rows.size(); ++i) {
+		const Row& row = rows[i];
+		if (row.valid && row.tab == tab && row.index == index && row.key == sig && (row.loop == 0 || row.loop == loop)) {
+			return i;
+		}
+	}
+	rows.push_back({tab, index, sig, loop, true});
+	statements.push_back({Kind::Lookup, tab, rows.size() - 1, 0, "", key});
+	return rows.size() - 1;
+}
+
+void Procedure::let(const string& name, const Proc_Value_Ptr& value) {
+	if (any_of(vars.begin(), vars.end(), [&](const Var& v) {return v.name == name;})) throw ProcedureError("variable " + name + " declared twice");
+	vars.push_back({name, typeOf(value, ""), false});
+	statements.push_back({Kind::Let, 0, 0, 0, name, {value}});
+}
+
+void Procedure::update(size_t row, size_t attr, const Proc_Value_Ptr& value) {
+	size_t tab = rows[row].tab;
+	const Schema::Relation& def = context->getTabDef(tab);
+	for (const Schema::Relation::Index& ind : def.indices) {
+		if (find(ind.fields.begin(), ind.fields.end(), attr) != ind.fields.end()) {
+			throw ProcedureError("update of " + def.name + "." + def.attributes[attr].name + ", which is in index " + ind.name);
+		}
+	}
+	// lookups keyed by this field see a different key from now on
+	string field = signature(procField(row, attr));
+	for (Row& r : rows) {
+		if (r.key.find(field) != string::npos) r.valid = false;
+	}
+	statements.push_back({Kind::Update, tab, row, attr, "", {value}});
+}
+
+void Procedure::insert(size_t tab, const vector<Proc_Value_Ptr>& values) {
+	const Schema::Relation& def = context->getTabDef(tab);
+	if (values.size() != def.attributes.size()) throw ProcedureError("insert into " + def.name + ": " + to_string(values.size()) + " values for " + to_string(def.attributes.size()) + " attributes");
+	statements.push_back({Kind::Insert, tab, 0, 0, "", values});
+}
+
+void Procedure::remove(size_t row) {
+	size_t tab = rows[row].tab;
+	// remove() moves the last row of the table into the gap
+	for (Row& r : rows) {
+		if (r.tab == tab) r.valid = false;
+	}
+	statements.push_back({Kind::Remove, tab, row, 0, "", {}});
+}
+
+void Procedure::beginLoop(const string& array) {
+	if (in_loop) throw ProcedureError("nested loop over " + array);
+	if (!var(array).array) throw ProcedureError("loop over " + array + ", which is not an array");
+	in_loop = true;
+	++loops;
+	statements.push_back({Kind::Loop, 0, 0, 0, array, {}});
+}
+
+void Procedure::endLoop() {
+	if (!in_loop) throw ProcedureError("endLoop() outside of a loop");
+	in_loop = false;
+	for (Row& r : rows) {
+		if (r.loop == loops) r.valid = false;
+	}
+	statements.push_back({Kind::EndLoop, 0, 0, 0, "", {}});
+}
+
+const Procedure::Var& Procedure::var(const string& name) const {
+	auto it = find_if(vars.begin(), vars.end(), [&name](const Var& v) {return v.name == name;});
+	if (it == vars.end()) throw ProcedureError("unknown variable " + name);
+	return *it;
+}
+
+string Procedure::signature(const Proc_Value_Ptr& value) const {
+	switch(value->kind) {
+		case Proc_Value::Kind::Var:
+			return "v(" + value->name + ")";
+		case Proc_Value::Kind::Field:
+			return "f(" + to_string(value->row) + "," + to_string(value->attr) + ")";
+		case Proc_Value::Kind::Constant:
+			return "c(" + value->name + ")";
+		case Proc_Value::Kind::Position:
+			return "p";
+		case Proc_Value::Kind::Add:
+		case Proc_Value::Kind::Sub:
+		case Proc_Value::Kind::Mul:
+			return string(value->kind == Proc_Value::Kind::Add ? "+(" : value->kind == Proc_Value::Kind::Sub ? "-(" : "*(")
+				+ signature(value->children[0]) + "," + signature(value->children[1]) + ")";
+	}
+	return "";
+}
+
+// constants take the type expected by their context
+string Procedure::typeOf(const Proc_Value_Ptr& value, const string& expected) const {
+	switch(value->kind) {
+		case Proc_Value::Kind::Var:
+			return var(value->name).type;
+		case Proc_Value::Kind::Field:
+			return type(context->getAttr(rows[value->row].tab, value->attr));
+		case Proc_Value::Kind::Constant:
+			if (expected.empty()) throw ProcedureError("constant " + value->name + " without a type from its context");
+			return expected;
+		case Proc_Value::Kind::Position:
+			return "Integer";
+		case Proc_Value::Kind::Add:
+		case Proc_Value::Kind::Sub:
+			if (value->children[0]->kind != Proc_Value::Kind::Constant) return typeOf(value->children[0], expected);
+			return typeOf(value->children[1], expected);
+		case Proc_Value::Kind::Mul:
+			// the precision of the product is that of the context
+			if (expected.empty()) throw ProcedureError("product without a type from its context");
+			return expected;
+	}
+	return expected;
+}
+
+// Numeric of the same precision and Integer to Numeric with precision 0 convert
+// through the raw value; other types must match
+string Procedure::generateValue(const Proc_Value_Ptr& value, const string& type) {
+	string from = typeOf(value, type);
+	string res = generateRaw(value, from);
+	if (from == type) return res;
+	if (type.compare(0, 8, "Numeric<") != 0 || precision(from) != precision(type)) throw ProcedureError("no conversion from " + from + " to " + type);
+	return type + "(int64_t(" + res + ".value))";
+}
+
+string Procedure::generateRaw(const Proc_Value_Ptr& value, const string& type) {
+	switch(value->kind) {
+		case Proc_Value::Kind::Var: {
+			const Var& v = var(value->name);
+			if (!v.array) return v.name;
+			if (!in_loop) throw ProcedureError("array " + v.name + " used outside of a loop");
+			return v.name + "[i]";
+		}
+		case Proc_Value::Kind::Field:
+			return column(rows[value->row].tab, value->attr) + "[tid" + to_string(value->row) + "]";
+		case Proc_Value::Kind::Constant: {
+			auto it = constants.find({type, value->name});
+			if (it == constants.end()) {
+				it = constants.insert({{type, value->name}, context->requestName("constant")}).first;
+			}
+			return it->second;
+		}
+		case Proc_Value::Kind::Position:
+			return "Integer(int32_t(i+1))";
+		case Proc_Value::Kind::Add:
+		case Proc_Value::Kind::Sub:
+			return "(" + generateValue(value->children[0], type) + (value->kind == Proc_Value::Kind::Add ? "+" : "-")
+				+ generateValue(value->children[1], type) + ")";
+		case Proc_Value::Kind::Mul: {
+			// on the raw values, constants are Integers; the digits after the point
+			// beyond those of type are cut off
+			string left = typeOf(value->children[0], "Integer");
+			string right = typeOf(value->children[1], "Integer");
+			unsigned digits = precision(left) + precision(right);
+			if (digits < precision(type)) throw ProcedureError("product of " + left + " and " + right + " as " + type);
+			string product = "int64_t(" + generateValue(value->children[0], left) + ".value)*" + generateValue(value->children[1], right) + ".value";
+			if (digits > precision(type)) product = "(" + product + ")/" + "1" + string(digits - precision(type), '0');
+			return type + "(" + (type == "Integer" ? "int32_t(" : "int64_t(") + product + "))";
+		}
+	}
+	return "";
+}
+
+// true if value can be computed before the loop for every position
+bool Procedure::loopInvariant(const Proc_Value_Ptr& value) const {
+	switch(value->kind) {
+		case Proc_Value::Kind::Var:
+			return find_if(params.begin(), params.end(), [&value](const Var& p) {return p.name == value->name;}) != params.end();
+		case Proc_Value::Kind::Field:
+			return false;
+		case Proc_Value::Kind::Constant:
+		case Proc_Value::Kind::Position:
+			return true;
+		case Proc_Value::Kind::Add:
+		case Proc_Value::Kind::Sub:
+		case Proc_Value::Kind::Mul:
+			return loopInvariant(value->children[0]) && loopInvariant(value->children[1]);
+	}
+	return false;
+}
+
+string Procedure::generateKey(const Statement& lookup) {
+	const Schema::Relation& def = context->getTabDef(lookup.tab);
+	const auto& ind = def.indices[rows[lookup.row].index];
+	string key = "Table_" + def.name + "::type_" + ind.name + "(";
+	string delim = "";
+	for (size_t i = 0; i < ind.fields.size(); ++i) {
+		key += delim + generateValue(lookup.values[i], type(def.attributes[ind.fields[i]]));
+		delim = ",";
+	}
+	return key + ")";
+}
+
+// The lookups of the loop starting at statements[begin] that only depend on the
+// parameters and the position, into unpartitioned tables the loop does not insert
+// into or remove from, are done for all positions up front by one lookup_batch() each.
+void Procedure::generateBatches(size_t begin, stringstream& body) {
+	size_t end = begin;
+	while (statements[end].kind != Kind::EndLoop) ++end;
+	const string& array = statements[begin].name;
+	for (size_t pos = begin + 1; pos < end; ++pos) {
+		const Statement& st = statements[pos];
+		if (st.kind != Kind::Lookup) continue;
+		if (!all_of(st.values.begin(), st.values.end(), [this](const Proc_Value_Ptr& v) {return loopInvariant(v);})) continue;
+		bool moved = false;
+		for (size_t other = begin + 1; other < end; ++other) {
+			const Statement& o = statements[other];
+			if ((o.kind == Kind::Insert || o.kind == Kind::Remove) && o.tab == st.tab) moved = true;
+		}
+		const Schema::Relation& def = context->getTabDef(st.tab);
+		if (moved || def.partitioned) continue;
+		const auto& ind = def.indices[rows[st.row].index];
+		string keys = "keys" + to_string(st.row), tids = "tids" + to_string(st.row);
+		// reused from call to call
+		body << "static thread_local vector<Table_" << def.name << "::type_" << ind.name << "> " << keys << ";"
+			<< "static thread_local vector<Tid> " << tids << ";"
+			<< keys << ".resize(" << array << ".size());" << tids << ".resize(" << array << ".size());";
+		body << "for (size_t i=0;i<" << array << ".size();++i) " << keys << "[i]=" << generateKey(st) << ";";
+		body << "lookup_batch(" << context->getTabName(st.tab) << "." << ind.name << "," << keys << ".data()," << array << ".size()," << tids << ".data());";
+		batched[st.row] = true;
+	}
+}
+
+string Procedure::column(size_t tab, size_t attr) const {
+	return context->getTabName(tab) + "." + context->getAttr(tab, attr).name;
+}
+
+// The first statement changing a table; a loop containing it counts from its start.
+size_t Procedure::firstWrite() const {
+	size_t loop = statements.size();
+	for (size_t pos = 0; pos < statements.size(); ++pos) {
+		switch(statements[pos].kind) {
+			case Kind::Loop:
+				loop = pos;
+				break;
+			case Kind::EndLoop:
+				loop = statements.size();
+				break;
+			case Kind::Update:
+			case Kind::Insert:
+			case Kind::Remove:
+				return loop < pos ? loop : pos;
+			default:
+				break;
+		}
+	}
+	return statements.size();
+}
+
+// true if value is the same before the statement at write as wherever it is used
+bool Procedure::stable(const Proc_Value_Ptr& value, size_t write) const {
+	switch(value->kind) {
+		case Proc_Value::Kind::Var:
+			for (size_t pos = write; pos < statements.size(); ++pos) {
+				if (statements[pos].kind == Kind::Let && statements[pos].name == value->name) return false;
+			}
+			return true;
+		case Proc_Value::Kind::Field: {
+			const Row& row = rows[value->row];
+			for (size_t pos = 0; pos < statements.size(); ++pos) {
+				const Statement& st = statements[pos];
+				if (st.kind == Kind::Lookup && st.row == value->row && pos > write) return false;
+				if (st.kind == Kind::Update && st.tab == row.tab && st.attr == value->attr) return false;
+			}
+			return true;
+		}
+		case Proc_Value::Kind::Constant:
+		case Proc_Value::Kind::Position:
+			return true;
+		case Proc_Value::Kind::Add:
+		case Proc_Value::Kind::Sub:
+		case Proc_Value::Kind::Mul:
+			return stable(value->children[0], write) && stable(value->children[1], write);
+	}
+	return false;
+}
+
+// true if value reads a field of row
+static bool readsRow(const Proc_Value_Ptr& value, size_t row) {
+	if (value->kind == Proc_Value::Kind::Field && value->row == row) return true;
+	return any_of(value->children.begin(), value->children.end(), [row](const Proc_Value_Ptr& c) {return readsRow(c, row);});
+}
+
+bool Procedure::used(size_t row) const {
+	return any_of(statements.begin(), statements.end(), [row](const Statement& st) {
+		if ((st.kind == Kind::Update || st.kind == Kind::Remove) && st.row == row) return true;
+		return any_of(st.values.begin(), st.values.end(), [row](const Proc_Value_Ptr& v) {return readsRow(v, row);});
+	});
+}
+
+// a lookup whose tid is not used only checks that the row exists, if fallible
+void Procedure::generateLookup(const Statement& st, bool fallible, stringstream& body) {
+	const Schema::Relation& def = context->getTabDef(st.tab);
+	const auto& ind = def.indices[rows[st.row].index];
+	string tid = "tid" + to_string(st.row);
+	string index = context->getTabName(st.tab) + "." + ind.name;
+	bool needed = used(st.row);
+	if (!needed && !fallible) return;
+	if (batched[st.row]) {
+		if (needed) body << "Tid " << tid << "=tids" << st.row << "[i];";
+		if (fallible) body << "if (tids" << st.row << "[i]==lookup::missing) return false;";
+	} else if ((def.synchronized && !ind.tree) || def.partitioned) {
+		string key = generateKey(st);
+		if (!needed) {
+			body << "{Tid tid=0;if (!" << index << ".find(" << key << ",tid)) return false;}";
+			return;
+		}
+		body << "Tid " << tid << "=0;";
+		if (fallible) {
+			body << "if (!" << index << ".find(" << key << "," << tid << ")) return false;";
+		} else {
+			body << index << ".find(" << key << "," << tid << ");";
+		}
+	} else if (!needed) {
+		body << "if (" << index << ".find(" << generateKey(st) << ")==" << index << ".end()) return false;";
+	} else if (fallible) {
+		string key = generateKey(st);
+		string it = "it" + to_string(st.row);
+		body << "auto " << it << "=" << index << ".find(" << key << ");"
+			<< "if (" << it << "==" << index << ".end()) return false;"
+			<< "Tid " << tid << "=" << it << "->second;";
+	} else {
+		body << "Tid " << tid << "=" << index << ".find(" << generateKey(st) << ")->second;";
+	}
+}
+
+// Runs before the statement at write, the first one changing a table: does the
+// lookups after it that are outside of loops and checks for every position that
+// the lookups in later loops find their row, so that a false return leaves the
+// tables unchanged. Their keys must not depend on the changes, and their tables
+// must not get rows inserted or removed before them.
+void Procedure::generateChecks(size_t write, stringstream& body) {
+	bool looping = false;
+	for (size_t pos = write; pos < statements.size(); ++pos) {
+		const Statement& st = statements[pos];
+		if (st.kind == Kind::Loop) {
+			looping = true;
+			in_loop = true;
+			generateBatches(pos, body);
+			checked[pos] = true;
+			size_t end = pos;
+			while (statements[end].kind != Kind::EndLoop) ++end;
+			stringstream checks;
+			for (size_t p = pos + 1; p < end; ++p) {
+				const Statement& lookup = statements[p];
+				if (lookup.kind != Kind::Lookup) continue;
+				if (!checkable(p, write, end)) throw ProcedureError("lookup in " + context->getTabName(lookup.tab) + " in a loop cannot be checked before the first change");
+				if (batched[lookup.row]) {
+					checks << "if (tids" << lookup.row << "[i]==lookup::missing) return false;";
+					continue;
+				}
+				const Schema::Relation& def = context->getTabDef(lookup.tab);
+				const auto& ind = def.indices[rows[lookup.row].index];
+				string index = context->getTabName(lookup.tab) + "." + ind.name;
+				string key = generateKey(lookup);
+				bool found = (def.synchronized && !ind.tree) || def.partitioned;
+				if (used(lookup.row)) {
+					// the tid found here is the one of the loop, as for batched lookups
+					string tids = "tids" + to_string(lookup.row);
+					body << "static thread_local vector<Tid> " << tids << ";" << tids << ".resize(" << st.name << ".size());";
+					if (found) {
+						checks << "if (!" << index << ".find(" << key << "," << tids << "[i])) return false;";
+					} else {
+						checks << "{auto it=" << index << ".find(" << key << ");if (it==" << index << ".end()) return false;" << tids << "[i]=it->second;}";
+					}
+					batched[lookup.row] = true;
+				} else if (found) {
+					checks << "{Tid tid=0;if (!" << index << ".find(" << key << ",tid)) return false;}";
+				} else {
+					checks << "if (" << index << ".find(" << key << ")==" << index << ".end()) return false;";
+				}
+			}
+			in_loop = false;
+			if (!checks.str().empty()) {
+				body << "for (size_t i=0;i<" << st.name << ".size();++i){" << checks.str() << "}";
+			}
+		} else if (st.kind == Kind::EndLoop) {
+			looping = false;
+		} else if (st.kind == Kind::Lookup && !looping && pos > write) {
+			if (!checkable(pos, write, pos)) throw ProcedureError("lookup in " + context->getTabName(st.tab) + " cannot be checked before the first change");
+			generateLookup(st, true, body);
+			checked[pos] = true;
+		}
+	}
+}
+
+// the lookup at pos, whose row must be found until the statement at end, can be checked before write
+bool Procedure::checkable(size_t pos, size_t write, size_t end) const {
+	const Statement& lookup = statements[pos];
+	for (const Proc_Value_Ptr& value : lookup.values) {
+		if (!stable(value, write)) return false;
+	}
+	for (size_t p = write; p <= end; ++p) {
+		const Statement& st = statements[p];
+		if ((st.kind == Kind::Insert || st.kind == Kind::Remove) && st.tab == lookup.tab) return false;
+	}
+	return true;
+}
+
+// remove() moves the last row of the table into the gap: no row of the table
+// looked up before may be used afterwards, in a loop also in later iterations
+void Procedure::checkRemoves() const {
+	vector<size_t> loop_of(statements.size(), 0);
+	vector<size_t> loop_begin(loops + 1, 0);
+	size_t loop = 0;
+	for (size_t pos = 0, n = 0; pos < statements.size(); ++pos) {
+		if (statements[pos].kind == Kind::Loop) loop_begin[loop = ++n] = pos;
+		loop_of[pos] = loop;
+		if (statements[pos].kind == Kind::EndLoop) loop = 0;
+	}
+	auto uses = [this](const Statement& st, size_t tab, size_t loop) {
+		auto stale = [&](size_t row) {return rows[row].tab == tab && (loop == 0 || rows[row].loop != loop);};
+		if ((st.kind == Kind::Update || st.kind == Kind::Remove) && stale(st.row)) return true;
+		for (size_t row = 0; row < rows.size(); ++row) {
+			if (!stale(row)) continue;
+			if (any_of(st.values.begin(), st.values.end(), [row](const Proc_Value_Ptr& v) {return readsRow(v, row);})) return true;
+		}
+		return false;
+	};
+	for (size_t pos = 0; pos < statements.size(); ++pos) {
+		const Statement& remove = statements[pos];
+		if (remove.kind != Kind::Remove) continue;
+		const string& tab_name = context->getTabName(remove.tab);
+		for (size_t p = pos + 1; p < statements.size(); ++p) {
+			if (uses(statements[p], remove.tab, 0)) throw ProcedureError("a row of " + tab_name + " is used after a remove from it");
+		}
+		// the next iteration of the loop: the rows it looked up itself are new
+		if (loop_of[pos] == 0) continue;
+		for (size_t p = loop_begin[loop_of[pos]]; p <= pos; ++p) {
+			if (uses(statements[p], remove.tab, loop_of[pos])) throw ProcedureError("a row of " + tab_name + " is used after a remove from it in the loop");
+		}
+	}
+}
+
+void Procedure::generate(const string& name) {
+	if (in_loop) throw ProcedureError(name + ": loop without endLoop()");
+	stringstream body;
+	constants.clear();
+	batched.assign(rows.size(), false);
+	checked.assign(statements.size(), false);
+	checkRemoves();
+	used_tabs.clear();
+	changed_tabs.clear();
+	for (const Row& row : rows) {
+		if (context->getTabDef(row.tab).synchronized) used_tabs.insert(row.tab);
+	}
+	for (const Statement& st : statements) {
+		if (st.kind != Kind::Update && st.kind != Kind::Insert && st.kind != Kind::Remove) continue;
+		if (!context->getTabDef(st.tab).synchronized) continue;
+		used_tabs.insert(st.tab);
+		changed_tabs.insert(st.tab);
+	}
+	size_t write = firstWrite();
+	for (size_t pos = 0; pos < statements.size(); ++pos) {
+		const Statement& st = statements[pos];
+		if (pos == write) generateChecks(write, body);
+		switch(st.kind) {
+			case Kind::Lookup:
+				// a lookup done by generateChecks() is not repeated
+				if (!checked[pos]) generateLookup(st, pos < write, body);
+				break;
+			case Kind::Let: {
+				const Var& v = var(st.name);
+				body << "const " << v.type << " " << v.name << "=" << generateValue(st.values[0], v.type) << ";";
+				break;
+			}
+			case Kind::Update: {
+				// the table's on_change hooks see the update as removal and insertion
+				const string& tab_name = context->getTabName(st.tab);
+				const auto& attr = context->getAttr(st.tab, st.attr);
+				string tid = "tid" + to_string(st.row);
+				string value = generateValue(st.values[0], type(attr));
+				string col = column(st.tab, st.attr);
+				body << "{" << type(attr) << " value=" << value << ";";
+				body << "for (auto& hook : " << tab_name << ".on_change) hook(" << tid << ",-1);";
+				if (attr.compressed) {
+					body << col << ".set(" << tid << ",value);";
+				} else {
+					body << col << "[" << tid << "]=value;";
+				}
+				body << "for (auto& hook : " << tab_name << ".on_change) hook(" << tid << ",1);";
+				body << "if (wal::log().enabled()) wal::log().update(Table_" << context->getTabDef(st.tab).name << "::wal_id," << tid << "," << st.attr << ",value);";
+				body << "++" << tab_name << ".version;}";
+				break;
+			}
+			case Kind::Insert: {
+				const auto& attributes = context->getTabDef(st.tab).attributes;
+				body << context->getTabName(st.tab) << (latched(st.tab) ? ".insert_latched(" : ".insert(");
+				string delim = "";
+				for (size_t i = 0; i < attributes.size(); ++i) {
+					body << delim << generateValue(st.values[i], type(attributes[i]));
+					delim = ",";
+				}
+				body << ");";
+				break;
+			}
+			case Kind::Remove:
+				body << context->getTabName(st.tab) << (latched(st.tab) ? ".remove_latched(tid" : ".remove(tid") << st.row << ");";
+				break;
+			case Kind::Loop:
+				in_loop = true;
+				if (!checked[pos]) generateBatches(pos, body);
+				body << "for (size_t i=0;i<" << st.name << ".size();++i){";
+				break;
+			case Kind::EndLoop:
+				in_loop = false;
+				body << "}";
+				break;
+		}
+	}
+	out << "bool " << name << "(";
+	string delim = "";
+	for (const Var& p : params) {
+		out << delim << (p.array ? "const vector<" + p.type + ">& " : p.type + " ") << p.name;
+		delim = ",";
+	}
+	out << "){";
+	// the synchronized tables it uses are latched for the whole procedure, all
+	// in one guard: exclusively those it changes, shared the others
+	if (!used_tabs.empty()) {
+		string exclusive, shared;
+		for (size_t tab : used_tabs) {
+			string& latches = changed_tabs.count(tab) ? exclusive : shared;
+			latches += (latches.empty() ? "&" : ",&") + context->getTabName(tab) + ".latch";
+		}
+		out << "Latch_Guard latches({" << exclusive << "},{" << shared << "});";
+	}
+	// the changes are committed to the write-ahead log on every return; declared
+	// after the latches, so the commit LSN is drawn before they are released
+	out << "wal::Transaction txn;";
+	for (const auto& c : constants) {
+		out << "static const " << c.first.first << " " << c.second << "=" << c.first.first
+			<< "::castString(" << quote(c.first.second) << "," << c.first.second.size() << ");";
+	}
+	out << body.str() << "return true;}" << endl;
+}
@@ -1,5 +1,11 @@
 #pragma once
 #include <sstream>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <new>
+#include <stdexcept>
 #include "Schema.hpp"
 
 
@@ -16,25 +22,99 @@ struct TID_Unit {
 	size_t tab;
 };
 
+class Name_Generator {
+	unordered_map<string,size_t> used_names;
+public:
+	string request_name(const string& suggested) {
+		auto it = used_names.find(suggested);
+		if (it == used_names.end()) {
+			used_names.insert(make_pair(suggested,0));
+			return suggested;
+		} else {
+			size_t num = ++it->second;
+			return suggested + to_string(num);
+		}
+	}
+	void reset() {used_names.clear();}
+};
+
+// state of one plan: table instances, generated names and the tid variable of each instance
 struct Context {
 	struct Tab_Instance {
 		string name;
 		size_t def_pos;
 	};
-	Schema schema;
+	shared_ptr<const Schema> schema;
 	vector<Tab_Instance> tab_instances;
-	Context(Schema& schema) {this->schema = schema;}
+	Name_Generator names;
+	vector<string> tid_names;// by tab instance
+	vector<size_t> field_offsets;// fieldId() = field_offsets[tab] + attr
+	vector<string> field_exprs;// by fieldId; set while a scan holds the field decoded in a local buffer or reads it from a partition
+	vector<string> partition_exprs;// by tab instance; set while a partition-wise join restricts its scan to one partition
+	vector<uint32_t> field_marks;// scratch for mergeFields()
+	uint32_t mark_epoch = 0;
+	Context(const shared_ptr<const Schema>& schema) : schema(schema) {}
+	void setTabInstances(const vector<Tab_Instance>& tab_instances);
+	void reset();
 	const string& getTabName(size_t tab) const {return tab_instances[tab].name;}
-	const Schema::Relation& getTabDef(size_t tab) const {return schema.relations[tab_instances[tab].def_pos];}
+	const Schema::Relation& getTabDef(size_t tab) const {return schema->relations[tab_instances[tab].def_pos];}
 	const Schema::Relation::Attribute& getAttr(size_t tab, size_t attr) const {return getTabDef(tab).attributes[attr];}
+	string requestName(const string& suggested) {return names.request_name(suggested);}
+	void setTidName(size_t tab, const string& name) {tid_names[tab] = name;}
+	const string& getTidName(size_t tab) const {return tid_names[tab];}
+	size_t fieldId(const Field_Unit& field) const {return field_offsets[field.tab] + field.attr;}
+	void setFieldExpr(const Field_Unit& field, const string& expr) {field_exprs[fieldId(field)] = expr;}
+	const string& getFieldExpr(const Field_Unit& field) const {return field_exprs[fieldId(field)];}
+	// pointer to the partition of tab to scan, nullptr if there is none; empty: all partitions
+	void setPartitionExpr(size_t tab, const string& expr) {partition_exprs[tab] = expr;}
+	const string& getPartitionExpr(size_t tab) const {return partition_exprs[tab];}
+	// appends the fields of src that are not yet in dst
+	void mergeFields(vector<Field_Unit>& dst, const vector<Field_Unit>& src);
+};
+
+struct Operator;
+
+// Expression tree for selections; constants are given in the .tbl text format
+struct Expr {
+	enum class Kind : unsigned {Compare, And, Or, Not, Between, In, LikePrefix};
+	enum class Cmp : unsigned {Eq, Ne, Lt, Le, Gt, Ge};
+	Kind kind;
+	Cmp cmp;
+	Field_Unit field;
+	vector<string> constants;
+	vector<shared_ptr<Expr>> children;
+	vector<string> const_names;// set in the copies returned by declareConstants()
+	Expr(Kind kind) : kind(kind), cmp(Cmp::Eq), field({0,0}) {}
+	
+	void collectFields(vector<Field_Unit>& fields) const;
+	unsigned cost(const Context* context) const;
+	// a copy of the tree whose constants are declared in out; generate() and
+	// generateKernel() need such a copy, the tree itself may be shared and stays as is
+	shared_ptr<Expr> declareConstants(Context* context, stringstream& out) const;
+	string generate(const Context* context, const Operator* input) const;
+	// true if a scan can evaluate the expression with the column kernels
+	bool vectorizable(const Context* context) const;
+	// statements narrowing the selection vector sel over the count rows of
+	// column starting at batch; without refine it is built from all count rows
+	string generateKernel(const Context* context, const string& column, const string& batch, const string& sel, const string& count, bool refine) const;
 };
+using Expr_Ptr = shared_ptr<Expr>;
+
+Expr_Ptr exprCompare(const Field_Unit& field, Expr::Cmp cmp, const string& constant);
+Expr_Ptr exprBetween(const Field_Unit& field, const string& low, const string& high);
+Expr_Ptr exprIn(const Field_Unit& field, const vector<string>& constants);
+Expr_Ptr exprLikePrefix(const Field_Unit& field, const string& prefix);
+Expr_Ptr exprAnd(const vector<Expr_Ptr>& children);
+Expr_Ptr exprOr(const vector<Expr_Ptr>& children);
+Expr_Ptr exprNot(const Expr_Ptr& child);
 
 struct Operator {
-	const Context* context = nullptr;
-	Operator* consumer;
+	Context* context = nullptr;
+	Operator* consumer = nullptr;
 	stringstream& out;
 	
-	Operator(const Context* context, stringstream& out): context(context), out(out) {}
+	Operator(Context* context, stringstream& out): context(context), out(out) {}
+	virtual ~Operator() {}
 	void setConsumer(Operator* consumer) {this->consumer = consumer;}
 	
 	virtual const vector<Field_Unit>* getProduced() const = 0;
@@ -43,6 +123,12 @@ struct Operator {
 	virtual void computeTIDs() = 0;
 	virtual void computeProduced() = 0;
 	virtual void computeRequired() = 0;
+	// C++ expression for the value of field in the current tuple
+	virtual string getFieldExpr(const Field_Unit& field) const;
+	// hands evaluation of filter over to this operator; false if it cannot take it
+	virtual bool pushFilter(const Expr_Ptr& filter) {return false;}
+	// appends the tab instances scanned below, whether their tids are kept or not
+	virtual void collectTables(vector<size_t>& tabs) const {}
 	
 	virtual void consume(const Operator* caller) = 0;
 	virtual void produce() = 0;
@@ -50,17 +136,19 @@ struct Operator {
 
 struct OperatorUnary : public Operator {
 	Operator* input = nullptr;	
-	OperatorUnary(const Context* context, stringstream& out) : Operator(context,out) {}
+	OperatorUnary(Context* context, stringstream& out) : Operator(context,out) {}
 	void setInput(Operator* input) {this->input = input;input->setConsumer(this);}
 	void computeTIDs() {input->computeTIDs();}
 	void computeProduced() {input->computeProduced();}
 	void computeRequired() {input->computeRequired();}
+	string getFieldExpr(const Field_Unit& field) const {return input->getFieldExpr(field);}
+	void collectTables(vector<size_t>& tabs) const {input->collectTables(tabs);}
 };
 
 struct OperatorBinary : public Operator {
 	Operator* left = nullptr;
 	Operator* right = nullptr;
-	OperatorBinary(const Context* context, stringstream& out) : Operator(context,out) {}
+	OperatorBinary(Context* context, stringstream& out) : Operator(context,out) {}
 	void setInput(Operator* left, Operator* right) {
 		this->left = left; left->setConsumer(this);
 		this->right=right; right->setConsumer(this);
@@ -68,15 +156,19 @@ struct OperatorBinary : public Operator {
 	void computeTIDs() {left->computeTIDs();right->computeTIDs();}
 	void computeProduced() {left->computeProduced();right->computeProduced();}
 	void computeRequired() {left->computeRequired();right->computeRequired();}
+	void collectTables(vector<size_t>& tabs) const {left->collectTables(tabs);right->collectTables(tabs);}
 };
 
 struct OperatorScan : public Operator {
 	vector<Field_Unit> produced;
 	size_t tab;
 	vector<TID_Unit> TIDs;
+	vector<Expr_Ptr> filters;// evaluated batch-wise with the column kernels, pushed anew by every generation
 	//-------------
-	OperatorScan(const Context* context, stringstream& out) : Operator(context,out) {}
+	OperatorScan(Context* context, stringstream& out) : Operator(context,out) {}
 	void assignTable(size_t tab) {this->tab = tab;}
+	bool pushFilter(const Expr_Ptr& filter);
+	void collectTables(vector<size_t>& tabs) const {tabs.push_back(tab);}
 	
 	const vector<Field_Unit>* getRequired() const {return consumer->getRequired();}
 	const vector<Field_Unit>* getProduced() const {return &produced;}
@@ -87,14 +179,17 @@ struct OperatorScan : public Operator {
 	
 	void consume(const Operator* caller) {}
 	void produce();
+protected:
+	// the loop over the rows of source, a table or a partition, numbered by row
+	void produceRows(const string& source, const string& row);
 };
 
+// prints every field its input produces
 struct OperatorPrint : public OperatorUnary {
-	vector<Field_Unit> required;//nothing
 	//-------------
-	OperatorPrint(const Context* context, stringstream& out) : OperatorUnary(context,out) {}
+	OperatorPrint(Context* context, stringstream& out) : OperatorUnary(context,out) {}
 
-	const vector<Field_Unit>* getRequired() const {return &required;}
+	const vector<Field_Unit>* getRequired() const {return input->getProduced();}
 	const vector<Field_Unit>* getProduced() const {return input->getProduced();}
 	const vector<TID_Unit>* getTIDs() const {return input->getTIDs();}
 	
@@ -102,16 +197,40 @@ struct OperatorPrint : public OperatorUnary {
 	void produce() {input->produce();}
 };
 
+// delivers fields as columnar batches (see Emit.hpp) to the callback named by setBatch()
+struct OperatorEmit : public OperatorUnary {
+	vector<Field_Unit> fields;
+	vector<string> members;// batch member holding fields[i]
+	string batch_typename;
+	string callback_name;
+	string emitter_name;
+	string batch_name;
+	//-------------
+	OperatorEmit(Context* context, stringstream& out) : OperatorUnary(context,out) {}
+	void setFields(const vector<Field_Unit>& fields) {this->fields = fields;}
+	void setBatch(const string& batch_typename, const string& callback_name) {
+		this->batch_typename = batch_typename;
+		this->callback_name = callback_name;
+	}
+	// namespace-scope declaration of the batch struct; call after setFields()
+	string declareBatch();
+
+	const vector<Field_Unit>* getRequired() const {return &fields;}
+	const vector<Field_Unit>* getProduced() const {return &fields;}
+	const vector<TID_Unit>* getTIDs() const {return input->getTIDs();}
+
+	void consume(const Operator* caller);
+	void produce();
+};
+
 struct OperatorSelect : public OperatorUnary {
-	struct Field_Comparison {
-		Field_Unit field;
-		string predicat;
-	};
-	Field_Comparison fc;
+	Expr_Ptr condition;
+	Expr_Ptr residual;// part of condition not pushed into the scan below, may be null
 	vector<Field_Unit> required;
+	string adaptive_name;// set if top-level conjuncts are reordered at runtime
 	//-------------
-	OperatorSelect(const Context* context, stringstream& out) : OperatorUnary(context,out) {}
-	void setFieldComparison(const Field_Unit& field, const string& predicat) {fc.field = field; fc.predicat = predicat;}
+	OperatorSelect(Context* context, stringstream& out) : OperatorUnary(context,out) {}
+	void setCondition(const Expr_Ptr& condition) {this->condition = condition;}
 
 	const vector<Field_Unit>* getRequired() const {return &required;}
 	const vector<Field_Unit>* getProduced() const {return input->getProduced();}
@@ -119,13 +238,13 @@ struct OperatorSelect : public OperatorUnary {
 	void computeRequired();
 	
 	void consume(const Operator* caller);
-	void produce() {input->produce();}
+	void produce();
 };
 
 struct OperatorProjection : public OperatorUnary {
 	vector<Field_Unit> fields;
 	//-------------
-	OperatorProjection(const Context* context, stringstream& out) : OperatorUnary(context,out) {}
+	OperatorProjection(Context* context, stringstream& out) : OperatorUnary(context,out) {}
 	void setFields(const vector<Field_Unit>& fields);
 	
 	const vector<Field_Unit>* getRequired() const {return &fields;}
@@ -137,7 +256,18 @@ struct OperatorProjection : public OperatorUnary {
 	void check();
 };
 
+// Builds a hash table over left and probes it with right. Semi, Anti and Mark
+// joins keep only the distinct left keys and produce right tuples only: Semi
+// those with a match, Anti those without, Mark all of them with the bool
+// variable getMarkName() telling whether there is one. With setGroup() the
+// table is a Join_Hash_Table (HashTable.hpp) and the right tuples are buffered
+// and looked up a group at a time, so that their cache misses overlap. With
+// setMemoryBudget() the table is a spill::Hybrid_Hash_Table (Spill.hpp), which
+// writes partitions beyond the budget to disk together with their right tuples
+// and joins them after the probe.
 struct OperatorHashJoin : public OperatorBinary {
+	enum class Kind : unsigned {Inner, Semi, Anti, Mark};
+	Kind kind = Kind::Inner;
 	vector<Field_Unit> left_fields;
 	vector<Field_Unit> right_fields;
 	vector<Field_Unit> required;
@@ -146,8 +276,31 @@ struct OperatorHashJoin : public OperatorBinary {
 	string tuple_typename;
 	string tuple_tids;
 	string hash_name;
+	string mark_name;
+	bool cached = false;// keep the built table in join_cache() across executions
+	size_t group = 0;// probe tuples looked up together, 0: one at a time
+	string group_name;// buffer of the probe group
+	vector<Field_Unit> probe_fields;// right fields copied into the buffer, their scan values do not outlive the tuple
+	string probe_name;// buffered tuple being resolved, empty outside of the resolution
+	bool partition_wise = false;// join co-partitioned tables partition by partition
+	bool parallel = false;// partitions on all hardware threads, consumer calls serialized
+	string lock_name;// mutex serializing the consumer, empty unless partitions run in parallel
+	size_t budget = 0;// bytes of build table kept in memory, 0: unlimited
+	string spill_name;// right tuple of the hybrid table, also when read back from disk
+	string spill_typename;
 	//-------------
-	OperatorHashJoin(const Context* context, stringstream& out) : OperatorBinary(context,out) {}
+	OperatorHashJoin(Context* context, stringstream& out) : OperatorBinary(context,out) {}
+	void setCached(bool cached) {this->cached = cached;}
+	void setKind(Kind kind) {this->kind = kind;}
+	// collects group probe tuples, prefetches their buckets and chains, then resolves them
+	void setGroup(size_t group) {this->group = group;}
+	// builds and probes per partition where a join key pairs the partitioning attributes
+	// of partitioned tables on both sides; ignored otherwise and for cached joins
+	void setPartitionWise(bool parallel) {this->partition_wise = true;this->parallel = parallel;}
+	// spills build and probe partitions beyond budget bytes, per partition of a partition-wise
+	// join; takes precedence over setGroup(), ignored for cached joins
+	void setMemoryBudget(size_t budget) {this->budget = budget;}
+	const string& getMarkName() const {return mark_name;}
 	void setFields(const vector<Field_Unit>& left_fields, const vector<Field_Unit>& right_fields) {
 		this->left_fields = left_fields;
 		this->right_fields = right_fields;
@@ -159,7 +312,299 @@ struct OperatorHashJoin : public OperatorBinary {
 	const vector<Field_Unit>* getRequired() const {return &required;}
 	const vector<Field_Unit>* getProduced() const {return &produced;}
 	const vector<TID_Unit>* getTIDs() const {return &TIDs;}
+	string getFieldExpr(const Field_Unit& field) const;
 	
 	void consume(const Operator* caller);
 	void produce();
-};
\ No newline at end of file
+protected:
+	void produceJoin(const string& hash_typename);
+	void produceProbe();
+	void produceSpill(const string& hash_typename);
+	void produceMatches(const string& table, const string& entry, const string& hash, const string& key);
+	void produceRecordMatches(const string& record, const string& table, const string& entry);
+	void consumeGroup();
+	void consumeSpill();
+	void copyProbeFields(const string& record);
+	// a left tid of a match is read above the join
+	bool unpacks(const TID_Unit& tid) const;
+	bool spilling() const {return budget && !cached;}
+	size_t partitionKey() const;
+	void producePartitions(const string& hash_typename, size_t key);
+	void handOver();
+};
+struct Sort_Key {
+	Field_Unit field;
+	bool descending;
+};
+
+// pipeline breaker: materializes the fields required above it and the keys as rows
+struct OperatorSort : public OperatorUnary {
+	vector<Sort_Key> keys;
+	vector<Field_Unit> required;
+	vector<Field_Unit> produced;// the input's fields, narrowed to members by computeRequired()
+	vector<Field_Unit> members;// member i of a row holds members[i]
+	vector<TID_Unit> TIDs;// empty: rows are detached from the tables
+	string row_typename;
+	string cmp_typename;
+	string rows_name;
+	string row_name;
+	//-------------
+	OperatorSort(Context* context, stringstream& out) : OperatorUnary(context,out) {}
+	void setKeys(const vector<Sort_Key>& keys) {this->keys = keys;}
+	void computeRequired();
+	void computeProduced();
+	void computeTIDs() {OperatorUnary::computeTIDs();}
+	
+	const vector<Field_Unit>* getRequired() const {return &required;}
+	const vector<Field_Unit>* getProduced() const {return &produced;}
+	const vector<TID_Unit>* getTIDs() const {return &TIDs;}
+	string getFieldExpr(const Field_Unit& field) const;
+	
+	void consume(const Operator* caller);
+	void produce();
+protected:
+	size_t rowMember(const Field_Unit& field) const;
+	void declareRow();
+	string makeRow() const;
+};
+
+// ORDER BY ... LIMIT k: bounded heap, tuples not better than the current
+// k-th row are rejected before a row is built
+struct OperatorTopK : public OperatorSort {
+	size_t limit = 0;
+	//-------------
+	OperatorTopK(Context* context, stringstream& out) : OperatorSort(context,out) {}
+	void setKeys(const vector<Sort_Key>& keys, size_t limit) {this->keys = keys; this->limit = limit;}
+	
+	void consume(const Operator* caller);
+	void produce();
+};
+
+// Runs its input in every worker process of the exchange::Cluster named by
+// setCluster() (see Exchange.hpp), each worker on the tables of its shard, and
+// hands the gathered tuples to its consumer in the coordinator. Everything
+// below the exchange is generated into a function without captures, so it
+// must not refer to locals declared above it. Like a sort, the exchange
+// detaches the tuples from the tables: they travel as rows of the produced fields.
+struct OperatorExchange : public OperatorUnary {
+	vector<Field_Unit> required;
+	vector<Field_Unit> produced;// member i of a row holds produced[i]
+	vector<TID_Unit> TIDs;// empty
+	string cluster_name;
+	string row_typename;
+	string row_name;
+	string sender_name;
+	//-------------
+	OperatorExchange(Context* context, stringstream& out) : OperatorUnary(context,out) {}
+	// expression of the exchange::Cluster in the generated code
+	void setCluster(const string& cluster_name) {this->cluster_name = cluster_name;}
+	void computeRequired();
+	void computeProduced();
+	
+	const vector<Field_Unit>* getRequired() const {return &required;}
+	const vector<Field_Unit>* getProduced() const {return &produced;}
+	const vector<TID_Unit>* getTIDs() const {return &TIDs;}
+	string getFieldExpr(const Field_Unit& field) const;
+	
+	void consume(const Operator* caller);
+	void produce();
+};
+
+// a single row of a table, addressed by the tid variable of its tab instance;
+// lets expressions be generated outside of a scan loop
+struct OperatorRow : public Operator {
+	vector<Field_Unit> produced;
+	vector<TID_Unit> TIDs;
+	//-------------
+	OperatorRow(Context* context, stringstream& out) : Operator(context,out) {}
+	void assignRow(size_t tab, const string& tid_name);
+	
+	const vector<Field_Unit>* getRequired() const {return &produced;}
+	const vector<Field_Unit>* getProduced() const {return &produced;}
+	const vector<TID_Unit>* getTIDs() const {return &TIDs;}
+	void computeTIDs() {}
+	void computeProduced() {}
+	void computeRequired() {}
+	
+	void consume(const Operator* caller) {}
+	void produce() {}
+};
+
+// join between neighbours of a view chain: fields of tabs[i] = fields of tabs[i+1]
+struct View_Join {
+	vector<Field_Unit> left;
+	vector<Field_Unit> right;
+};
+
+// Generates a struct maintaining the join tabs[0] x tabs[1] x ... incrementally.
+// Each table keeps the values the view needs from its rows in hash tables
+// keyed by its join keys; a row inserted into or removed from a base table
+// (Table_::on_change) is joined against that state, so the cost of a change
+// does not depend on the table sizes. The result counts the field tuples.
+struct Incremental_View {
+	Context* context;
+	stringstream& out;
+	vector<size_t> tabs;
+	vector<View_Join> joins;// joins[i] connects tabs[i] and tabs[i+1]
+	vector<Expr_Ptr> filters;// by position in tabs, may be null
+	vector<Field_Unit> fields;
+	//-------------
+	Incremental_View(Context* context, stringstream& out) : context(context), out(out) {}
+	void setChain(const vector<size_t>& tabs, const vector<View_Join>& joins);
+	void setFilter(size_t tab, const Expr_Ptr& filter);
+	void setFields(const vector<Field_Unit>& fields) {this->fields = fields;}
+	void generate(const string& name);
+private:
+	vector<vector<Field_Unit>> rows;// by position: fields of tabs[i] kept in the state
+	size_t position(size_t tab) const;
+	string rowField(size_t pos, const string& row, const Field_Unit& field) const;
+	string rowKey(size_t pos, const string& row, const vector<Field_Unit>& key) const;
+	void generateDelta(size_t pos);
+};
+
+// Value in a stored procedure: a parameter or local variable, a field of a
+// row looked up before, a constant in the .tbl text format, the position in
+// the enclosing loop (an Integer counting from 1), or a sum, difference or
+// product; a product takes the type of its context and treats constants as Integers
+struct Proc_Value {
+	enum class Kind : unsigned {Var, Field, Constant, Position, Add, Sub, Mul};
+	Kind kind;
+	string name;// Var: variable, Constant: text
+	size_t row;// Field: handle from Procedure::lookup()
+	size_t attr;
+	vector<shared_ptr<Proc_Value>> children;
+	Proc_Value(Kind kind) : kind(kind), row(0), attr(0) {}
+};
+using Proc_Value_Ptr = shared_ptr<Proc_Value>;
+
+Proc_Value_Ptr procVar(const string& name);
+Proc_Value_Ptr procField(size_t row, size_t attr);
+Proc_Value_Ptr procConstant(const string& text);
+Proc_Value_Ptr procPosition();
+Proc_Value_Ptr procAdd(const Proc_Value_Ptr& left, const Proc_Value_Ptr& right);
+Proc_Value_Ptr procSub(const Proc_Value_Ptr& left, const Proc_Value_Ptr& right);
+Proc_Value_Ptr procMul(const Proc_Value_Ptr& left, const Proc_Value_Ptr& right);
+
+// a procedure that cannot be generated correctly
+struct ProcedureError : runtime_error {
+	ProcedureError(const string& m) : runtime_error(m) {}
+};
+
+// Generates a transaction as one function bool name(parameters) working on
+// the columns directly: a lookup probes the index once with the key built in
+// place and keeps the tid, fields of looked-up rows are read and updated
+// through it, and a lookup repeating an earlier one reuses its tid. The
+// function returns false when a lookup finds no row; all lookups are checked
+// before the first change, so the tables are then unchanged. Lookups after a
+// change must not be keyed by changed or later values, nor look into a table
+// rows are inserted into or removed from before them, and rows of a table are
+// not used after a remove from it. Procedures may run concurrently on
+// synchronized tables. They latch the tables they use for the whole run,
+// exclusively those they change and shared the others, so procedures changing
+// the same table run one after the other. Violations throw ProcedureError.
+struct Procedure {
+	Context* context;
+	stringstream& out;
+	//-------------
+	Procedure(Context* context, stringstream& out) : context(context), out(out) {}
+	// parameter of the type of like; an array is passed as const vector<type>&
+	void addParam(const string& name, const Field_Unit& like, bool array = false);
+	// the row with key in the index-th index of tab; for a non-unique index any matching row
+	size_t lookup(size_t tab, size_t index, const vector<Proc_Value_Ptr>& key);
+	// local variable holding value as of this statement
+	void let(const string& name, const Proc_Value_Ptr& value);
+	// attr must not be part of an index
+	void update(size_t row, size_t attr, const Proc_Value_Ptr& value);
+	void insert(size_t tab, const vector<Proc_Value_Ptr>& values);
+	void remove(size_t row);
+	// the statements up to endLoop() run once per element of the array parameter;
+	// array parameters are only used inside the loop, loops do not nest. Lookups
+	// in the loop keyed by parameters only are batched (see Lookup.hpp).
+	void beginLoop(const string& array);
+	void endLoop();
+	void generate(const string& name);
+private:
+	enum class Kind : unsigned {Lookup, Let, Update, Insert, Remove, Loop, EndLoop};
+	struct Statement {
+		Kind kind;
+		size_t tab;
+		size_t row;
+		size_t attr;
+		string name;
+		vector<Proc_Value_Ptr> values;
+	};
+	struct Var {
+		string name;
+		string type;
+		bool array;
+	};
+	struct Row {
+		size_t tab;
+		size_t index;
+		string key;// signature() of the key values
+		size_t loop;// 0 outside of loops, else the number of the loop defining it
+		bool valid;// may be reused by later lookups
+	};
+	vector<Var> params;
+	vector<Var> vars;// parameters and local variables
+	vector<Row> rows;
+	vector<Statement> statements;
+	size_t loops = 0;
+	bool in_loop = false;
+	map<pair<string,string>,string> constants;// (type, text) -> name
+	vector<bool> batched;// by row: looked up for the whole loop before it starts
+	vector<bool> checked;// by statement: done by generateChecks()
+	set<size_t> used_tabs;// synchronized tables latched by the procedure
+	set<size_t> changed_tabs;// of those, the ones latched exclusively
+
+	// the procedure holds the table's latch exclusively
+	bool latched(size_t tab) const {return changed_tabs.count(tab) != 0;}
+	void checkRemoves() const;
+
+	const Var& var(const string& name) const;
+	string signature(const Proc_Value_Ptr& value) const;
+	string typeOf(const Proc_Value_Ptr& value, const string& expected) const;
+	// value as an expression of type
+	string generateValue(const Proc_Value_Ptr& value, const string& type);
+	string generateRaw(const Proc_Value_Ptr& value, const string& type);
+	bool loopInvariant(const Proc_Value_Ptr& value) const;
+	// the index key of a lookup statement
+	string generateKey(const Statement& lookup);
+	void generateBatches(size_t begin, stringstream& body);
+	size_t firstWrite() const;
+	bool stable(const Proc_Value_Ptr& value, size_t write) const;
+	bool checkable(size_t pos, size_t write, size_t end) const;
+	// some statement reads or changes the row
+	bool used(size_t row) const;
+	void generateLookup(const Statement& st, bool fallible, stringstream& body);
+	void generateChecks(size_t write, stringstream& body);
+	string column(size_t tab, size_t attr) const;
+};
+
+// Owns the operators of one plan in an arena. reset() destroys them but keeps
+// the arena blocks, so one long-lived Plan generates query after query
+// without going back to the heap for the operator tree.
+struct Plan {
+	Context context;
+	stringstream out;
+	//-------------
+	Plan(const shared_ptr<const Schema>& schema) : context(schema) {}
+	Plan(const Plan&) = delete;
+	Plan& operator=(const Plan&) = delete;
+	~Plan() {reset();}
+	template<class Op> Op* make() {
+		Op* op = new (allocate(sizeof(Op), alignof(Op))) Op(&context, out);
+		operators.push_back(op);
+		return op;
+	}
+	// plan analysis and code generation for the tree below root
+	void generate(Operator* root);
+	void reset();
+private:
+	static const size_t block_size = 1 << 14;
+	vector<unique_ptr<char[]>> blocks;
+	size_t block = 0;
+	size_t offset = 0;
+	vector<Operator*> operators;
+	void* allocate(size_t size, size_t align);
+};
@@ -2,9 +2,15 @@
 #include <memory>
 #include <cstdio>
 #include <sstream>
+#include <chrono>
+#include <tuple>
 #include "Schema.hpp"
 #include "Parser.hpp"
 #include "code_generation.h"
+#include "Concurrent.hpp"
+#include "Kernels.hpp"
+#include "Lookup.hpp"
+#include "Driver.hpp"
 
 using namespace std;
 //extern Table_warehouse warehouse;
@@ -16,9 +22,9 @@ using namespace std;
 //extern Table_orderline orderline;
 //extern Table_item item;
 //extern Table_stock stock;
-string create_query(Schema* schema) {
-	Context context(*schema);
-	context.tab_instances = {
+static void prelude(Plan& plan) {
+	plan.reset();
+	plan.context.setTabInstances({
 		 {"warehouse", 0}
 		,{"district",1}
 		,{"customer",2}
@@ -28,58 +34,682 @@ string create_query(Schema* schema) {
 		,{"orderline",6}
 		,{"item",7}
 		,{"stock",8}
-	};
-	stringstream out;
+	});
+	stringstream& out = plan.out;
 	
 	out << "#include \"Types.hpp\""   << endl;
 	out << "#include \"schema_1.hpp\""   << endl;
+	out << "#include \"Allocator.hpp\"" << endl;
+	out << "#include \"Adaptive.hpp\"" << endl;
+	out << "#include \"Sort.hpp\""     << endl;
+	out << "#include \"Kernels.hpp\""  << endl;
+	out << "#include \"Emit.hpp\""     << endl;
+	out << "#include \"JoinCache.hpp\"" << endl;
+	out << "#include \"HashTable.hpp\"" << endl;
+	out << "#include \"Spill.hpp\"" << endl;
+	out << "#include \"Lookup.hpp\"" << endl;
+	out << "#include \"Exchange.hpp\"" << endl;
 	out << "#include <iostream>"      << endl;
 	out << "#include <unordered_map>" << endl;
+	out << "#include <unordered_set>" << endl;
+	out << "#include <cstring>"       << endl;
+	out << "#include <mutex>"         << endl;
 	out << "using namespace std;"     << endl;
-	out << "bool pred(const Varchar<16>& s) {return s.len > 0 && s.value[0]=='B';}";
-	out << "void run_query() {" << endl;
+}
+
+// customers named 'B%' joined with their orders and order lines;
+// returns the join on top, which produces all their attributes
+static Operator* customer_orders_join(Plan& plan) {
+	auto scanCust = plan.make<OperatorScan>();
+	auto scanOrder = plan.make<OperatorScan>();
+	auto scanOl = plan.make<OperatorScan>();
+	auto selectCust = plan.make<OperatorSelect>();
+	auto hjCustOrder = plan.make<OperatorHashJoin>();
+	auto hjCustOrderOl = plan.make<OperatorHashJoin>();
 	
-	OperatorScan scanCust(&context, out);
-	OperatorScan scanOrder(&context, out);
-	OperatorScan scanOl(&context, out);
-	OperatorSelect selectCust(&context, out);
-	OperatorPrint printData(&context, out);
-	OperatorProjection projectFields(&context, out);
-	OperatorHashJoin hjCustOrder(&context, out);
-	OperatorHashJoin hjCustOrderOl(&context, out);
-	
-	printData.setInput(&projectFields);
-	projectFields.setInput(&hjCustOrderOl);
-	hjCustOrderOl.setInput(&hjCustOrder,&scanOl);
-	hjCustOrder.setInput(&selectCust,&scanOrder);
-	selectCust.setInput(&scanCust);
-	
-	scanCust.assignTable(2);
-	scanOrder.assignTable(5);
-	scanOl.assignTable(6);
-	selectCust.setFieldComparison({2,5},"pred");
-	hjCustOrderOl.setFields(
+	hjCustOrderOl->setInput(hjCustOrder,scanOl);
+	hjCustOrder->setInput(selectCust,scanOrder);
+	selectCust->setInput(scanCust);
+	
+	scanCust->assignTable(2);
+	scanOrder->assignTable(5);
+	scanOl->assignTable(6);
+	//c_last like 'B%'
+	selectCust->setCondition(exprLikePrefix({2,5},"B"));
+	hjCustOrderOl->setFields(
 		 {{5,2},{5,1},{5,0}}
 		,{{6,2},{6,1},{6,0}});
-	hjCustOrder.setFields(
+	hjCustOrder->setFields(
 		 {{2,2},{2,1},{2,0}}
 		,{{5,2},{5,1},{5,3}});
+	// customers and orders change rarely compared to the report
+	hjCustOrderOl->setCached(true);
+	hjCustOrder->setCached(true);
+	// the order lines are the largest probe side
+	hjCustOrderOl->setGroup(16);
+	return hjCustOrderOl;
+}
+
+// the same, projected; returns the projection on top
+static Operator* customer_orders(Plan& plan) {
+	auto projectFields = plan.make<OperatorProjection>();
+	projectFields->setInput(customer_orders_join(plan));
+	//c_first, c_last, o_all_local, ol_amount 
+	projectFields->setFields({{2,3},{2,5},{5,7},{6,8}});
+	return projectFields;
+}
+
+string create_query(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	out << "void run_query() {" << endl;
+	
+	auto printData = plan.make<OperatorPrint>();
+	printData->setInput(customer_orders(plan));
+	plan.generate(printData);
+	
+	out << "}" << endl;
+	
+	// no customer field is printed, so the cached build side keeps no customer
+	// tids; its table still depends on the customers named 'B%'
+	out << "void run_order_amounts() {" << endl;
+	auto projectAmounts = plan.make<OperatorProjection>();
+	auto printAmounts = plan.make<OperatorPrint>();
+	printAmounts->setInput(projectAmounts);
+	projectAmounts->setInput(customer_orders_join(plan));
+	//o_all_local, ol_amount
+	projectAmounts->setFields({{5,7},{6,8}});
+	plan.generate(printAmounts);
+	
+	out << "}" << endl;
+	return out.str();
+}
+
+// the same query, delivered as columnar batches to a callback
+string create_emit_query(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	
+	auto emitData = plan.make<OperatorEmit>();
+	emitData->setInput(customer_orders(plan));
+	emitData->setFields({{2,3},{2,5},{5,7},{6,8}});
+	emitData->setBatch("Result_Batch", "callback");
+	out << emitData->declareBatch() << endl;
+	out << "void run_query(const function<void(const Result_Batch&)>& callback) {" << endl;
+	plan.generate(emitData);
+	
+	out << "}" << endl;
+	return out.str();
+}
+
+// the same query as an incrementally maintained view
+string create_view_query(Plan& plan) {
+	prelude(plan);
+	Incremental_View view(&plan.context, plan.out);
+	view.setChain({2,5,6}, {
+		 {{{2,2},{2,1},{2,0}}, {{5,2},{5,1},{5,3}}}
+		,{{{5,2},{5,1},{5,0}}, {{6,2},{6,1},{6,0}}}
+	});
+	//c_last like 'B%'
+	view.setFilter(2, exprLikePrefix({2,5},"B"));
 	//c_first, c_last, o_all_local, ol_amount 
-	projectFields.setFields({{2,3},{2,5},{5,7},{6,8}});
+	view.setFields({{2,3},{2,5},{5,7},{6,8}});
+	view.generate("View_customer_orders");
+	return plan.out.str();
+}
+
+// the same query on the shards of a cluster of worker processes: every worker
+// joins its own customers, orders and order lines, which works as long as all
+// tables are sharded by warehouse; the coordinator prints the gathered tuples.
+// check_sharded() compares it with run_query() of create_query() on 1 to n
+// workers, each keeping its shard of the tables loaded before, and again
+// after a run whose consumer throws while the workers are still producing.
+string create_sharded_query(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	out << "#include <sstream>" << endl;
+	out << "#include <algorithm>" << endl;
+	out << "void run_query(exchange::Cluster& cluster) {" << endl;
+	
+	auto printData = plan.make<OperatorPrint>();
+	auto gatherData = plan.make<OperatorExchange>();
+	printData->setInput(gatherData);
+	gatherData->setInput(customer_orders(plan));
+	gatherData->setCluster("cluster");
+	plan.generate(printData);
+	
+	out << "}" << endl;
+	// warehouse w belongs to shard (w-1) % shards; the tables' w_id is their third attribute
+	out << "void keep_shard(size_t shard,size_t shards){";
+	for (size_t tab : {2, 5, 6}) {
+		const string& name = plan.context.getTabName(tab);
+		const string& w_id = plan.context.getAttr(tab, 2).name;
+		// partitioned tables number the rows of each partition from 0
+		string table = name;
+		if (plan.context.getTabDef(tab).partitioned) {
+			out << "for (size_t p=0;p<" << name << ".partitions.size();++p){auto& part=" << name << ".partitions[p];";
+			table = "part";
+		}
+		out << "for (Tid tid=" << table << ".size();tid-->0;) "
+			<< "if (size_t(" << table << "." << w_id << "[tid].value-1)%shards!=shard) " << table << ".remove(tid);";
+		if (table != name) out << "}";
+	}
+	out << "}" << endl;
+	// the printed rows in order; the log must be disabled, as the workers remove rows
+	out << "void run_query();" << endl;
+	out << "bool check_sharded(size_t workers){"
+		<< "auto capture=[](const function<void()>& run){"
+		<< "stringstream rows;streambuf* old=cout.rdbuf(rows.rdbuf());"
+		<< "try {run();} catch (...) {cout.rdbuf(old);throw;}"
+		<< "cout.rdbuf(old);"
+		<< "vector<string> res;for (string row;getline(rows,row);) res.push_back(row);"
+		<< "sort(res.begin(),res.end());return res;};"
+		<< "vector<string> expected=capture([]{run_query();});"
+		<< "bool same=true;"
+		<< "for (size_t n=1;n<=workers;++n){"
+		<< "exchange::Cluster cluster(n,keep_shard);"
+		<< "vector<string> rows=capture([&cluster]{run_query(cluster);});"
+		<< "cout<<n<<\" workers: \"<<rows.size()<<\" rows, \"<<(rows==expected?\"same as\":\"different from\")<<\" run_query()\"<<endl;"
+		<< "same&=rows==expected;"
+		// more records than a ring holds, so the workers block until they are cancelled
+		<< "bool thrown=false;"
+		<< "try {cluster.gather<uint64_t>(+[](exchange::Sender<uint64_t>& sender){for (uint64_t i=0;i<(uint64_t(1)<<24);++i) sender.push(i);},"
+		<< "[](uint64_t){throw runtime_error(\"consumer failed\");});} "
+		<< "catch (const runtime_error& e) {thrown=string(e.what())==\"consumer failed\";}"
+		<< "rows=capture([&cluster]{run_query(cluster);});"
+		<< "cout<<n<<\" workers after a failed consumer: \"<<rows.size()<<\" rows, \"<<(thrown&&rows==expected?\"same as\":\"different from\")<<\" run_query()\"<<endl;"
+		<< "same&=thrown&&rows==expected;}"
+		<< "return same;}" << endl;
+	return out.str();
+}
+
+// the order lines of customers named 'B%', by customer name and then by
+// amount, and the 100 largest ones; the rows of the sorts only hold the
+// printed fields, not everything the joins produce. The same by name only,
+// printing all fields of customer_orders()
+string create_sort_query(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	out << "void run_customer_orders_sorted() {" << endl;
+	{
+		auto sortData = plan.make<OperatorSort>();
+		auto projectFields = plan.make<OperatorProjection>();
+		auto printData = plan.make<OperatorPrint>();
+		printData->setInput(projectFields);
+		projectFields->setInput(sortData);
+		sortData->setInput(customer_orders_join(plan));
+		//c_last, c_first, ol_amount desc
+		sortData->setKeys({{{2,5},false},{{2,3},false},{{6,8},true}});
+		//c_first, c_last, ol_amount
+		projectFields->setFields({{2,3},{2,5},{6,8}});
+		plan.generate(printData);
+	}
+	out << "}" << endl;
+	
+	// printed directly, so the rows hold the projected fields that are not keys too
+	out << "void run_customer_orders_by_name() {" << endl;
+	{
+		auto sortData = plan.make<OperatorSort>();
+		auto printData = plan.make<OperatorPrint>();
+		printData->setInput(sortData);
+		sortData->setInput(customer_orders(plan));
+		//c_last, c_first
+		sortData->setKeys({{{2,5},false},{{2,3},false}});
+		plan.generate(printData);
+	}
+	out << "}" << endl;
 	
-	printData.computeProduced();
-	printData.computeRequired();
-	printData.computeTIDs();
+	out << "void run_top_order_lines() {" << endl;
+	{
+		auto topData = plan.make<OperatorTopK>();
+		auto projectFields = plan.make<OperatorProjection>();
+		auto printData = plan.make<OperatorPrint>();
+		printData->setInput(projectFields);
+		projectFields->setInput(topData);
+		topData->setInput(customer_orders_join(plan));
+		//ol_amount desc, c_last, c_first limit 100
+		topData->setKeys({{{6,8},true},{{2,5},false},{{2,3},false}}, 100);
+		//c_first, c_last, ol_amount
+		projectFields->setFields({{2,3},{2,5},{6,8}});
+		plan.generate(printData);
+	}
+	out << "}" << endl;
+	return out.str();
+}
+
+// customers named 'B%' with (Semi) or without (Anti) an order: the orders
+// only contribute their distinct customer keys, kept in memory up to 64 MB
+static Operator* customers_by_orders(Plan& plan, OperatorHashJoin::Kind kind) {
+	auto scanCust = plan.make<OperatorScan>();
+	auto scanOrder = plan.make<OperatorScan>();
+	auto selectCust = plan.make<OperatorSelect>();
+	auto projectFields = plan.make<OperatorProjection>();
+	auto hjOrderCust = plan.make<OperatorHashJoin>();
 	
-	projectFields.check();
+	projectFields->setInput(hjOrderCust);
+	hjOrderCust->setInput(scanOrder,selectCust);
+	selectCust->setInput(scanCust);
 	
-	printData.produce();
+	scanCust->assignTable(2);
+	scanOrder->assignTable(5);
+	//c_last like 'B%'
+	selectCust->setCondition(exprLikePrefix({2,5},"B"));
+	hjOrderCust->setKind(kind);
+	hjOrderCust->setMemoryBudget(size_t(64) << 20);
+	hjOrderCust->setFields(
+		 {{5,2},{5,1},{5,3}}
+		,{{2,2},{2,1},{2,0}});
+	//c_first, c_last
+	projectFields->setFields({{2,3},{2,5}});
+	return projectFields;
+}
+
+string create_semi_query(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	out << "void run_customers_with_orders() {" << endl;
+	auto printWith = plan.make<OperatorPrint>();
+	printWith->setInput(customers_by_orders(plan, OperatorHashJoin::Kind::Semi));
+	plan.generate(printWith);
+	out << "}" << endl;
+	
+	out << "void run_customers_without_orders() {" << endl;
+	auto printWithout = plan.make<OperatorPrint>();
+	printWithout->setInput(customers_by_orders(plan, OperatorHashJoin::Kind::Anti));
+	plan.generate(printWithout);
+	out << "}" << endl;
+	return out.str();
+}
+
+// on tables partitioned by warehouse: the orders of one warehouse, which only
+// scans its partition, and all customers with their orders, joined warehouse by
+// warehouse in parallel; unpartitioned tables are scanned and joined as a whole
+string create_partition_query(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	out << "void run_warehouse_orders() {" << endl;
+	{
+		auto scanOrder = plan.make<OperatorScan>();
+		auto selectOrder = plan.make<OperatorSelect>();
+		auto projectFields = plan.make<OperatorProjection>();
+		auto printData = plan.make<OperatorPrint>();
+		printData->setInput(projectFields);
+		projectFields->setInput(selectOrder);
+		selectOrder->setInput(scanOrder);
+		scanOrder->assignTable(5);
+		//o_w_id = 1
+		selectOrder->setCondition(exprCompare({5,2}, Expr::Cmp::Eq, "1"));
+		//o_d_id, o_id, o_c_id
+		projectFields->setFields({{5,1},{5,0},{5,3}});
+		plan.generate(printData);
+	}
+	out << "}" << endl;
 	
+	out << "void run_customer_orders() {" << endl;
+	{
+		auto scanCust = plan.make<OperatorScan>();
+		auto scanOrder = plan.make<OperatorScan>();
+		auto hjCustOrder = plan.make<OperatorHashJoin>();
+		auto projectFields = plan.make<OperatorProjection>();
+		auto printData = plan.make<OperatorPrint>();
+		printData->setInput(projectFields);
+		projectFields->setInput(hjCustOrder);
+		hjCustOrder->setInput(scanCust,scanOrder);
+		scanCust->assignTable(2);
+		scanOrder->assignTable(5);
+		hjCustOrder->setFields(
+			 {{2,2},{2,1},{2,0}}
+			,{{5,2},{5,1},{5,3}});
+		hjCustOrder->setPartitionWise(true);
+		//c_first, c_last, o_all_local
+		projectFields->setFields({{2,3},{2,5},{5,7}});
+		plan.generate(printData);
+	}
+	out << "}" << endl;
+	return out.str();
+}
+
+// TPC-C new-order and payment as stored procedures, and a driver running them
+// in the standard 45:43 ratio. Parameters are drawn assuming dense ids from 1
+// and the same number of districts per warehouse and customers per district.
+string create_tpcc(Plan& plan) {
+	prelude(plan);
+	stringstream& out = plan.out;
+	out << "#include \"Driver.hpp\"" << endl;
+	out << "#include <atomic>" << endl;
+	{
+		Procedure proc(&plan.context, out);
+		proc.addParam("w_id", {0,0});
+		proc.addParam("d_id", {1,0});
+		proc.addParam("c_id", {2,0});
+		proc.addParam("entry_d", {5,4});
+		proc.addParam("ol_cnt", {5,6});
+		proc.addParam("item_id", {7,0}, true);
+		proc.addParam("supply_w_id", {6,5}, true);
+		proc.addParam("quantity", {6,7}, true);
+		proc.lookup(0, 0, {procVar("w_id")});
+		size_t d = proc.lookup(1, 0, {procVar("w_id"), procVar("d_id")});
+		proc.lookup(2, 0, {procVar("w_id"), procVar("d_id"), procVar("c_id")});
+		proc.let("o_id", procField(d, 10));
+		proc.update(d, 10, procAdd(procVar("o_id"), procConstant("1")));
+		proc.insert(5, {procVar("o_id"), procVar("d_id"), procVar("w_id"), procVar("c_id"), procVar("entry_d"), procConstant("0"), procVar("ol_cnt"), procConstant("1")});
+		proc.insert(4, {procVar("o_id"), procVar("d_id"), procVar("w_id")});
+		proc.beginLoop("item_id");
+		size_t i = proc.lookup(7, 0, {procVar("item_id")});
+		size_t s = proc.lookup(8, 0, {procVar("supply_w_id"), procVar("item_id")});
+		proc.update(s, 2, procSub(procField(s, 2), procVar("quantity")));
+		proc.update(s, 13, procAdd(procField(s, 13), procVar("quantity")));
+		proc.update(s, 14, procAdd(procField(s, 14), procConstant("1")));
+		// ol_amount = ol_quantity * i_price
+		proc.insert(6, {procVar("o_id"), procVar("d_id"), procVar("w_id"), procPosition(), procVar("item_id"), procVar("supply_w_id"), procVar("entry_d"), procVar("quantity"), procMul(procVar("quantity"), procField(i, 3)), procField(s, 3)});
+		proc.endLoop();
+		proc.generate("new_order");
+	}
+	{
+		Procedure proc(&plan.context, out);
+		proc.addParam("w_id", {0,0});
+		proc.addParam("d_id", {1,0});
+		proc.addParam("c_w_id", {2,2});
+		proc.addParam("c_d_id", {2,1});
+		proc.addParam("c_id", {2,0});
+		proc.addParam("date", {3,5});
+		proc.addParam("amount", {3,6});
+		size_t w = proc.lookup(0, 0, {procVar("w_id")});
+		size_t d = proc.lookup(1, 0, {procVar("w_id"), procVar("d_id")});
+		size_t c = proc.lookup(2, 0, {procVar("c_w_id"), procVar("c_d_id"), procVar("c_id")});
+		proc.update(w, 8, procAdd(procField(w, 8), procVar("amount")));
+		proc.update(d, 9, procAdd(procField(d, 9), procVar("amount")));
+		proc.update(c, 16, procSub(procField(c, 16), procVar("amount")));
+		proc.update(c, 17, procAdd(procField(c, 17), procVar("amount")));
+		proc.update(c, 18, procAdd(procField(c, 18), procConstant("1")));
+		proc.insert(3, {procVar("c_id"), procVar("c_d_id"), procVar("c_w_id"), procVar("d_id"), procVar("w_id"), procVar("date"), procVar("amount"), procConstant("payment")});
+		proc.generate("payment");
+	}
+	// the parameters of both transactions are drawn by lambdas shared with check_new_order()
+	auto draw_transactions = [](stringstream& out) {
+		out << "const int32_t warehouses=warehouse.size();" << endl;
+		out << "const int32_t districts=district.size()/warehouses;" << endl;
+		out << "const int32_t customers=customer.size()/district.size();" << endl;
+		out << "const int32_t items=item.size();" << endl;
+		out << "auto uniform=[](Transaction_Mix::Rng& rng,int32_t n){return Integer(int32_t(rng()%n+1));};" << endl;
+		out << "auto new_order_txn=[=](Transaction_Mix::Rng& rng){"
+			<< "Integer w_id=uniform(rng,warehouses);"
+			<< "size_t ol_cnt=5+rng()%11;"
+			<< "vector<Integer> item_id(ol_cnt),supply_w_id(ol_cnt,w_id);"
+			<< "vector<Numeric<2,0>> quantity(ol_cnt);"
+			<< "for (size_t i=0;i<ol_cnt;++i){item_id[i]=uniform(rng,items);quantity[i]=Numeric<2,0>(int64_t(rng()%10+1));}"
+			<< "return new_order(w_id,uniform(rng,districts),uniform(rng,customers),Timestamp(0),Numeric<2,0>(int64_t(ol_cnt)),item_id,supply_w_id,quantity);"
+			<< "};" << endl;
+		out << "auto payment_txn=[=](Transaction_Mix::Rng& rng){"
+			<< "Integer w_id=uniform(rng,warehouses);"
+			<< "Integer d_id=uniform(rng,districts);"
+			<< "return payment(w_id,d_id,w_id,d_id,uniform(rng,customers),Timestamp(0),Numeric<6,2>(int64_t(100+rng()%499901)));"
+			<< "};" << endl;
+	};
+	// procedures return before their commit is durable: with the log enabled, every
+	// 16th transaction of a thread waits for the thread's commits, so that throughput
+	// and latencies include group commit, and the rest is waited for after the run
+	auto durable_mix = [](stringstream& out, const string& run) {
+		out << "auto durable=[](const Transaction_Mix::Transaction& txn){return [txn](Transaction_Mix::Rng& rng){"
+			<< "bool res=txn(rng);thread_local size_t n=0;"
+			<< "if (++n%16==0&&wal::log().enabled()) wal::log().wait(wal::last_commit());"
+			<< "return res;};};" << endl;
+		out << "Transaction_Mix mix;" << endl;
+		out << "mix.add(\"new_order\",45,durable(new_order_txn));" << endl;
+		out << "mix.add(\"payment\",43,durable(payment_txn));" << endl;
+		out << run << endl;
+		out << "if (wal::log().enabled()){auto begin=chrono::steady_clock::now();wal::log().flush();"
+			<< "cout<<\"  remaining commits durable after \"<<chrono::duration<double,micro>(chrono::steady_clock::now()-begin).count()<<\" us\"<<endl;}" << endl;
+	};
+	out << "void run_tpcc(size_t transactions) {" << endl;
+	draw_transactions(out);
+	durable_mix(out, "mix.run(transactions,cout);");
+	out << "}" << endl;
+	// the same mix on 1, 2, 4, ... threads up to the number of cores, transactions
+	// each, so that it includes the latches of the tables and procedures; threads
+	// need synchronized tables
+	out << "void run_tpcc_threads(size_t transactions) {" << endl;
+	draw_transactions(out);
+	out << "const size_t cores=max<size_t>(2,thread::hardware_concurrency());" << endl;
+	out << "for (size_t threads=1;;threads=min(2*threads,cores)){" << endl;
+	durable_mix(out, "mix.run(transactions,threads,cout);");
+	out << "if (threads==cores) break;}" << endl;
+	out << "}" << endl;
+	// new_order on threads threads, transactions each, alongside payment on the
+	// same districts: every committed new_order takes the next order id of its
+	// district and inserts one order. Threads need synchronized tables.
+	const string& next_o_id = plan.context.getAttr(1, 10).name;
+	out << "bool check_new_order(size_t threads,size_t transactions) {" << endl;
+	draw_transactions(out);
+	// partitioned tables number the rows of each partition from 0
+	if (plan.context.getTabDef(1).partitioned) {
+		out << "auto next_o_ids=[]{int64_t sum=0;for (size_t p=0;p<district.partitions.size();++p){auto& part=district.partitions[p];"
+			<< "for (Tid tid=0;tid<part.size();++tid) sum+=part." << next_o_id << "[tid].value;}return sum;};" << endl;
+	} else {
+		out << "auto next_o_ids=[]{int64_t sum=0;for (Tid tid=0;tid<district.size();++tid) sum+=district." << next_o_id << "[tid].value;return sum;};" << endl;
+	}
+	out << "int64_t next_before=next_o_ids();size_t orders_before=order.size();" << endl;
+	out << "atomic<size_t> committed{0};" << endl;
+	out << "Transaction_Mix mix;" << endl;
+	out << "mix.add(\"new_order\",1,[&](Transaction_Mix::Rng& rng){if (!new_order_txn(rng)) return false;++committed;return true;});" << endl;
+	out << "mix.add(\"payment\",1,payment_txn);" << endl;
+	out << "mix.run(transactions,threads,cout);" << endl;
+	out << "int64_t advanced=next_o_ids()-next_before;size_t inserted=order.size()-orders_before;" << endl;
+	out << "cout<<committed<<\" new_orders committed, order ids advanced by \"<<advanced<<\", \"<<inserted<<\" orders inserted\"<<endl;" << endl;
+	out << "return advanced==int64_t(committed)&&inserted==committed;" << endl;
 	out << "}" << endl;
 	return out.str();
 }
 
+// generates the query repeatedly from one Plan and reports plans per second
+void bench_generator(const shared_ptr<const Schema>& schema, size_t iterations) {
+	Plan plan(schema);
+	size_t bytes = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i) {
+		bytes += create_query(plan).size();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << iterations << " plans in " << seconds << " s: "
+	     << iterations / seconds << " plans/s, "
+	     << bytes / iterations << " bytes/plan" << endl;
+}
+
+// parses the schema file repeatedly and reports parser throughput
+void bench_parser(const string& fileName, size_t iterations) {
+	ifstream in(fileName, ios::binary | ios::ate);
+	size_t bytes = in.tellg();
+	size_t tables = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i) {
+		Parser p(fileName);
+		tables += p.parse()->relations.size();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << iterations << " parses in " << seconds << " s: "
+	     << bytes * iterations / seconds / (1 << 20) << " MB/s, "
+	     << tables / seconds << " tables/s" << endl;
+}
+
+// lookups and inserts on one Concurrent_Hash_Index by 1, 2, 4, ... threads up to
+// the number of cores, each running transactions. Generated tables and procedures
+// latch the whole table around their index updates, so this bounds the index
+// alone; run_tpcc_threads() of the generated driver measures the tables.
+void bench_threads(size_t transactions) {
+	using Index = Concurrent_Hash_Index<uint64_t,uint64_t,hash<uint64_t>,equal_to<uint64_t>,true>;
+	const uint64_t preloaded = 1 << 20;
+	const size_t cores = max(2u, thread::hardware_concurrency());
+	for (size_t threads = 1; ; threads = min(2 * threads, cores)) {
+		Index index;
+		for (uint64_t key = 0; key < preloaded; ++key) index.insert(key, key);
+		Transaction_Mix mix;
+		mix.add("find", 90, [&index, preloaded](Transaction_Mix::Rng& rng) {
+			uint64_t value;
+			return index.find(rng() % preloaded, value);
+		});
+		// fresh keys from a range large enough to hardly ever repeat
+		mix.add("insert", 10, [&index, preloaded](Transaction_Mix::Rng& rng) {
+			return index.insert(preloaded + rng() % (uint64_t(1) << 48), 0);
+		});
+		mix.run(transactions, threads, cout);
+		if (threads == cores) break;
+	}
+}
+
+// runs each column kernel over rows values in batches, as generated scans do,
+// in its scalar version and in the one dispatched to on this machine
+void bench_kernels(size_t rows) {
+	const size_t rounds = 10;
+	const size_t batch = kernels::batch_size;
+	mt19937_64 rng(42);
+	vector<int32_t> ints(rows);
+	vector<int64_t> longs(rows);
+	for (size_t i = 0; i < rows; ++i) {
+		ints[i] = int32_t(rng() % 1000);
+		longs[i] = int64_t(rng() % 1000000);
+	}
+	// Char<16> rows, every other one starting with the prefix
+	struct Chars {char value[16];};
+	vector<Chars> chars(rows);
+	for (size_t i = 0; i < rows; ++i) memcpy(chars[i].value, i % 2 ? "BARBARBARBARBARB" : "OUGHTOUGHTOUGHTO", 16);
+	// 13-bit codes with a word of padding
+	const unsigned bits = 13;
+	vector<uint64_t> words(rows * bits / 64 + 2, 0);
+	for (size_t i = 0; i < rows; ++i) {
+		uint64_t code = rng() % (1 << bits);
+		size_t pos = i * bits;
+		words[pos / 64] |= code << (pos % 64);
+		if (pos % 64 + bits > 64) words[pos / 64 + 1] |= code >> (64 - pos % 64);
+	}
+	vector<uint32_t> sel(batch), codes(batch);
+	vector<int32_t> int_out(batch);
+	vector<int64_t> long_out(batch);
+	// refine and gather work on the rows below 500, about half
+	vector<uint32_t> half(rows);
+	vector<size_t> half_count((rows + batch - 1) / batch);
+	for (size_t b = 0; b < rows; b += batch) {
+		half_count[b / batch] = kernels::scalar::select(&ints[b], min(batch, rows - b), kernels::Cmp::Lt, int32_t(500), &half[b]);
+	}
+	const char* levels[] = {"scalar", "AVX2", "AVX-512"};
+	cout << "dispatching to " << levels[unsigned(kernels::level())] << " versions" << endl;
+	uint64_t sink = 0;
+	// kernel(b, n) processes the n rows of the batch at row b
+	using Kernel = function<uint64_t(size_t,size_t)>;
+	auto measure = [&](const string& name, const Kernel& scalar, const Kernel& dispatched) {
+		cout << name << ":";
+		for (const Kernel* kernel : {&scalar, &dispatched}) {
+			auto start = chrono::steady_clock::now();
+			for (size_t round = 0; round < rounds; ++round) {
+				for (size_t b = 0; b < rows; b += batch) sink += (*kernel)(b, min(batch, rows - b));
+			}
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			cout << (kernel == &scalar ? " scalar " : ", dispatched ") << rows * rounds / seconds / 1e6 << " M rows/s";
+		}
+		cout << endl;
+	};
+	using kernels::Cmp;
+	measure("select int32", [&](size_t b, size_t n) {return kernels::scalar::select(&ints[b], n, Cmp::Lt, int32_t(500), sel.data());},
+		[&](size_t b, size_t n) {return kernels::select(&ints[b], n, Cmp::Lt, int32_t(500), sel.data());});
+	measure("select int64", [&](size_t b, size_t n) {return kernels::scalar::select(&longs[b], n, Cmp::Lt, int64_t(500000), sel.data());},
+		[&](size_t b, size_t n) {return kernels::select(&longs[b], n, Cmp::Lt, int64_t(500000), sel.data());});
+	measure("refine int32", [&](size_t b, size_t) {return kernels::scalar::refine(&ints[b], &half[b], half_count[b / batch], Cmp::Ge, int32_t(250), sel.data());},
+		[&](size_t b, size_t) {return kernels::refine(&ints[b], &half[b], half_count[b / batch], Cmp::Ge, int32_t(250), sel.data());});
+	measure("gather int32", [&](size_t b, size_t) {kernels::scalar::gather(&ints[b], &half[b], half_count[b / batch], int_out.data()); return uint64_t(int_out[0]);},
+		[&](size_t b, size_t) {kernels::gather(&ints[b], &half[b], half_count[b / batch], int_out.data()); return uint64_t(int_out[0]);});
+	measure("gather int64", [&](size_t b, size_t) {kernels::scalar::gather(&longs[b], &half[b], half_count[b / batch], long_out.data()); return uint64_t(long_out[0]);},
+		[&](size_t b, size_t) {kernels::gather(&longs[b], &half[b], half_count[b / batch], long_out.data()); return uint64_t(long_out[0]);});
+	measure("sum int32", [&](size_t b, size_t n) {return uint64_t(kernels::scalar::sum(&ints[b], n));},
+		[&](size_t b, size_t n) {return uint64_t(kernels::sum(&ints[b], n));});
+	measure("sum int64", [&](size_t b, size_t n) {return uint64_t(kernels::scalar::sum(&longs[b], n));},
+		[&](size_t b, size_t n) {return uint64_t(kernels::sum(&longs[b], n));});
+	measure("min int32", [&](size_t b, size_t n) {return uint64_t(kernels::scalar::min(&ints[b], n));},
+		[&](size_t b, size_t n) {return uint64_t(kernels::min(&ints[b], n));});
+	measure("max int64", [&](size_t b, size_t n) {return uint64_t(kernels::scalar::max(&longs[b], n));},
+		[&](size_t b, size_t n) {return uint64_t(kernels::max(&longs[b], n));});
+	measure("prefix char", [&](size_t b, size_t n) {return kernels::scalar::equal_bytes(reinterpret_cast<const char*>(&chars[b]), sizeof(Chars), 0, n, "BAR", 3, sel.data());},
+		[&](size_t b, size_t n) {return kernels::prefix_char(&chars[b], n, "BAR", 3, sel.data());});
+	measure("unpack 13 bits", [&](size_t b, size_t n) {kernels::scalar::unpack(&words[b * bits / 64], bits, 0, n, codes.data()); return uint64_t(codes[0]);},
+		[&](size_t b, size_t n) {kernels::unpack(&words[b * bits / 64], bits, n, codes.data()); return uint64_t(codes[0]);});
+	// keeps the results alive
+	if (sink == 42) cout << endl;
+}
 
+// looks up random two-part keys like (w_id, i_id), about a quarter of them
+// present, in an unordered_map and a Concurrent_Hash_Index of entries rows, one
+// by one with find() and with lookup_batch() over batches of 10 and 1000 keys
+void bench_lookup(size_t entries) {
+	using Key = tuple<uint32_t,uint32_t>;
+	struct Hash {
+		size_t operator()(const Key& key) const {
+			return (uint64_t(get<0>(key)) * 0x9e3779b97f4a7c15ull) ^ hash<uint32_t>()(get<1>(key));
+		}
+	};
+	const size_t lookups = 1 << 22;
+	mt19937_64 rng(42);
+	auto random_key = [&rng, entries]() {
+		uint64_t key = rng() % (4 * entries);
+		return Key(uint32_t(key % 16), uint32_t(key / 16));
+	};
+	vector<Key> keys(lookups);
+	for (Key& key : keys) key = random_key();
+	vector<uint64_t> tids(lookups);
+	uint64_t sink = 0;
+	auto measure = [&](const string& name, const function<size_t()>& run) {
+		auto start = chrono::steady_clock::now();
+		size_t found = run();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		sink += tids[lookups / 2];
+		cout << "  " << name << ": " << seconds << " s, "
+		     << lookups / seconds / 1e6 << " M lookups/s, " << found << " found" << endl;
+	};
+	auto batched = [&](const function<size_t(const Key*, size_t, uint64_t*)>& batch, size_t size) {
+		size_t found = 0;
+		for (size_t b = 0; b < lookups; b += size) found += batch(&keys[b], min(size, lookups - b), &tids[b]);
+		return found;
+	};
+	{
+		unordered_map<Key,uint64_t,Hash> index;
+		for (size_t tid = 0; tid < entries; ++tid) index.emplace(random_key(), tid);
+		cout << "unordered_map, " << index.size() << " entries:" << endl;
+		measure("find", [&]() {
+			size_t found = 0;
+			for (size_t i = 0; i < lookups; ++i) {
+				auto it = index.find(keys[i]);
+				tids[i] = it == index.end() ? lookup::missing : it->second;
+				found += it != index.end();
+			}
+			return found;
+		});
+		for (size_t size : {10, 1000}) {
+			measure("lookup_batch by " + to_string(size), [&]() {
+				return batched([&](const Key* k, size_t n, uint64_t* t) {return lookup_batch(index, k, n, t);}, size);
+			});
+		}
+	}
+	{
+		using Index = Concurrent_Hash_Index<Key,uint64_t,Hash,equal_to<Key>,true>;
+		Index index;
+		size_t size = 0;
+		for (size_t tid = 0; tid < entries; ++tid) size += index.insert(random_key(), tid);
+		cout << "Concurrent_Hash_Index, " << size << " entries:" << endl;
+		measure("find", [&]() {
+			size_t found = 0;
+			for (size_t i = 0; i < lookups; ++i) {
+				bool hit = index.find(keys[i], tids[i]);
+				if (!hit) tids[i] = lookup::missing;
+				found += hit;
+			}
+			return found;
+		});
+		for (size_t size : {10, 1000}) {
+			measure("lookup_batch by " + to_string(size), [&]() {
+				return batched([&](const Key* k, size_t n, uint64_t* t) {return lookup_batch(index, k, n, t);}, size);
+			});
+		}
+	}
+	// keeps the results alive
+	if (sink == 42) cout << endl;
+}
 
 int main(int argc, char* argv[]) {
 	if (argc != 4) {
@@ -88,14 +718,52 @@ int main(int argc, char* argv[]) {
 		     << " <output dir>"
 		     << " <filename without extension>"
 		     << endl
+		     << "       " << argv[0]
+		     << " <schema file> --bench <iterations>"
+		     << endl
+		     << "       " << argv[0]
+		     << " <schema file> --bench-parse <iterations>"
+		     << endl
+		     << "       " << argv[0]
+		     << " <schema file> --bench-threads <transactions per thread>"
+		     << endl
+		     << "       " << argv[0]
+		     << " <schema file> --bench-kernels <rows>"
+		     << endl
+		     << "       " << argv[0]
+		     << " <schema file> --bench-lookup <entries>"
+		     << endl
 		     << argc << endl;
 		return -1;
 	}
 
 	Parser p(argv[1]);
 	try {
-		unique_ptr<Schema> schema = p.parse();
+		if (string(argv[2]) == "--bench-parse") {
+			bench_parser(argv[1], stoul(argv[3]));
+			return 0;
+		}
+		if (string(argv[2]) == "--bench-kernels") {
+			bench_kernels(stoul(argv[3]));
+			return 0;
+		}
+		if (string(argv[2]) == "--bench-lookup") {
+			bench_lookup(stoul(argv[3]));
+			return 0;
+		}
+		if (string(argv[2]) == "--bench-threads") {
+			bench_threads(stoul(argv[3]));
+			return 0;
+		}
+		
+		shared_ptr<const Schema> schema = p.parse();
 		
+		if (string(argv[2]) == "--bench") {
+			bench_generator(schema, stoul(argv[3]));
+			return 0;
+		}
+		
+		Plan plan(schema);
 		ofstream out;
 
 		string path = string(argv[2],strlen(argv[2])) + "/";
@@ -103,11 +771,42 @@ int main(int argc, char* argv[]) {
 		
 		
 		out.open(path  + name + ".cpp");
-		out << create_query(schema.get());
+		out << create_query(plan);
 		out.close();		
 		
+		out.open(path  + name + "_emit.cpp");
+		out << create_emit_query(plan);
+		out.close();
+		
+		out.open(path  + name + "_view.cpp");
+		out << create_view_query(plan);
+		out.close();
+		
+		out.open(path  + name + "_semi.cpp");
+		out << create_semi_query(plan);
+		out.close();
+		
+		out.open(path  + name + "_sort.cpp");
+		out << create_sort_query(plan);
+		out.close();
+		
+		out.open(path  + name + "_partition.cpp");
+		out << create_partition_query(plan);
+		out.close();
+		
+		out.open(path  + name + "_sharded.cpp");
+		out << create_sharded_query(plan);
+		out.close();
+		
+		out.open(path  + name + "_tpcc.cpp");
+		out << create_tpcc(plan);
+		out.close();
+		
 	} catch (ParserError& e) {
 		cerr << e.what() << endl;
+	} catch (ProcedureError& e) {
+		cerr << e.what() << endl;
+		return 1;
 	}
 	return 0;
 }